@@ -14,6 +14,205 @@ VALUE mASV;            /* module Amalgalite::SQLite3::Version   */
 VALUE eAS_Error;       /* class  Amalgalite::SQLite3::Error     */
 VALUE cAS_Stat;        /* class  Amalgalite::SQLite3::Stat      */
 
+/* release the GVL around blocking SQLite calls, see SQLite3.release_gvl= */
+static int am_release_gvl = 1;
+
+/*----------------------------------------------------------------------
+ * GVL handling
+ *---------------------------------------------------------------------*/
+
+#ifndef HAVE_RUBY_THREAD_HAS_GVL_P
+/* set while this thread has released the GVL to run SQLite */
+static AM_THREAD_LOCAL int am_without_gvl = 0;
+
+/* a function to run without, or with, the GVL and its argument */
+typedef struct am_gvl_call {
+    void *(*func)(void *);
+    void  *data;
+} am_gvl_call;
+
+static void* amalgalite_released_gvl( void *arg )
+{
+    am_gvl_call *call = (am_gvl_call*)arg;
+    void        *result;
+
+    am_without_gvl = 1;
+    result = call->func( call->data );
+    am_without_gvl = 0;
+    return result;
+}
+
+static void* amalgalite_acquired_gvl( void *arg )
+{
+    am_gvl_call *call = (am_gvl_call*)arg;
+    void        *result;
+
+    am_without_gvl = 0;
+    result = call->func( call->data );
+    am_without_gvl = 1;
+    return result;
+}
+#endif
+
+/*
+ * Does the current thread hold the GVL.  Ruby exports ruby_thread_has_gvl_p
+ * without declaring it in a public header, so where extconf.rb does not find
+ * it the extension keeps track of the GVL it releases itself.
+ */
+int amalgalite_has_gvl( void )
+{
+#ifdef HAVE_RUBY_THREAD_HAS_GVL_P
+    return ruby_thread_has_gvl_p();
+#else
+    return ruby_native_thread_p() && !am_without_gvl;
+#endif
+}
+
+/*
+ * Run func( data ) without the GVL, with rb_thread_call_without_gvl2 if
+ * checked, so that pending interrupts are left to the caller, and
+ * rb_thread_call_without_gvl otherwise.
+ */
+static void* amalgalite_without_gvl( void *(*func)(void *), void *data, rb_unblock_function_t *ubf, void *ubf_data, int checked )
+{
+#ifndef HAVE_RUBY_THREAD_HAS_GVL_P
+    am_gvl_call call;
+
+    call.func = func;
+    call.data = data;
+    func      = amalgalite_released_gvl;
+    data      = &call;
+#endif
+    if ( checked ) {
+        return rb_thread_call_without_gvl2( func, data, ubf, ubf_data );
+    }
+    return rb_thread_call_without_gvl( func, data, ubf, ubf_data );
+}
+
+/*
+ * The unblocking function used while SQLite runs without the GVL.  Ruby calls
+ * this when the thread needs to be interrupted, for Thread#kill, Thread#raise,
+ * signals, etc.  Interrupting the database makes the blocking call return
+ * SQLITE_INTERRUPT at the earliest opportunity.
+ */
+static void amalgalite_ubf_interrupt( void *db )
+{
+    sqlite3_interrupt( (sqlite3*) db );
+}
+
+/*
+ * The unblocking function for work that sqlite3_interrupt cannot stop, it
+ * raises the flag the work checks between its steps.
+ */
+static void amalgalite_ubf_flag( void *flag )
+{
+    *(volatile int*)flag = 1;
+}
+
+/* the thread local holding an exception raised by a callback */
+static ID id_callback_error;
+
+/*
+ * Keep the exception a ruby callback raised while SQLite was running, it is
+ * raised by amalgalite_raise_callback_error once SQLite has returned.  Raising
+ * it from within the callback would unwind through SQLite and leave the
+ * database mutex held.
+ */
+void amalgalite_save_callback_error( VALUE error )
+{
+    VALUE thread = rb_thread_current( );
+
+    if ( Qnil == rb_thread_local_aref( thread, id_callback_error ) ) {
+        rb_thread_local_aset( thread, id_callback_error, error );
+    }
+}
+
+/*
+ * Raise the exception saved by amalgalite_save_callback_error, if any
+ */
+void amalgalite_raise_callback_error( void )
+{
+    VALUE thread = rb_thread_current( );
+    VALUE error  = rb_thread_local_aref( thread, id_callback_error );
+
+    if ( Qnil != error ) {
+        rb_thread_local_aset( thread, id_callback_error, Qnil );
+        rb_exc_raise( error );
+    }
+}
+
+/*
+ * Invoke func( data ) without holding the GVL so that other ruby threads may
+ * run while SQLite is working.  This is only done if the SQLite library is
+ * threadsafe, otherwise func is invoked directly.  If the ruby thread is
+ * interrupted while func is running then the db is interrupted.  An exception
+ * raised by a callback during func is raised once func has returned.
+ */
+void* amalgalite_call_without_gvl( void *(*func)(void *), void *data, sqlite3 *db )
+{
+    void *result;
+
+    if ( am_release_gvl && sqlite3_threadsafe() ) {
+        result = amalgalite_without_gvl( func, data, amalgalite_ubf_interrupt, (void*)db, 0 );
+
+        /* the memory SQLite used meanwhile could not be reported to the GC */
+        am_memory_report_to_gc( );
+    } else {
+        result = func( data );
+    }
+    amalgalite_raise_callback_error( );
+    return result;
+}
+
+/*
+ * Invoke func( data ) without holding the GVL, for work such as file io that
+ * sqlite3_interrupt cannot stop.  If the ruby thread is interrupted then
+ * *interrupted is set and func must return at its next step.  func must
+ * return non-NULL, it is not invoked at all if an interrupt is already
+ * pending, and *interrupted is set then too.  The pending interrupt is not
+ * handled here, the caller cleans up what func was working on and then calls
+ * rb_thread_check_ints.
+ */
+void* amalgalite_call_without_gvl_flagged( void *(*func)(void *), void *data, volatile int *interrupted )
+{
+    void *result;
+
+    *interrupted = 0;
+    if ( am_release_gvl && sqlite3_threadsafe() ) {
+        result = amalgalite_without_gvl( func, data, amalgalite_ubf_flag, (void*)interrupted, 1 );
+        if ( NULL == result ) {
+            *interrupted = 1;
+        }
+        am_memory_report_to_gc( );
+    } else {
+        result = func( data );
+    }
+    return result;
+}
+
+/*
+ * Invoke func( data ) while holding the GVL.  This is used by all the
+ * callbacks that SQLite invokes, since they may be called from within
+ * amalgalite_call_without_gvl.
+ */
+void* amalgalite_call_with_gvl( void *(*func)(void *), void *data )
+{
+#ifndef HAVE_RUBY_THREAD_HAS_GVL_P
+    am_gvl_call call;
+#endif
+
+    if ( amalgalite_has_gvl() ) {
+        return func( data );
+    }
+#ifndef HAVE_RUBY_THREAD_HAS_GVL_P
+    call.func = func;
+    call.data = data;
+    return rb_thread_call_with_gvl( amalgalite_acquired_gvl, &call );
+#else
+    return rb_thread_call_with_gvl( func, data );
+#endif
+}
+
 /*----------------------------------------------------------------------
  * module methods for Amalgalite::SQLite3
  *---------------------------------------------------------------------*/
@@ -36,6 +235,34 @@ VALUE am_sqlite3_threadsafe(VALUE self)
     }
 }
 
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.release_gvl? -> true or false
+ *
+ * Is the GVL released while SQLite steps statements, prepares statements,
+ * executes batches and runs backups.  This is only ever true if the SQLite
+ * library is threadsafe.
+ *
+ */
+VALUE am_sqlite3_get_release_gvl(VALUE self)
+{
+    return ( am_release_gvl && sqlite3_threadsafe() ) ? Qtrue : Qfalse;
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.release_gvl = true or false
+ *
+ * Turn on or off releasing the GVL during blocking SQLite calls.  It is on by
+ * default.
+ *
+ */
+VALUE am_sqlite3_set_release_gvl(VALUE self, VALUE flag)
+{
+    am_release_gvl = RTEST( flag ) ? 1 : 0;
+    return flag;
+}
+
 /*
  * call-seq:
  *  Amalgalite::SQLite.temp_directory -> String or nil
@@ -152,6 +379,52 @@ VALUE am_sqlite3_complete(VALUE self, VALUE args)
     return ( result > 0 ) ? Qtrue : Qfalse;
 }
 
+/* the sqlite3_status64 counters reported by SQLite3.status_counters */
+static const struct {
+    int         op;
+    const char *name;
+} am_status_counters[] = {
+    { SQLITE_STATUS_MEMORY_USED,        "memory_used"        },
+    { SQLITE_STATUS_PAGECACHE_USED,     "pagecache_used"     },
+    { SQLITE_STATUS_PAGECACHE_OVERFLOW, "pagecache_overflow" },
+    { SQLITE_STATUS_MALLOC_SIZE,        "malloc_size"        },
+    { SQLITE_STATUS_PARSER_STACK,       "parser_stack"       },
+    { SQLITE_STATUS_PAGECACHE_SIZE,     "pagecache_size"     },
+    { SQLITE_STATUS_MALLOC_COUNT,       "malloc_count"       },
+};
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.status_counters( reset = false ) -> Hash
+ *
+ * Return every sqlite3_status64 counter of the SQLite library in a single
+ * call, as a Hash of the counter name, as a Symbol, to a [ current,
+ * highwater ] pair.  If reset is true the highwater marks are reset after
+ * they are read.
+ *
+ */
+VALUE am_sqlite3_status_counters( int argc, VALUE *argv, VALUE self )
+{
+    sqlite3_int64 current;
+    sqlite3_int64 highwater;
+    VALUE         reset;
+    VALUE         counters = rb_hash_new();
+    size_t        i;
+    int           rc;
+
+    rb_scan_args( argc, argv, "01", &reset );
+
+    for ( i = 0 ; i < sizeof( am_status_counters ) / sizeof( am_status_counters[0] ) ; i++ ) {
+        rc = sqlite3_status64( am_status_counters[i].op, &current, &highwater, RTEST( reset ) );
+        if ( SQLITE_OK != rc ) {
+            rb_raise(eAS_Error, "Failure to retrieve status for %s : [SQLITE_ERROR %d] \n", am_status_counters[i].name, rc);
+        }
+        rb_hash_aset( counters, ID2SYM( rb_intern( am_status_counters[i].name ) ),
+                      rb_assoc_new( SQLINT64_2NUM( current ), SQLINT64_2NUM( highwater ) ) );
+    }
+    return counters;
+}
+
 /*
  * call-seq:
  *    Amalgalite::SQLite3::Stat.update!( reset = false ) -> nil
@@ -305,7 +578,11 @@ void Init_amalgalite()
     rb_define_module_function(mAS, "randomness", am_sqlite3_randomness,1);
     rb_define_module_function(mAS, "temp_directory", am_sqlite3_get_temp_directory, 0);
     rb_define_module_function(mAS, "temp_directory=", am_sqlite3_set_temp_directory, 1);
+    rb_define_module_function(mAS, "release_gvl?", am_sqlite3_get_release_gvl, 0);
+    rb_define_module_function(mAS, "release_gvl=", am_sqlite3_set_release_gvl, 1);
+    id_callback_error = rb_intern("__amalgalite_callback_error");
 
+    rb_define_module_function(mAS, "status_counters", am_sqlite3_status_counters, -1); /* in amalgalite.c */
     rb_define_module_function(mAS, "escape", am_sqlite3_escape, 1);
     rb_define_module_function(mAS, "quote", am_sqlite3_quote, 1);
 
@@ -340,6 +617,10 @@ void Init_amalgalite()
     Init_amalgalite_database( );
     Init_amalgalite_statement( );
     Init_amalgalite_blob( );
+    Init_amalgalite_datetime( );
+    Init_amalgalite_histogram( );
+    Init_amalgalite_memory( );
+    Init_amalgalite_page_cache( );
 
     /*
      * initialize sqlite itself
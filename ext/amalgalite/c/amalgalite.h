@@ -9,22 +9,107 @@
 #define __AMALGALITE_H__
 
 #include "ruby.h"
+#include "ruby/thread.h"
+#include "ruby/encoding.h"
 #include "sqlite3.h"
 #include <string.h>
 
 /* wrapper struct around the sqlite3 opaque pointer */
+/* the last schema cookie read from one of the databases of a connection */
+typedef struct am_schema_cookie {
+  sqlite3_stmt *stmt;         /* persistent PRAGMA <db>.schema_version */
+  unsigned int  data_version; /* SQLITE_FCNTL_DATA_VERSION when version was read */
+  int           version;
+  int           valid;
+} am_schema_cookie;
+
+/* the databases whose schema cookie is kept in am_sqlite3 */
+#define AM_SCHEMA_COOKIE_MAIN 0
+#define AM_SCHEMA_COOKIE_TEMP 1
+#define AM_SCHEMA_COOKIE_COUNT 2
+
+/* the rowids inserted or updated in one table, collected by an update hook */
+typedef struct am_rowid_tracker {
+  char          *zDb;
+  char          *zTable;
+  sqlite3_int64 *rowids;
+  long           count;
+  long           capacity;
+  int            out_of_memory;
+} am_rowid_tracker;
+
+/* the totals of every execution of the statements with one fingerprint, the
+ * normalized sql of the statement.  Times are in nanoseconds */
+typedef struct am_query_stat {
+  char          *fingerprint;
+  unsigned int   hash;
+  sqlite3_int64  calls;
+  sqlite3_int64  total_time;
+  sqlite3_int64  min_time;
+  sqlite3_int64  max_time;
+  sqlite3_int64  rows;
+  sqlite3_int64  fullscan_steps;
+} am_query_stat;
+
+/* a statement between its SQLITE_TRACE_STMT and SQLITE_TRACE_PROFILE events */
+typedef struct am_query_run {
+  sqlite3_stmt  *stmt;
+  sqlite3_int64  rows;
+  int            fullscan_start;
+} am_query_run;
+
+/* the number of statements of one connection that may be running at once */
+#define AM_QUERY_STATS_RUNS 16
+
+/* the most fingerprints kept, executions of others are not recorded */
+#define AM_QUERY_STATS_MAX 4096
+
+/* the statistics of a connection, an open addressed table of fingerprints */
+typedef struct am_query_stats {
+  am_query_stat *stats;
+  long           capacity;
+  long           count;
+  int            collecting;
+  am_query_run   runs[AM_QUERY_STATS_RUNS];
+  int            next_run;
+} am_query_stats;
+
 typedef struct am_sqlite3 {
   sqlite3 *db;
   VALUE    trace_obj;
   VALUE    profile_obj;
   VALUE    busy_handler_obj;
   VALUE    progress_handler_obj;
+  am_schema_cookie schema_cookies[AM_SCHEMA_COOKIE_COUNT];
+  am_rowid_tracker *rowid_tracker;
+  am_query_stats   *query_stats;
 } am_sqlite3;
 
+/* the sub buckets of each power of 2 in a histogram, values are kept to
+ * within 1 part in 2^(AM_HISTOGRAM_SUB_BUCKET_BITS - 1) */
+#define AM_HISTOGRAM_SUB_BUCKET_BITS 7
+
+/* values of 2^AM_HISTOGRAM_MAX_BITS and above are counted in the last bucket */
+#define AM_HISTOGRAM_MAX_BITS 48
+
+#define AM_HISTOGRAM_BUCKETS ( ( AM_HISTOGRAM_MAX_BITS - AM_HISTOGRAM_SUB_BUCKET_BITS + 2 ) << ( AM_HISTOGRAM_SUB_BUCKET_BITS - 1 ) )
+
+/* a log-linear histogram of non negative integer samples */
+typedef struct am_histogram {
+  sqlite3_uint64 counts[AM_HISTOGRAM_BUCKETS];
+  sqlite3_uint64 total;
+  sqlite3_uint64 min;
+  sqlite3_uint64 max;
+} am_histogram;
+
 /* wrapper struct around the sqlite3_statement opaque pointer */
 typedef struct am_sqlite3_stmt {
   sqlite3_stmt *stmt;
   VALUE         remaining_sql;
+  VALUE         parameter_indexes; /* Hash of parameter name => index */
+  sqlite3_int64 rows;              /* rows returned since prepared, or since stats were reset */
+  int           reprepares;        /* SQLITE_STMTSTATUS_REPREPARE as of the last step */
+  int           reprepared;        /* prepared again since Statement#reprepared? was last asked */
 } am_sqlite3_stmt;
 
 /* wrapper struct around the sqlite3_blob opaque ponter */
@@ -53,6 +138,33 @@ extern VALUE eAS_Error;       /* class  Amalgalite::SQLite3::Error     */
 extern VALUE cAR;             /* class  Amalgalite::Requries */
 extern VALUE cARB;            /* class  Amalgalite::Requries::Bootstrap  */
 
+/*----------------------------------------------------------------------
+ * Running SQLite without the GVL, and calling back into ruby with it
+ *---------------------------------------------------------------------*/
+
+/* exported by the ruby vm, but not declared in a public header */
+#ifdef HAVE_RUBY_THREAD_HAS_GVL_P
+extern int   ruby_thread_has_gvl_p(void);
+#endif
+
+/* a variable of each native thread */
+#if defined(__GNUC__)
+#define AM_THREAD_LOCAL __thread
+#elif defined(_MSC_VER)
+#define AM_THREAD_LOCAL __declspec(thread)
+#else
+#define AM_THREAD_LOCAL _Thread_local
+#endif
+
+extern int   amalgalite_has_gvl( void );
+
+extern void* amalgalite_call_without_gvl( void *(*func)(void *), void *data, sqlite3 *db );
+extern void* amalgalite_call_without_gvl_flagged( void *(*func)(void *), void *data, volatile int *interrupted );
+extern void* amalgalite_call_with_gvl( void *(*func)(void *), void *data );
+extern void  amalgalite_save_callback_error( VALUE error );
+extern void  amalgalite_raise_callback_error( void );
+extern VALUE amalgalite_wrap_funcall2( VALUE arg );
+
 /*----------------------------------------------------------------------
  * Prototype for Amalgalite::SQLite3::Database
  *---------------------------------------------------------------------*/
@@ -70,21 +182,44 @@ extern VALUE am_sqlite3_database_row_changes(VALUE self);
 extern VALUE am_sqlite3_database_total_changes(VALUE self);
 extern VALUE am_sqlite3_database_table_column_metadata(VALUE self, VALUE db_name, VALUE tbl_name, VALUE col_name);
 
-extern VALUE am_sqlite3_database_prepare(VALUE self, VALUE rSQL);
+extern VALUE am_sqlite3_database_prepare(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_database_schema_version(int argc, VALUE* argv, VALUE self);
+extern VALUE am_sqlite3_database_start_rowid_tracking(VALUE self, VALUE db_name, VALUE tbl_name);
+extern VALUE am_sqlite3_database_stop_rowid_tracking(VALUE self);
+extern VALUE am_sqlite3_database_is_rowid_column(VALUE self, VALUE db_name, VALUE tbl_name, VALUE col_name);
 extern VALUE am_sqlite3_database_register_trace_tap(VALUE self, VALUE tap);
 extern VALUE am_sqlite3_database_register_profile_tap(VALUE self, VALUE tap);
 extern VALUE am_sqlite3_database_busy_handler(VALUE self, VALUE handler);
+extern VALUE am_sqlite3_database_set_collect_query_stats(VALUE self, VALUE flag);
+extern VALUE am_sqlite3_database_is_collecting_query_stats(VALUE self);
+extern VALUE am_sqlite3_database_reset_query_stats(VALUE self);
+extern VALUE am_sqlite3_database_statement_stats(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_database_status_counters(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_database_configure_lookaside(VALUE self, VALUE slot_size, VALUE slot_count);
+extern VALUE am_sqlite3_database_backup_to(VALUE self, VALUE other, VALUE dest_name, VALUE src_name, VALUE pages_per_step, VALUE sleep_ms, VALUE progress);
 
 /*----------------------------------------------------------------------
  * Prototype for Amalgalite::SQLite3::Statement 
  *---------------------------------------------------------------------*/
 extern VALUE cAS_Statement;   /* class  Amalgalite::SQLite3::Statement */
 
+/* the sqlite3_stmt_status counters reported by Statement#stats */
+#define AM_STATEMENT_STATUS_COUNTERS 9
+extern const int   am_statement_status_counter_ops[AM_STATEMENT_STATUS_COUNTERS];
+extern const char *am_statement_status_counter_names[AM_STATEMENT_STATUS_COUNTERS];
+
 extern VALUE am_sqlite3_statement_alloc(VALUE klass);
 extern void  am_sqlite3_statement_free(am_sqlite3_stmt* );
 extern VALUE am_sqlite3_statement_sql(VALUE self);
 extern VALUE am_sqlite3_statement_close(VALUE self);
+extern int   am_sqlite3_statement_step_without_gvl(sqlite3_stmt *stmt);
+extern VALUE am_sqlite3_statement_stats(int argc, VALUE *argv, VALUE self);
 extern VALUE am_sqlite3_statement_step(VALUE self);
+extern VALUE am_sqlite3_statement_is_reprepared(VALUE self);
+extern VALUE am_sqlite3_statement_convert_values(VALUE self, VALUE values, VALUE types, VALUE plan);
+extern VALUE am_sqlite3_statement_step_row(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_statement_step_rows(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_statement_step_columns(int argc, VALUE *argv, VALUE self);
 extern VALUE am_sqlite3_statement_column_count(VALUE self);
 extern VALUE am_sqlite3_statement_column_name(VALUE self, VALUE index);
 extern VALUE am_sqlite3_statement_column_decltype(VALUE self, VALUE index);
@@ -111,6 +246,13 @@ extern VALUE am_sqlite3_statement_bind_int(VALUE self, VALUE position, VALUE val
 extern VALUE am_sqlite3_statement_bind_int64(VALUE self, VALUE position, VALUE value);
 extern VALUE am_sqlite3_statement_bind_double(VALUE self, VALUE position, VALUE value);
 extern VALUE am_sqlite3_statement_bind_null(VALUE self, VALUE position);
+extern VALUE am_sqlite3_statement_bind_array(VALUE self, VALUE values);
+extern VALUE am_sqlite3_statement_bind_hash(VALUE self, VALUE hash);
+extern VALUE am_sqlite3_statement_execute_rows(VALUE self, VALUE rows);
+extern VALUE am_sqlite3_statement_readonly(VALUE self);
+extern VALUE am_sqlite3_statement_instantiate_rows(VALUE self, VALUE rows, VALUE klass);
+extern VALUE am_sqlite3_statement_parameter_indexes(VALUE self);
+extern void  am_sqlite3_statement_index_parameters(am_sqlite3_stmt *am_stmt);
 
 /*----------------------------------------------------------------------
  * Prototype for Amalgalite::SQLite3::Blob
@@ -120,10 +262,69 @@ extern VALUE cAS_Blob; /* class Amalgalite::SQLite3::Blob */
 extern VALUE am_sqlite3_blob_alloc(VALUE klass);
 extern VALUE am_sqlite3_blob_initialize( VALUE self, VALUE db, VALUE db_name, VALUE table_name, VALUE column_name, VALUE rowid, VALUE flag) ;
 extern void  am_sqlite3_blob_free(am_sqlite3_blob* );
-extern VALUE am_sqlite3_blob_read(VALUE self, VALUE length);
+extern VALUE am_sqlite3_blob_read(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_blob_readpartial(int argc, VALUE *argv, VALUE self);
 extern VALUE am_sqlite3_blob_write(VALUE self, VALUE buffer);
+extern VALUE am_sqlite3_blob_import_file(VALUE self, VALUE path);
+extern VALUE am_sqlite3_blob_export_file(VALUE self, VALUE path);
 extern VALUE am_sqlite3_blob_close(VALUE self);
+extern VALUE am_sqlite3_blob_is_closed(VALUE self);
+extern VALUE am_sqlite3_blob_reopen(VALUE self, VALUE rowid);
 extern VALUE am_sqlite3_blob_length(VALUE self);
+extern VALUE am_sqlite3_blob_pos(VALUE self);
+extern VALUE am_sqlite3_blob_set_pos(VALUE self, VALUE offset);
+extern VALUE am_sqlite3_blob_seek(int argc, VALUE *argv, VALUE self);
+extern VALUE am_sqlite3_blob_is_eof(VALUE self);
+
+/*----------------------------------------------------------------------
+ * Prototype for Amalgalite::SQLite3 date and time functions
+ *---------------------------------------------------------------------*/
+extern VALUE am_sqlite3_parse_date(VALUE self, VALUE str);
+extern VALUE am_sqlite3_parse_datetime(VALUE self, VALUE str);
+extern VALUE am_sqlite3_parse_time(VALUE self, VALUE str);
+extern VALUE am_sqlite3_format_time(VALUE self, VALUE obj);
+extern int   am_sqlite3_datetime_conversion(VALUE value, ID id, VALUE *result);
+
+/*----------------------------------------------------------------------
+ * Prototype for Amalgalite::Histogram
+ *---------------------------------------------------------------------*/
+extern VALUE cA_Histogram; /* class Amalgalite::Histogram */
+
+extern VALUE am_histogram_alloc(VALUE klass);
+extern void  am_histogram_free(am_histogram *histogram);
+extern VALUE am_histogram_initialize_copy(VALUE self, VALUE orig);
+extern VALUE am_histogram_record(VALUE self, VALUE value);
+extern VALUE am_histogram_count(VALUE self);
+extern VALUE am_histogram_min(VALUE self);
+extern VALUE am_histogram_max(VALUE self);
+extern VALUE am_histogram_percentile(VALUE self, VALUE percent);
+extern VALUE am_histogram_merge_bang(VALUE self, VALUE other);
+extern VALUE am_histogram_reset_bang(VALUE self);
+
+/*----------------------------------------------------------------------
+ * Prototype for the per fingerprint statement statistics
+ *---------------------------------------------------------------------*/
+extern am_query_stats* am_query_stats_alloc( );
+extern void  am_query_stats_free(am_query_stats *stats);
+extern void  am_query_stats_clear(am_query_stats *stats);
+extern void  am_query_stats_record(am_query_stats *stats, unsigned trace_type, sqlite3_stmt *stmt, void *extra);
+extern int   am_query_stats_create_module(am_sqlite3 *am_db);
+
+/*----------------------------------------------------------------------
+ * Prototype for the SQLite memory configuration
+ *---------------------------------------------------------------------*/
+extern int   am_sqlite3_open_connections; /* database connections open */
+
+extern void  am_sqlite3_shutdown_for_configuration( const char *what );
+extern void  am_memory_report_to_gc( void );
+extern VALUE am_sqlite3_configure_memory_bang(VALUE self, VALUE pool, VALUE gc_accounting, VALUE lookaside_size, VALUE lookaside_count);
+extern VALUE am_sqlite3_memory_configuration(VALUE self);
+
+/*----------------------------------------------------------------------
+ * Prototype for the shared page cache
+ *---------------------------------------------------------------------*/
+extern VALUE am_sqlite3_configure_page_cache_bang(VALUE self, VALUE budget, VALUE page_size, VALUE preallocate, VALUE huge_pages);
+extern VALUE am_sqlite3_page_cache_stats(int argc, VALUE *argv, VALUE self);
 
 /*----------------------------------------------------------------------
  * more initialization methods
@@ -132,6 +333,10 @@ extern void Init_amalgalite_constants( );
 extern void Init_amalgalite_database( );
 extern void Init_amalgalite_statement( );
 extern void Init_amalgalite_blob( );
+extern void Init_amalgalite_datetime( );
+extern void Init_amalgalite_histogram( );
+extern void Init_amalgalite_memory( );
+extern void Init_amalgalite_page_cache( );
 extern void Init_amalgalite_requires_bootstrap( );
 
  
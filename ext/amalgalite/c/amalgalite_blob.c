@@ -1,4 +1,13 @@
 #include "amalgalite.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
 /**
  * Copyright (c) 2008 Jeremy Hinegardner
  * All rights reserved.  See LICENSE and/or COPYING for details.
@@ -6,6 +15,30 @@
  * vim: shiftwidth=4 
  */ 
 
+#ifndef O_BINARY
+#define O_BINARY 0
+#endif
+
+/* the number of bytes moved at a time between a file and a blob when the
+ * file cannot be mapped */
+#define AM_BLOB_FILE_CHUNK ( 1024 * 1024 )
+
+/* arguments and results of moving a file into or out of a blob without the GVL */
+typedef struct am_blob_file_io {
+    am_sqlite3_blob *am_blob;
+    sqlite3_blob    *blob;
+    void          *(*func)(void *); /* moves the bytes a chunk at a time */
+    int              fd;
+    char            *buf;      /* the mapped file, or a scratch buffer */
+    int              mapped;   /* is buf the mapped file */
+    long             length;   /* the number of bytes to move */
+    int              offset;   /* the offset in the blob to start at */
+    long             done;     /* the number of bytes moved */
+    int              rc;       /* the sqlite result code */
+    int              err;      /* errno of a failed read or write of the file */
+    volatile int     interrupted; /* set when the ruby thread is interrupted */
+} am_blob_file_io;
+
 /* class  Amalgliate::SQLite3::Blob */
 VALUE cAS_Blob;   
 
@@ -67,6 +100,21 @@ VALUE am_sqlite3_blob_initialize( VALUE self, VALUE db, VALUE db_name, VALUE tab
     }
 }
 
+/*
+ * extract the blob struct from self, raising an error if the blob has been
+ * closed
+ */
+static am_sqlite3_blob* am_sqlite3_blob_open_struct( VALUE self )
+{
+    am_sqlite3_blob *am_blob;
+
+    Data_Get_Struct(self, am_sqlite3_blob, am_blob);
+    if ( NULL == am_blob->blob ) {
+        rb_raise( rb_eIOError, "closed blob" );
+    }
+    return am_blob;
+}
+
 /**
  * call-seq:
  *  blob.close -> nil
@@ -79,7 +127,11 @@ VALUE am_sqlite3_blob_close( VALUE self )
     int              rc;
     
     Data_Get_Struct(self, am_sqlite3_blob, am_blob);
+    if ( NULL == am_blob->blob ) {
+        return Qnil;
+    }
     rc = sqlite3_blob_close( am_blob->blob );
+    am_blob->blob = NULL;
     if ( SQLITE_OK != rc ) {
         rb_raise(eAS_Error, "Error closing blob: [SQLITE_ERROR %d] %s\n",
                 rc, sqlite3_errmsg( am_blob->db ));
@@ -89,6 +141,45 @@ VALUE am_sqlite3_blob_close( VALUE self )
     return Qnil;
 }
 
+/**
+ * call-seq:
+ *  blob.closed? -> true or false
+ *
+ * Has the blob been closed.
+ */
+VALUE am_sqlite3_blob_is_closed( VALUE self )
+{
+    am_sqlite3_blob *am_blob;
+
+    Data_Get_Struct(self, am_sqlite3_blob, am_blob);
+    return ( NULL == am_blob->blob ) ? Qtrue : Qfalse;
+}
+
+/**
+ * call-seq:
+ *  blob.reopen( row_id ) -> self
+ *
+ * Move the blob to the same column of another row of the table, and rewind it
+ * to the start.  This is much cheaper than opening a new Blob for each row
+ * when streaming the blobs of many rows.
+ */
+VALUE am_sqlite3_blob_reopen( VALUE self, VALUE rowid )
+{
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
+    sqlite3_int64    iRow    = NUM2SQLINT64( rowid );
+    int              rc;
+
+    rc = sqlite3_blob_reopen( am_blob->blob, iRow );
+    if ( SQLITE_OK != rc ) {
+        /* the blob handle is aborted if it cannot be moved */
+        rb_raise( eAS_Error, "Error reopening Blob at rowid = %lu : [SQLITE_ERROR %d] %s\n",
+                             (unsigned long)iRow, rc, sqlite3_errmsg( am_blob->db ) );
+    }
+    am_blob->length         = sqlite3_blob_bytes( am_blob->blob );
+    am_blob->current_offset = 0;
+
+    return self;
+}
 
 /**
  * call-seq:
@@ -107,45 +198,196 @@ VALUE am_sqlite3_blob_length( VALUE self )
 
 /**
  * call-seq:
- *   blob.read( int ) -> String containting int number of  bytes or nil if eof.
+ *  blob.pos -> Integer
  *
- * returns int number of bytes as a String from the database
+ * The current offset in bytes into the blob of the next read or write.
  */
-VALUE am_sqlite3_blob_read( VALUE self, VALUE length )
+VALUE am_sqlite3_blob_pos( VALUE self )
 {
     am_sqlite3_blob *am_blob;
-    int             rc;
-    int              n = NUM2INT( length );
-    void           *buf = NULL;
-    VALUE          result;
 
     Data_Get_Struct(self, am_sqlite3_blob, am_blob);
 
-    /* we have to be exact on the number of bytes to read.  n + current_offset
-     * cannot be larger than the blob's length
-     */
-    if ( (n + am_blob->current_offset > am_blob->length)) {
+    return INT2FIX( am_blob->current_offset );
+}
+
+/**
+ * call-seq:
+ *  blob.seek( offset, whence = IO::SEEK_SET ) -> 0
+ *
+ * Move the offset of the next read or write, just like IO#seek.  The offset
+ * may not be moved outside of the blob, since a blob cannot change size.
+ */
+VALUE am_sqlite3_blob_seek( int argc, VALUE *argv, VALUE self )
+{
+    am_sqlite3_blob *am_blob;
+    VALUE            rOffset, rWhence;
+    long             offset;
+    int              whence = SEEK_SET;
+
+    rb_scan_args( argc, argv, "11", &rOffset, &rWhence );
+    Data_Get_Struct(self, am_sqlite3_blob, am_blob);
+
+    offset = NUM2LONG( rOffset );
+    if ( Qnil != rWhence ) {
+        whence = NUM2INT( rWhence );
+    }
+    switch ( whence ) {
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += am_blob->current_offset;
+            break;
+        case SEEK_END:
+            offset += am_blob->length;
+            break;
+        default:
+            rb_raise( rb_eArgError, "invalid whence %d", whence );
+    }
+
+    if ( ( offset < 0 ) || ( offset > am_blob->length ) ) {
+        rb_raise( rb_eArgError, "offset %ld is outside of the blob of %d bytes", offset, am_blob->length );
+    }
+    am_blob->current_offset = (int)offset;
+
+    return INT2FIX( 0 );
+}
+
+/**
+ * call-seq:
+ *  blob.pos = offset -> offset
+ *
+ * Move the offset of the next read or write to +offset+ bytes from the start
+ * of the blob.
+ */
+VALUE am_sqlite3_blob_set_pos( VALUE self, VALUE offset )
+{
+    am_sqlite3_blob_seek( 1, &offset, self );
+    return offset;
+}
+
+/**
+ * call-seq:
+ *  blob.eof? -> true or false
+ *
+ * Is the current offset at the end of the blob.
+ */
+VALUE am_sqlite3_blob_is_eof( VALUE self )
+{
+    am_sqlite3_blob *am_blob;
+
+    Data_Get_Struct(self, am_sqlite3_blob, am_blob);
+
+    return ( am_blob->current_offset >= am_blob->length ) ? Qtrue : Qfalse;
+}
+
+/*
+ * Read up to n bytes from the current offset of the blob straight into
+ * outbuf, or a new String if outbuf is nil, and advance the offset.  Returns
+ * the String, which is n bytes or shorter at the end of the blob.
+ */
+static VALUE am_sqlite3_blob_read_into( am_sqlite3_blob *am_blob, long n, VALUE outbuf )
+{
+    int rc;
+
+    if ( n > ( am_blob->length - am_blob->current_offset ) ) {
         n = am_blob->length - am_blob->current_offset;
     }
 
-    if ( am_blob->current_offset == am_blob->length ) {
-        return Qnil;
+    if ( Qnil == outbuf ) {
+        outbuf = rb_str_new( NULL, n );
+    } else {
+        StringValue( outbuf );
+        rb_str_modify( outbuf );
+        rb_str_resize( outbuf, n );
+    }
+
+    if ( n > 0 ) {
+        rc = sqlite3_blob_read( am_blob->blob, RSTRING_PTR( outbuf ), (int)n, am_blob->current_offset );
+        if ( rc != SQLITE_OK ) {
+            rb_raise(eAS_Error, "Error reading %ld bytes blob at offset %d: [SQLITE_ERROR %d] %s\n",
+                    n, am_blob->current_offset, rc, sqlite3_errmsg( am_blob->db ));
+        }
+        am_blob->current_offset += (int)n;
     }
 
-    buf = (void *)malloc( n );
-    rc = sqlite3_blob_read( am_blob->blob, buf, n, am_blob->current_offset); 
+    return outbuf;
+}
 
-    if ( rc != SQLITE_OK ) {
-        rb_raise(eAS_Error, "Error reading %d bytes blob at offset %d: [SQLITE_ERROR %d] %s\n",
-                n, am_blob->current_offset, rc, sqlite3_errmsg( am_blob->db ));
+/*
+ * Clear the outbuf, if there is one, at the end of the blob.
+ */
+static void am_sqlite3_blob_clear_outbuf( VALUE outbuf )
+{
+    if ( Qnil != outbuf ) {
+        StringValue( outbuf );
+        rb_str_resize( outbuf, 0 );
     }
+}
 
-    am_blob->current_offset += n;
+/**
+ * call-seq:
+ *   blob.read( length = nil, outbuf = nil ) -> String or nil
+ *
+ * Read +length+ bytes from the current offset of the blob, just like IO#read.
+ * Returns nil at the end of the blob.  With no +length+ the rest of the blob
+ * is read, and an empty String is returned at the end of the blob.
+ *
+ * If +outbuf+ is given the bytes are read directly into it, replacing its
+ * contents, and it is returned.  Reusing one +outbuf+ when streaming a large
+ * blob avoids allocating a String for every read.
+ */
+VALUE am_sqlite3_blob_read( int argc, VALUE *argv, VALUE self )
+{
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
+    VALUE            length, outbuf;
+    long             n;
 
-    result = rb_str_new( (char*)buf, n );
-    free( buf );
-    return result;
+    rb_scan_args( argc, argv, "02", &length, &outbuf );
 
+    if ( Qnil == length ) {
+        return am_sqlite3_blob_read_into( am_blob, am_blob->length - am_blob->current_offset, outbuf );
+    }
+
+    n = NUM2LONG( length );
+    if ( n < 0 ) {
+        rb_raise( rb_eArgError, "negative length %ld given", n );
+    }
+
+    if ( ( am_blob->current_offset >= am_blob->length ) && ( n > 0 ) ) {
+        am_sqlite3_blob_clear_outbuf( outbuf );
+        return Qnil;
+    }
+
+    return am_sqlite3_blob_read_into( am_blob, n, outbuf );
+}
+
+/**
+ * call-seq:
+ *   blob.readpartial( maxlen, outbuf = nil ) -> String
+ *
+ * Read at most +maxlen+ bytes from the current offset of the blob, just like
+ * IO#readpartial.  Raises EOFError at the end of the blob.
+ */
+VALUE am_sqlite3_blob_readpartial( int argc, VALUE *argv, VALUE self )
+{
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
+    VALUE            maxlen, outbuf;
+    long             n;
+
+    rb_scan_args( argc, argv, "11", &maxlen, &outbuf );
+
+    n = NUM2LONG( maxlen );
+    if ( n < 0 ) {
+        rb_raise( rb_eArgError, "negative length %ld given", n );
+    }
+
+    if ( ( am_blob->current_offset >= am_blob->length ) && ( n > 0 ) ) {
+        am_sqlite3_blob_clear_outbuf( outbuf );
+        rb_raise( rb_eEOFError, "end of file reached" );
+    }
+
+    return am_sqlite3_blob_read_into( am_blob, n, outbuf );
 }
 
 /**
@@ -158,13 +400,10 @@ VALUE am_sqlite3_blob_read( VALUE self, VALUE length )
  */
 VALUE am_sqlite3_blob_write( VALUE self, VALUE buf )
 {
-    am_sqlite3_blob *am_blob;
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
     int              rc;
     VALUE            str = StringValue( buf );
     int              n   = (int)RSTRING_LEN( str );
-    char            *chk_buf = NULL;
-
-    Data_Get_Struct(self, am_sqlite3_blob, am_blob);
 
     rc = sqlite3_blob_write( am_blob->blob, RSTRING_PTR(str), n, am_blob->current_offset); 
 
@@ -173,10 +412,6 @@ VALUE am_sqlite3_blob_write( VALUE self, VALUE buf )
                 n, am_blob->current_offset, rc, sqlite3_errmsg( am_blob->db ));
     }
 
-    chk_buf = (char *) malloc( n  + 1);
-    chk_buf[n] = '\0';
-    sqlite3_blob_read( am_blob->blob, chk_buf, n, 0);
-
     am_blob->current_offset += n;
 
     return INT2FIX( n );
@@ -184,6 +419,249 @@ VALUE am_sqlite3_blob_write( VALUE self, VALUE buf )
 }
 
 
+/*
+ * Is there more of the file to move, and nothing has gone wrong or
+ * interrupted the move
+ */
+static int am_sqlite3_blob_file_io_more( am_blob_file_io *io )
+{
+    return ( io->done < io->length ) && ( SQLITE_OK == io->rc ) && ( 0 == io->err ) && !io->interrupted;
+}
+
+/*
+ * Write the file into the blob a chunk at a time, called without the GVL.  A
+ * mapped file is written straight from the mapping, otherwise each chunk is
+ * read into the buffer first.
+ */
+static void* am_sqlite3_blob_import_func( void *data )
+{
+    am_blob_file_io *io = (am_blob_file_io*)data;
+    char            *chunk;
+    long             n;
+
+    while ( am_sqlite3_blob_file_io_more( io ) ) {
+        n = io->length - io->done;
+        if ( n > AM_BLOB_FILE_CHUNK ) { n = AM_BLOB_FILE_CHUNK; }
+
+        if ( io->mapped ) {
+            chunk = io->buf + io->done;
+        } else {
+            chunk = io->buf;
+            n = read( io->fd, io->buf, n );
+            if ( n < 0 ) {
+                if ( EINTR == errno ) { continue; }
+                io->err = errno;
+                break;
+            }
+            if ( 0 == n ) {
+                break;
+            }
+        }
+        io->rc = sqlite3_blob_write( io->blob, chunk, (int)n, io->offset + (int)io->done );
+        if ( SQLITE_OK == io->rc ) {
+            io->done += n;
+        }
+    }
+    return io;
+}
+
+/*
+ * Read the blob into the file a chunk at a time, called without the GVL.
+ */
+static void* am_sqlite3_blob_export_func( void *data )
+{
+    am_blob_file_io *io = (am_blob_file_io*)data;
+    long             n, written, w;
+
+    while ( am_sqlite3_blob_file_io_more( io ) ) {
+        n = io->length - io->done;
+        if ( n > AM_BLOB_FILE_CHUNK ) { n = AM_BLOB_FILE_CHUNK; }
+
+        io->rc = sqlite3_blob_read( io->blob, io->buf, (int)n, io->offset + (int)io->done );
+        if ( SQLITE_OK != io->rc ) {
+            break;
+        }
+
+        for ( written = 0 ; written < n ; written += w ) {
+#ifdef HAVE_PWRITE
+            w = pwrite( io->fd, io->buf + written, n - written, io->done + written );
+#else
+            w = write( io->fd, io->buf + written, n - written );
+#endif
+            if ( w < 0 ) {
+                if ( EINTR == errno ) { w = 0; continue; }
+                io->err = errno;
+                return io;
+            }
+        }
+        io->done += n;
+    }
+    return io;
+}
+
+/*
+ * Run io->func without the GVL until the file is moved.  When the thread is
+ * interrupted the chunk in progress is finished and the interrupt handled
+ * with the GVL, raising if it is a Thread#raise, Thread#kill or an untrapped
+ * signal, and otherwise the move carries on.
+ */
+static VALUE am_sqlite3_blob_file_io_run( VALUE arg )
+{
+    am_blob_file_io *io = (am_blob_file_io*)arg;
+
+    for ( ;; ) {
+        amalgalite_call_without_gvl_flagged( io->func, io, &io->interrupted );
+        if ( !io->interrupted ) {
+            break;
+        }
+        rb_thread_check_ints( );
+    }
+    return Qnil;
+}
+
+/*
+ * Release the file and buffer of a move, and advance the blob past the bytes
+ * moved, however the move ended
+ */
+static VALUE am_sqlite3_blob_file_io_close( VALUE arg )
+{
+    am_blob_file_io *io = (am_blob_file_io*)arg;
+
+#ifdef HAVE_SYS_MMAN_H
+    if ( io->mapped ) {
+        munmap( io->buf, io->length );
+    }
+#endif
+    if ( !io->mapped ) {
+        xfree( io->buf );
+    }
+    if ( ( 0 != close( io->fd ) ) && ( 0 == io->err ) ) {
+        io->err = errno;
+    }
+
+    io->am_blob->current_offset += (int)io->done;
+    return Qnil;
+}
+
+/*
+ * Raise the error of a file import or export once the file is closed
+ */
+static void am_sqlite3_blob_raise_file_io( am_sqlite3_blob *am_blob, am_blob_file_io *io, const char *action, VALUE path )
+{
+    if ( 0 != io->err ) {
+        errno = io->err;
+        rb_sys_fail_str( path );
+    }
+    if ( SQLITE_OK != io->rc ) {
+        rb_raise( eAS_Error, "Error %s %s at blob offset %ld: [SQLITE_ERROR %d] %s\n",
+                  action, StringValueCStr( path ), io->offset + io->done, io->rc, sqlite3_errmsg( am_blob->db ) );
+    }
+}
+
+/**
+ * call-seq:
+ *   blob.import_file( path ) -> Integer
+ *
+ * Write the whole contents of the file at +path+ into the blob at the current
+ * offset and return the number of bytes written.  The file must fit in the
+ * rest of the blob.
+ *
+ * The file is mapped into memory, or read where it cannot be mapped, and
+ * handed to SQLite in large chunks without creating any Ruby Strings and
+ * without holding the GVL.  The thread may be interrupted between chunks.
+ */
+VALUE am_sqlite3_blob_import_file( VALUE self, VALUE path )
+{
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
+    am_blob_file_io  io;
+    struct stat      st;
+
+    FilePathValue( path );
+    memset( &io, 0, sizeof( io ) );
+    io.am_blob = am_blob;
+    io.blob    = am_blob->blob;
+    io.func    = am_sqlite3_blob_import_func;
+    io.offset  = am_blob->current_offset;
+    io.rc      = SQLITE_OK;
+
+    io.fd = open( StringValueCStr( path ), O_RDONLY | O_BINARY );
+    if ( io.fd < 0 ) {
+        rb_sys_fail_str( path );
+    }
+    if ( 0 != fstat( io.fd, &st ) ) {
+        io.err = errno;
+        close( io.fd );
+        errno = io.err;
+        rb_sys_fail_str( path );
+    }
+    io.length = (long)st.st_size;
+
+    if ( io.length > ( am_blob->length - am_blob->current_offset ) ) {
+        close( io.fd );
+        rb_raise( rb_eArgError, "%s is %ld bytes and does not fit in the %d bytes left in the blob",
+                  StringValueCStr( path ), io.length, am_blob->length - am_blob->current_offset );
+    }
+
+#ifdef HAVE_SYS_MMAN_H
+    if ( io.length > 0 ) {
+        io.buf = mmap( NULL, io.length, PROT_READ, MAP_PRIVATE, io.fd, 0 );
+        if ( MAP_FAILED == io.buf ) {
+            io.buf = NULL;
+        } else {
+            io.mapped = 1;
+#ifdef MADV_SEQUENTIAL
+            madvise( io.buf, io.length, MADV_SEQUENTIAL );
+#endif
+        }
+    }
+#endif
+    if ( !io.mapped ) {
+        io.buf = xmalloc( AM_BLOB_FILE_CHUNK );
+    }
+
+    rb_ensure( am_sqlite3_blob_file_io_run, (VALUE)&io, am_sqlite3_blob_file_io_close, (VALUE)&io );
+    am_sqlite3_blob_raise_file_io( am_blob, &io, "importing", path );
+
+    return LONG2NUM( io.done );
+}
+
+/**
+ * call-seq:
+ *   blob.export_file( path ) -> Integer
+ *
+ * Write the blob, from the current offset to the end, into the file at
+ * +path+, replacing it, and return the number of bytes written.  The blob is
+ * read in large chunks that are written with pwrite, without creating any
+ * Ruby Strings and without holding the GVL.  The thread may be interrupted
+ * between chunks.
+ */
+VALUE am_sqlite3_blob_export_file( VALUE self, VALUE path )
+{
+    am_sqlite3_blob *am_blob = am_sqlite3_blob_open_struct( self );
+    am_blob_file_io  io;
+
+    FilePathValue( path );
+    memset( &io, 0, sizeof( io ) );
+    io.am_blob = am_blob;
+    io.blob    = am_blob->blob;
+    io.func    = am_sqlite3_blob_export_func;
+    io.offset  = am_blob->current_offset;
+    io.length  = am_blob->length - am_blob->current_offset;
+    io.rc      = SQLITE_OK;
+
+    io.fd = open( StringValueCStr( path ), O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0666 );
+    if ( io.fd < 0 ) {
+        rb_sys_fail_str( path );
+    }
+    io.buf = xmalloc( AM_BLOB_FILE_CHUNK );
+
+    rb_ensure( am_sqlite3_blob_file_io_run, (VALUE)&io, am_sqlite3_blob_file_io_close, (VALUE)&io );
+    am_sqlite3_blob_raise_file_io( am_blob, &io, "exporting", path );
+
+    return LONG2NUM( io.done );
+}
+
+
 /***********************************************************************
  * Ruby life cycle methods
  ***********************************************************************/
@@ -206,6 +684,8 @@ VALUE am_sqlite3_blob_alloc(VALUE klass)
     VALUE             obj     ; 
 
     wrapper->current_offset = 0;
+    wrapper->length         = 0;
+    wrapper->blob           = NULL;
     wrapper->db             = NULL;
     obj = Data_Wrap_Struct(klass, NULL, am_sqlite3_blob_free, wrapper);
     return obj;
@@ -232,9 +712,20 @@ void Init_amalgalite_blob( )
     rb_define_alloc_func(cAS_Blob, am_sqlite3_blob_alloc); 
     rb_define_method(cAS_Blob, "initialize", am_sqlite3_blob_initialize, 6); 
     rb_define_method(cAS_Blob, "close", am_sqlite3_blob_close, 0); 
-    rb_define_method(cAS_Blob, "read", am_sqlite3_blob_read, 1); 
+    rb_define_method(cAS_Blob, "closed?", am_sqlite3_blob_is_closed, 0); 
+    rb_define_method(cAS_Blob, "reopen", am_sqlite3_blob_reopen, 1); 
+    rb_define_method(cAS_Blob, "read", am_sqlite3_blob_read, -1); 
+    rb_define_method(cAS_Blob, "readpartial", am_sqlite3_blob_readpartial, -1); 
     rb_define_method(cAS_Blob, "write", am_sqlite3_blob_write, 1); 
+    rb_define_method(cAS_Blob, "import_file", am_sqlite3_blob_import_file, 1); 
+    rb_define_method(cAS_Blob, "export_file", am_sqlite3_blob_export_file, 1); 
     rb_define_method(cAS_Blob, "length", am_sqlite3_blob_length, 0); 
+    rb_define_alias(cAS_Blob, "size", "length"); 
+    rb_define_method(cAS_Blob, "pos", am_sqlite3_blob_pos, 0); 
+    rb_define_alias(cAS_Blob, "tell", "pos"); 
+    rb_define_method(cAS_Blob, "pos=", am_sqlite3_blob_set_pos, 1); 
+    rb_define_method(cAS_Blob, "seek", am_sqlite3_blob_seek, -1); 
+    rb_define_method(cAS_Blob, "eof?", am_sqlite3_blob_is_eof, 0); 
 }
 
 
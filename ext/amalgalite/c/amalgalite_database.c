@@ -9,49 +9,215 @@
 VALUE cAS_Database;       /* class  Amalgalite::SQLite3::Database        */
 VALUE cAS_Database_Stat;  /* class  Amalgalite::SQLite3::Database::Stat  */
 
+/* arguments for sqlite3_exec() invoked without the GVL */
+typedef struct am_exec_args {
+    sqlite3    *db;
+    const char *sql;
+} am_exec_args_t;
+
+static void* am_sqlite3_database_exec_func( void *data )
+{
+    am_exec_args_t *args = (am_exec_args_t*) data;
+    return (void*)(intptr_t) sqlite3_exec( args->db, args->sql, NULL, NULL, NULL );
+}
+
+/* the settings of Database.open that are pragmas, in the order they are run */
+static const char *am_database_open_pragmas[] = {
+    "journal_mode", "synchronous", "mmap_size", "cache_size", "temp_store"
+};
+
+/*
+ * Is value an Integer from min to max, if it is it is stored in number.  This
+ * does not raise, unlike NUM2SQLINT64.
+ */
+static int am_sqlite3_database_integer_setting( VALUE value, sqlite3_int64 min, sqlite3_int64 max, sqlite3_int64 *number )
+{
+    int sign;
+
+    if ( !RB_INTEGER_TYPE_P( value ) ) {
+        return 0;
+    }
+    sign = rb_integer_pack( value, number, 1, sizeof( *number ), 0, INTEGER_PACK_NATIVE_BYTE_ORDER | INTEGER_PACK_2COMP );
+    return ( -1 <= sign ) && ( sign <= 1 ) && ( min <= *number ) && ( *number <= max );
+}
+
+/*
+ * The pragmas of the settings Hash of Database.open, as a single batch of
+ * sql, or NULL if there are none.  The value of each is an Integer or a
+ * keyword, anything else raises an ArgumentError.  The :busy_timeout setting
+ * is checked too and stored in busy_timeout, or -1 if there is none.
+ */
+static char* am_sqlite3_database_open_pragmas( VALUE settings, int *busy_timeout )
+{
+    sqlite3_str  *sql;
+    VALUE         value;
+    const char   *keyword;
+    sqlite3_int64 number;
+    size_t        i;
+    long          c;
+
+    *busy_timeout = -1;
+    if ( Qnil == settings ) {
+        return NULL;
+    }
+    Check_Type( settings, T_HASH );
+
+    value = rb_hash_lookup( settings, ID2SYM( rb_intern( "busy_timeout" ) ) );
+    if ( Qnil != value ) {
+        if ( !am_sqlite3_database_integer_setting( value, 0, INT_MAX, &number ) ) {
+            rb_raise( rb_eArgError, "busy_timeout must be an Integer of milliseconds from 0 to %d", INT_MAX );
+        }
+        *busy_timeout = (int)number;
+    }
+
+    sql = sqlite3_str_new( NULL );
+    for ( i = 0 ; i < sizeof( am_database_open_pragmas ) / sizeof( am_database_open_pragmas[0] ) ; i++ ) {
+        value = rb_hash_lookup( settings, ID2SYM( rb_intern( am_database_open_pragmas[i] ) ) );
+        if ( Qnil == value ) {
+            continue;
+        }
+        if ( RB_INTEGER_TYPE_P( value ) ) {
+            if ( !am_sqlite3_database_integer_setting( value, INT64_MIN, INT64_MAX, &number ) ) {
+                sqlite3_free( sqlite3_str_finish( sql ) );
+                rb_raise( rb_eArgError, "%s is out of range", am_database_open_pragmas[i] );
+            }
+            sqlite3_str_appendf( sql, "PRAGMA %s = %lld;", am_database_open_pragmas[i], number );
+            continue;
+        }
+        if ( SYMBOL_P( value ) ) {
+            value = rb_sym2str( value );
+        }
+        keyword = ( T_STRING == TYPE( value ) && RSTRING_LEN( value ) > 0 ) ? RSTRING_PTR( value ) : NULL;
+        for ( c = 0 ; NULL != keyword && c < RSTRING_LEN( value ) ; c++ ) {
+            if ( !( ISALNUM( keyword[c] ) || '_' == keyword[c] ) ) {
+                keyword = NULL;
+            }
+        }
+        if ( NULL == keyword ) {
+            sqlite3_free( sqlite3_str_finish( sql ) );
+            rb_raise( rb_eArgError, "%s must be an Integer or a keyword", am_database_open_pragmas[i] );
+        }
+        sqlite3_str_appendf( sql, "PRAGMA %s = %.*s;", am_database_open_pragmas[i], (int)RSTRING_LEN( value ), keyword );
+    }
+
+    if ( SQLITE_OK != sqlite3_str_errcode( sql ) ) {
+        sqlite3_free( sqlite3_str_finish( sql ) );
+        rb_memerror();
+    }
+    if ( 0 == sqlite3_str_length( sql ) ) {
+        sqlite3_free( sqlite3_str_finish( sql ) );
+        return NULL;
+    }
+    return sqlite3_str_finish( sql );
+}
+
+/*
+ * Close a connection that could not be opened all the way, so it is not left
+ * counted in am_sqlite3_open_connections, and raise the error.  The message
+ * is taken before the connection is closed.
+ */
+static void am_sqlite3_database_open_failed( am_sqlite3 *am_db, char *pragmas, const char *what, const char *filename, int rc )
+{
+    VALUE message = rb_str_new2( ( NULL != am_db->db ) ? sqlite3_errmsg( am_db->db ) : sqlite3_errstr( rc ) );
+
+    sqlite3_free( pragmas );
+    am_query_stats_free( am_db->query_stats );
+    am_db->query_stats = NULL;
+    if ( NULL != am_db->db ) {
+        sqlite3_close_v2( am_db->db );
+        am_sqlite3_open_connections--;
+        am_db->db = NULL;
+    }
+    rb_raise(eAS_Error, "Failure to %s %s : [SQLITE_ERROR %d] : %s\n",
+            what, filename, rc, StringValueCStr( message ));
+}
+
+/*
+ * Apply the settings of Database.open to the newly opened am_db, the
+ * busy_timeout and then the batch of pragmas.  If that fails the database is
+ * closed and an error raised.
+ */
+static void am_sqlite3_database_apply_settings( am_sqlite3 *am_db, int busy_timeout, char *pragmas, const char *filename )
+{
+    am_exec_args_t  args;
+    int             rc = SQLITE_OK;
+
+    if ( busy_timeout >= 0 ) {
+        rc = sqlite3_busy_timeout( am_db->db, busy_timeout );
+    }
+    if ( SQLITE_OK == rc && NULL != pragmas ) {
+        args.db  = am_db->db;
+        args.sql = pragmas;
+        rc = (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_database_exec_func, &args, am_db->db );
+    }
+
+    if ( SQLITE_OK != rc ) {
+        am_sqlite3_database_open_failed( am_db, pragmas, "configure database", filename, rc );
+    }
+    sqlite3_free( pragmas );
+}
+
 /**
  * Document-method: open
  *
  * call-seq:
- *    Amalgalite::SQLite3::Database.open( filename, flags = READWRITE | CREATE ) -> Database
+ *    Amalgalite::SQLite3::Database.open( filename, flags = READWRITE | CREATE, settings = nil ) -> Database
  *
  * Create a new SQLite2 database with a UTF-8 encoding.
  *
+ * settings is an optional Hash applied right after the database is opened.
+ * :busy_timeout is the milliseconds to wait for a lock, and :journal_mode,
+ * :synchronous, :mmap_size, :cache_size and :temp_store are pragmas, all run
+ * with a single sqlite3_exec.
+ *
  */
 VALUE am_sqlite3_database_open(int argc, VALUE *argv, VALUE class)
 {
     VALUE  self = am_sqlite3_database_alloc(class);
     VALUE  rFlags;
     VALUE  rFilename;
+    VALUE  rSettings;
     int     flags = SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE;
     char*   filename;
+    char*   pragmas;
     int     rc;
+    int     busy_timeout;
     am_sqlite3* am_db;
 
     /* at least a filename argument is required */
-    rb_scan_args( argc, argv, "11", &rFilename, &rFlags );
+    rb_scan_args( argc, argv, "12", &rFilename, &rFlags, &rSettings );
 
     /* convert flags to the sqlite version */
     flags  = ( Qnil == rFlags ) ? flags : FIX2INT(rFlags);
     filename = StringValuePtr(rFilename);
 
+    /* the settings are checked before there is a database to close */
+    pragmas = am_sqlite3_database_open_pragmas( rSettings, &busy_timeout );
+
     /* extract the sqlite3 wrapper struct */
     Data_Get_Struct(self, am_sqlite3, am_db);
 
     /* open the sqlite3 database */
     rc = sqlite3_open_v2( filename, &(am_db->db), flags, 0);
+    if ( NULL != am_db->db ) {
+        am_sqlite3_open_connections++;
+    }
     if ( SQLITE_OK != rc ) {
-        rb_raise(eAS_Error, "Failure to open database %s : [SQLITE_ERROR %d] : %s\n",
-                filename, rc, sqlite3_errmsg(am_db->db));
+        am_sqlite3_database_open_failed( am_db, pragmas, "open database", filename, rc );
     }
 
     /* by default turn on the extended result codes */
     rc = sqlite3_extended_result_codes( am_db->db, 1);
     if ( SQLITE_OK != rc ) {
-        rb_raise(eAS_Error, "Failure to set extended result codes %s : [SQLITE_ERROR %d] : %s\n",
-                filename, rc, sqlite3_errmsg(am_db->db));
+        am_sqlite3_database_open_failed( am_db, pragmas, "set extended result codes", filename, rc );
     }
 
+    rc = am_query_stats_create_module( am_db );
+    if ( SQLITE_OK != rc ) {
+        am_sqlite3_database_open_failed( am_db, pragmas, "register the query stats table on", filename, rc );
+    }
+
+    am_sqlite3_database_apply_settings( am_db, busy_timeout, pragmas, filename );
     return self;
 }
 
@@ -71,21 +237,97 @@ VALUE am_sqlite3_database_open16(VALUE class, VALUE rFilename)
 
     Data_Get_Struct(self, am_sqlite3, am_db);
     rc = sqlite3_open16( filename, &(am_db->db) );
+    if ( NULL != am_db->db ) {
+        am_sqlite3_open_connections++;
+    }
     if ( SQLITE_OK != rc ) {
-        rb_raise(eAS_Error, "Failure to open UTF-16 database %s : [SQLITE_ERROR %d] : %s\n",
-                filename, rc, sqlite3_errmsg( am_db->db ));
+        am_sqlite3_database_open_failed( am_db, NULL, "open UTF-16 database", filename, rc );
     }
 
     /* by default turn on the extended result codes */
     rc = sqlite3_extended_result_codes( am_db->db, 1);
     if ( SQLITE_OK != rc ) {
-        rb_raise(eAS_Error, "Failure to set extended result codes on UTF-16 database %s : [SQLITE_ERROR %d] : %s\n",
-                filename, rc, (char*)sqlite3_errmsg16(am_db->db));
+        am_sqlite3_database_open_failed( am_db, NULL, "set extended result codes on UTF-16 database", filename, rc );
+    }
+
+    rc = am_query_stats_create_module( am_db );
+    if ( SQLITE_OK != rc ) {
+        am_sqlite3_database_open_failed( am_db, NULL, "register the query stats table on UTF-16 database", filename, rc );
     }
 
     return self;
 }
 
+/*
+ * Finalize the persistent statements used to read the schema cookies and
+ * forget the cookies themselves.
+ */
+static void am_sqlite3_database_finalize_schema_cookies( am_sqlite3 *am_db )
+{
+    int i;
+
+    for ( i = 0 ; i < AM_SCHEMA_COOKIE_COUNT ; i++ ) {
+        if ( NULL != am_db->schema_cookies[i].stmt ) {
+            sqlite3_finalize( am_db->schema_cookies[i].stmt );
+        }
+        am_db->schema_cookies[i].stmt         = NULL;
+        am_db->schema_cookies[i].data_version = 0;
+        am_db->schema_cookies[i].version      = 0;
+        am_db->schema_cookies[i].valid        = 0;
+    }
+}
+
+/*
+ * Is the prepared statement one of those used to read the schema cookies
+ */
+static int am_sqlite3_database_is_schema_cookie_stmt( am_sqlite3 *am_db, void *stmt )
+{
+    int i;
+
+    for ( i = 0 ; i < AM_SCHEMA_COOKIE_COUNT ; i++ ) {
+        if ( ( NULL != stmt ) && ( stmt == (void*)am_db->schema_cookies[i].stmt ) ) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/*
+ * Step a PRAGMA schema_version statement and reset it.  Returns 1 and sets
+ * version if a row was returned.
+ */
+static int am_sqlite3_database_step_schema_version( sqlite3_stmt *stmt, int *version )
+{
+    int found = 0;
+
+    if ( SQLITE_ROW == sqlite3_step( stmt ) ) {
+        *version = sqlite3_column_int( stmt, 0 );
+        found = 1;
+    }
+    sqlite3_reset( stmt );
+    return found;
+}
+
+/*
+ * Remove the update hook of the rowid tracker, if there is one, and free it.
+ */
+static void am_sqlite3_database_free_rowid_tracker( am_sqlite3 *am_db )
+{
+    am_rowid_tracker *tracker = am_db->rowid_tracker;
+
+    if ( NULL == tracker ) {
+        return;
+    }
+    if ( NULL != am_db->db ) {
+        sqlite3_update_hook( am_db->db, NULL, NULL );
+    }
+    sqlite3_free( tracker->zDb );
+    sqlite3_free( tracker->zTable );
+    sqlite3_free( tracker->rowids );
+    sqlite3_free( tracker );
+    am_db->rowid_tracker = NULL;
+}
+
 /**
  * call-seq:
  *    database.close
@@ -98,8 +340,15 @@ VALUE am_sqlite3_database_close(VALUE self)
     int           rc = 0;
 
     Data_Get_Struct(self, am_sqlite3, am_db);
+    am_sqlite3_database_finalize_schema_cookies( am_db );
+    am_sqlite3_database_free_rowid_tracker( am_db );
     rc = sqlite3_close( am_db->db );
+    if ( SQLITE_OK == rc && NULL != am_db->db ) {
+        am_sqlite3_open_connections--;
+    }
     am_db->db = NULL;
+    am_query_stats_free( am_db->query_stats );
+    am_db->query_stats = NULL;
     if ( SQLITE_OK != rc ) {
         rb_raise(eAS_Error, "Failure to close database : [SQLITE_ERROR %d] : %s\n",
                 rc, sqlite3_errmsg( am_db->db ));
@@ -109,6 +358,96 @@ VALUE am_sqlite3_database_close(VALUE self)
 
 }
 
+/**
+ * call-seq:
+ *    database.schema_version( db_name = "main" ) -> Integer or nil
+ *
+ * Return the schema cookie of the named database, the value of PRAGMA
+ * schema_version, which changes every time the schema changes.  Returns nil
+ * if the schema version cannot be read at the moment, for instance because
+ * the database is locked.
+ *
+ * For the main and temp databases the pragma is prepared once and kept for
+ * the life of the connection, and the cookie is remembered along with the
+ * SQLITE_FCNTL_DATA_VERSION of the database.  Outside of a transaction, as
+ * long as the data version has not moved the remembered cookie is returned
+ * without running the pragma at all.  Changes made by other connections are
+ * noticed once this connection next reads from the database.
+ */
+VALUE am_sqlite3_database_schema_version(int argc, VALUE* argv, VALUE self)
+{
+    am_sqlite3       *am_db;
+    am_schema_cookie *cookie  = NULL;
+    VALUE             rDbName = Qnil;
+    const char       *zDbName = "main";
+    char             *zSql    = NULL;
+    sqlite3_stmt     *stmt    = NULL;
+    unsigned int      data_version = 0;
+    int               have_data_version;
+    int               version;
+    int               rc;
+
+    rb_scan_args( argc, argv, "01", &rDbName );
+    if ( Qnil != rDbName ) {
+        zDbName = StringValueCStr( rDbName );
+    }
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    if ( 0 == sqlite3_stricmp( zDbName, "main" ) ) {
+        cookie = &(am_db->schema_cookies[AM_SCHEMA_COOKIE_MAIN]);
+    } else if ( 0 == sqlite3_stricmp( zDbName, "temp" ) ) {
+        cookie = &(am_db->schema_cookies[AM_SCHEMA_COOKIE_TEMP]);
+    }
+
+    /* an attached database, read its cookie with a one off statement */
+    if ( NULL == cookie ) {
+        zSql = sqlite3_mprintf( "PRAGMA \"%w\".schema_version", zDbName );
+        rc = sqlite3_prepare_v2( am_db->db, zSql, -1, &stmt, NULL );
+        sqlite3_free( zSql );
+        if ( SQLITE_OK != rc ) {
+            rb_raise(eAS_Error, "Failure to prepare schema version query for database '%s' : [SQLITE_ERROR %d] : %s\n",
+                    zDbName, rc, sqlite3_errmsg( am_db->db ));
+        }
+        rc = am_sqlite3_database_step_schema_version( stmt, &version );
+        sqlite3_finalize( stmt );
+        return rc ? INT2FIX( version ) : Qnil;
+    }
+
+    /* the data version is only trusted outside of a transaction, uncommitted
+     * schema changes do not move it */
+    have_data_version = sqlite3_get_autocommit( am_db->db ) &&
+                        ( SQLITE_OK == sqlite3_file_control( am_db->db, zDbName, SQLITE_FCNTL_DATA_VERSION, &data_version ) );
+    if ( cookie->valid && have_data_version && ( data_version == cookie->data_version ) ) {
+        return INT2FIX( cookie->version );
+    }
+
+    if ( NULL == cookie->stmt ) {
+        zSql = sqlite3_mprintf( "PRAGMA %s.schema_version", ( cookie == &(am_db->schema_cookies[AM_SCHEMA_COOKIE_MAIN]) ) ? "main" : "temp" );
+        rc = sqlite3_prepare_v3( am_db->db, zSql, -1, SQLITE_PREPARE_PERSISTENT, &(cookie->stmt), NULL );
+        sqlite3_free( zSql );
+        if ( SQLITE_OK != rc ) {
+            rb_raise(eAS_Error, "Failure to prepare schema version query : [SQLITE_ERROR %d] : %s\n",
+                    rc, sqlite3_errmsg( am_db->db ));
+        }
+    }
+
+    cookie->valid = 0;
+    if ( !am_sqlite3_database_step_schema_version( cookie->stmt, &version ) ) {
+        return Qnil;
+    }
+
+    /* reading the cookie may itself have noticed a change by another
+     * connection, so take the data version again afterwards */
+    if ( have_data_version &&
+         ( SQLITE_OK == sqlite3_file_control( am_db->db, zDbName, SQLITE_FCNTL_DATA_VERSION, &data_version ) ) ) {
+        cookie->data_version = data_version;
+        cookie->valid        = 1;
+    }
+    cookie->version = version;
+
+    return INT2FIX( version );
+}
+
 /**
  * call-seq:
  *    database.last_insert_rowid -> Integer
@@ -164,6 +503,108 @@ VALUE am_sqlite3_database_row_changes(VALUE self)
     return INT2FIX(rc);
 }
 
+/*
+ * The update hook of the rowid tracker.  This is called while a statement is
+ * stepped, usually without the GVL, so it only records the rowid in C memory.
+ */
+static void am_sqlite3_database_track_rowid( void *ctx, int op, const char *zDb, const char *zTable, sqlite3_int64 rowid )
+{
+    am_rowid_tracker *tracker = (am_rowid_tracker*)ctx;
+    sqlite3_int64    *rowids;
+    long              capacity;
+
+    if ( ( SQLITE_DELETE == op ) ||
+         ( 0 != sqlite3_stricmp( zTable, tracker->zTable ) ) ||
+         ( 0 != sqlite3_stricmp( zDb, tracker->zDb ) ) ) {
+        return;
+    }
+    if ( ( tracker->count > 0 ) && ( tracker->rowids[tracker->count - 1] == rowid ) ) {
+        return;
+    }
+    if ( tracker->count == tracker->capacity ) {
+        capacity = ( 0 == tracker->capacity ) ? 16 : tracker->capacity * 2;
+        rowids   = sqlite3_realloc64( tracker->rowids, capacity * sizeof( sqlite3_int64 ) );
+        if ( NULL == rowids ) {
+            tracker->out_of_memory = 1;
+            return;
+        }
+        tracker->rowids   = rowids;
+        tracker->capacity = capacity;
+    }
+    tracker->rowids[tracker->count++] = rowid;
+}
+
+/**
+ * call-seq:
+ *    database.start_rowid_tracking( db_name, table_name ) -> nil
+ *
+ * Start recording the rowid of every row inserted or updated in the table
+ * +table_name+ of the database +db_name+, until #stop_rowid_tracking is
+ * called.  This is done with the sqlite3_update_hook of the connection,
+ * replacing any other update hook until the tracking stops, when the hook is
+ * removed.  Only one table may be tracked at a time.
+ */
+VALUE am_sqlite3_database_start_rowid_tracking(VALUE self, VALUE db_name, VALUE tbl_name)
+{
+    am_sqlite3       *am_db;
+    am_rowid_tracker *tracker;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    if ( NULL != am_db->rowid_tracker ) {
+        rb_raise(eAS_Error, "Already tracking the rowids of table '%s'", am_db->rowid_tracker->zTable );
+    }
+
+    tracker = sqlite3_malloc( sizeof( am_rowid_tracker ) );
+    if ( NULL == tracker ) {
+        rb_memerror();
+    }
+    memset( tracker, 0, sizeof( am_rowid_tracker ) );
+    tracker->zDb    = sqlite3_mprintf( "%s", StringValueCStr( db_name ) );
+    tracker->zTable = sqlite3_mprintf( "%s", StringValueCStr( tbl_name ) );
+    am_db->rowid_tracker = tracker;
+    if ( ( NULL == tracker->zDb ) || ( NULL == tracker->zTable ) ) {
+        am_sqlite3_database_free_rowid_tracker( am_db );
+        rb_memerror();
+    }
+
+    sqlite3_update_hook( am_db->db, am_sqlite3_database_track_rowid, tracker );
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *    database.stop_rowid_tracking -> Array
+ *
+ * Stop the tracking started by #start_rowid_tracking and return the rowids
+ * that were inserted or updated, in the order SQLite changed them.
+ */
+VALUE am_sqlite3_database_stop_rowid_tracking(VALUE self)
+{
+    am_sqlite3       *am_db;
+    am_rowid_tracker *tracker;
+    VALUE             rowids;
+    long              i;
+    int               out_of_memory;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    tracker = am_db->rowid_tracker;
+    if ( NULL == tracker ) {
+        return rb_ary_new();
+    }
+
+    rowids = rb_ary_new_capa( tracker->count );
+    for ( i = 0 ; i < tracker->count ; i++ ) {
+        rb_ary_push( rowids, SQLINT64_2NUM( tracker->rowids[i] ) );
+    }
+    out_of_memory = tracker->out_of_memory;
+    am_sqlite3_database_free_rowid_tracker( am_db );
+
+    if ( out_of_memory ) {
+        rb_memerror();
+    }
+    return rowids;
+}
+
 /**
  * call-seq:
  *    database.last_error_code -> Integer
@@ -264,32 +705,141 @@ VALUE am_sqlite3_database_stat_update_bang( int argc, VALUE *argv, VALUE self )
 
 
 
+/*
+ * call-seq:
+ *    database.configure_lookaside( slot_size, slot_count ) -> nil
+ *
+ * Give the connection slot_count lookaside memory slots of slot_size bytes
+ * each, SQLITE_DBCONFIG_LOOKASIDE.  Small, short lived allocations of the
+ * connection are taken from the slots instead of the heap.  A slot_count of
+ * 0 turns lookaside off.  This fails while any lookaside memory is in use, so
+ * it is best done right after the connection is opened.
+ */
+VALUE am_sqlite3_database_configure_lookaside(VALUE self, VALUE slot_size, VALUE slot_count)
+{
+    am_sqlite3   *am_db;
+    int           rc;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    rc = sqlite3_db_config( am_db->db, SQLITE_DBCONFIG_LOOKASIDE, NULL, NUM2INT( slot_size ), NUM2INT( slot_count ) );
+    if ( SQLITE_OK != rc ) {
+        rb_raise(eAS_Error, "Failure to configure lookaside memory : [SQLITE_ERROR %d] : %s\n",
+                rc, sqlite3_errstr( rc ));
+    }
+    return Qnil;
+}
+
+/* the sqlite3_db_status counters reported by Database#status_counters */
+static const struct {
+    int         op;
+    const char *name;
+} am_database_status_counters[] = {
+    { SQLITE_DBSTATUS_LOOKASIDE_USED,      "lookaside_used"      },
+    { SQLITE_DBSTATUS_CACHE_USED,          "cache_used"          },
+    { SQLITE_DBSTATUS_SCHEMA_USED,         "schema_used"         },
+    { SQLITE_DBSTATUS_STMT_USED,           "stmt_used"           },
+    { SQLITE_DBSTATUS_LOOKASIDE_HIT,       "lookaside_hit"       },
+    { SQLITE_DBSTATUS_LOOKASIDE_MISS_SIZE, "lookaside_miss_size" },
+    { SQLITE_DBSTATUS_LOOKASIDE_MISS_FULL, "lookaside_miss_full" },
+    { SQLITE_DBSTATUS_CACHE_HIT,           "cache_hit"           },
+    { SQLITE_DBSTATUS_CACHE_MISS,          "cache_miss"          },
+    { SQLITE_DBSTATUS_CACHE_WRITE,         "cache_write"         },
+    { SQLITE_DBSTATUS_DEFERRED_FKS,        "deferred_fks"        },
+    { SQLITE_DBSTATUS_CACHE_USED_SHARED,   "cache_used_shared"   },
+    { SQLITE_DBSTATUS_CACHE_SPILL,         "cache_spill"         },
+#ifdef SQLITE_DBSTATUS_TEMPBUF_SPILL
+    { SQLITE_DBSTATUS_TEMPBUF_SPILL,       "tempbuf_spill"       },
+#endif
+};
+
+/*
+ * call-seq:
+ *    database.status_counters( reset = false ) -> Hash
+ *
+ * Return every sqlite3_db_status counter of the database in a single call, as
+ * a Hash of the counter name, as a Symbol, to a [ current, highwater ] pair.
+ * A counter the SQLite library linked at runtime does not know of is left
+ * out.  If reset is true the counters are reset after they are read.
+ *
+ */
+VALUE am_sqlite3_database_status_counters( int argc, VALUE *argv, VALUE self )
+{
+    am_sqlite3  *am_db;
+    VALUE        reset;
+    VALUE        counters = rb_hash_new();
+    size_t       i;
+    int          current;
+    int          highwater;
+
+    rb_scan_args( argc, argv, "01", &reset );
+    Data_Get_Struct(self, am_sqlite3, am_db);
+
+    for ( i = 0 ; i < sizeof( am_database_status_counters ) / sizeof( am_database_status_counters[0] ) ; i++ ) {
+        if ( SQLITE_OK == sqlite3_db_status( am_db->db, am_database_status_counters[i].op, &current, &highwater, RTEST( reset ) ) ) {
+            rb_hash_aset( counters, ID2SYM( rb_intern( am_database_status_counters[i].name ) ),
+                          rb_assoc_new( INT2NUM( current ), INT2NUM( highwater ) ) );
+        }
+    }
+    return counters;
+}
+
+/* arguments for sqlite3_prepare_v3() invoked without the GVL */
+typedef struct am_prepare_args {
+    sqlite3       *db;
+    const char    *sql;
+    int            length;
+    unsigned int   flags;
+    sqlite3_stmt **stmt;
+    const char   **tail;
+} am_prepare_args_t;
+
+static void* am_sqlite3_database_prepare_func( void *data )
+{
+    am_prepare_args_t *args = (am_prepare_args_t*) data;
+    return (void*)(intptr_t) sqlite3_prepare_v3( args->db, args->sql, args->length, args->flags, args->stmt, args->tail );
+}
+
 /**
  * call-seq:
- *    database.prepare( sql ) -> SQLite3::Statement
+ *    database.prepare( sql, persistent = false ) -> SQLite3::Statement
  *
- * Create a new SQLite3 statement.
+ * Create a new SQLite3 statement.  If persistent is true the statement is
+ * prepared with SQLITE_PREPARE_PERSISTENT, telling SQLite it will be kept and
+ * reused many times.
  */
-VALUE am_sqlite3_database_prepare(VALUE self, VALUE rSQL)
+VALUE am_sqlite3_database_prepare(int argc, VALUE *argv, VALUE self)
 {
-    VALUE            sql = StringValue( rSQL );
+    VALUE            rSQL, persistent;
+    VALUE            sql;
     VALUE            stmt = am_sqlite3_statement_alloc(cAS_Statement);
     am_sqlite3      *am_db;
     am_sqlite3_stmt *am_stmt;
     const char      *tail;
     int              rc;
+    am_prepare_args_t args;
+
+    rb_scan_args( argc, argv, "11", &rSQL, &persistent );
+    sql = StringValue( rSQL );
 
     Data_Get_Struct(self, am_sqlite3, am_db);
 
     Data_Get_Struct(stmt, am_sqlite3_stmt, am_stmt);
-    rc = sqlite3_prepare_v2( am_db->db, RSTRING_PTR(sql), (int)RSTRING_LEN(sql),
-                            &(am_stmt->stmt), &tail);
+    args.db     = am_db->db;
+    args.sql    = RSTRING_PTR(sql);
+    args.length = (int)RSTRING_LEN(sql);
+    args.flags  = RTEST( persistent ) ? SQLITE_PREPARE_PERSISTENT : 0;
+    args.stmt   = &(am_stmt->stmt);
+    args.tail   = &tail;
+    rc = (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_database_prepare_func, &args, am_db->db );
+    RB_GC_GUARD( sql );
     if ( SQLITE_OK != rc) {
         rb_raise(eAS_Error, "Failure to prepare statement %s : [SQLITE_ERROR %d] : %s\n",
                 RSTRING_PTR(sql), rc, sqlite3_errmsg(am_db->db));
         am_sqlite3_statement_free( am_stmt );
     }
 
+    am_sqlite3_statement_index_parameters( am_stmt );
+
     if ( tail != NULL ) {
         am_stmt->remaining_sql = rb_str_new2( tail );
         rb_gc_register_address( &(am_stmt->remaining_sql) );
@@ -309,13 +859,17 @@ VALUE am_sqlite3_database_prepare(VALUE self, VALUE rSQL)
  */
 VALUE am_sqlite3_database_exec(VALUE self, VALUE rSQL)
 {
-  VALUE        sql = StringValue( rSQL );
-  am_sqlite3  *am_db;
-  int          rc;
+  VALUE          sql = StringValue( rSQL );
+  am_sqlite3    *am_db;
+  int            rc;
+  am_exec_args_t args;
 
   Data_Get_Struct(self, am_sqlite3, am_db);
-  
-  rc = sqlite3_exec( am_db->db, RSTRING_PTR(sql), NULL, NULL, NULL );
+
+  args.db  = am_db->db;
+  args.sql = RSTRING_PTR(sql);
+  rc = (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_database_exec_func, &args, am_db->db );
+  RB_GC_GUARD( sql );
 
   if ( SQLITE_OK != rc ){
     rb_raise( eAS_Error, "Failed to execute bulk statements: [SQLITE_ERROR %d] : %s\n",
@@ -333,56 +887,137 @@ VALUE am_sqlite3_database_exec(VALUE self, VALUE rSQL)
  * VALUE is also registered.
  *
  * When this function is called, it calls the 'trace' method on the tap object,
- * which is the VALUE that was registered during the sqlite3_trace_v2 call.
+ * the trace_obj of the am_sqlite3 registered during the sqlite3_trace_v2 call.
  *
  * This function corresponds to the SQLite xCallback function specification.
  *
  * https://sqlite.org/c3ref/c_trace.html
  *
  */
-int amalgalite_xTraceCallback(unsigned trace_type, void* tap, void* prepared_statement, void* extra)
+typedef struct am_trace_args {
+    unsigned  trace_type;
+    void     *tap;
+    void     *prepared_statement;
+    void     *extra;
+} am_trace_args_t;
+
+/*
+ * The expanded text of the prepared statement as a String, or the original
+ * text if it could not be expanded
+ */
+static VALUE amalgalite_trace_expanded_sql( sqlite3_stmt *stmt )
 {
-    VALUE     trace_obj = (VALUE) tap;
-    char*           msg;
-    sqlite3_uint64 time;
+    char  *expanded = sqlite3_expanded_sql( stmt );
+    VALUE  sql;
 
-    switch(trace_type) {
+    if ( NULL == expanded ) {
+        const char *text = sqlite3_sql( stmt );
+        return rb_str_new2( text ? text : "" );
+    }
+    sql = rb_str_new2( expanded );
+    sqlite3_free( expanded );
+    return sql;
+}
+
+static void* amalgalite_xTraceCallback_gvl( void *data )
+{
+    am_trace_args_t *args      = (am_trace_args_t*) data;
+    sqlite3_stmt    *prepared_statement = (sqlite3_stmt*) args->prepared_statement;
+    char            *msg;
+    VALUE            argv[2];
+    int              state = 0;
+    am_protected_t   protected;
+
+    protected.instance = (VALUE) args->tap;
+    protected.argv     = argv;
+
+    switch(args->trace_type) {
         case SQLITE_TRACE_STMT:
-            msg = (char*)extra;
+            msg = (char*)args->extra;
 
             /* The callback can compute the same text that would have been returned by the
              * legacy sqlite3_trace() interface by using the X argument when X begins with
              * "--" and invoking sqlite3_expanded_sql(P) otherwise.
              */
             if (0 != strncmp(msg, "--", 2)) {
-                msg = sqlite3_expanded_sql(prepared_statement);
+                argv[0] = amalgalite_trace_expanded_sql( prepared_statement );
+            } else {
+                argv[0] = rb_str_new2( msg );
             }
-
-            rb_funcall( trace_obj, rb_intern("trace"), 1, rb_str_new2( msg ) );
+            protected.method = rb_intern("trace");
+            protected.argc   = 1;
             break;
 
         case SQLITE_TRACE_PROFILE:
-            msg = sqlite3_expanded_sql(prepared_statement);
-            time = *(sqlite3_uint64*)extra;
-            rb_funcall( trace_obj, rb_intern("profile"),
-                         2, rb_str_new2( msg ), SQLUINT64_2NUM(time) );
+            argv[0] = amalgalite_trace_expanded_sql( prepared_statement );
+            argv[1] = SQLUINT64_2NUM( *(sqlite3_uint64*)args->extra );
+            protected.method = rb_intern("profile");
+            protected.argc   = 2;
             break;
 
-        case SQLITE_TRACE_ROW:
-            /* not implemented */
-            break;
+        default:
+            /* SQLITE_TRACE_ROW and SQLITE_TRACE_CLOSE are not implemented */
+            return NULL;
+    }
 
-        case SQLITE_TRACE_CLOSE:
-            /* not implemented */
-            break;
+    /* SQLite holds the database mutex here, so the tap may not unwind
+     * through it, the exception is raised once SQLite returns */
+    rb_protect( amalgalite_wrap_funcall2, (VALUE)&protected, &state );
+    if ( state ) {
+        amalgalite_save_callback_error( rb_errinfo( ) );
+        rb_set_errinfo( Qnil );
+    }
+    return NULL;
+}
 
-        default:
-            /* nothing */
-            break;
+int amalgalite_xTraceCallback(unsigned trace_type, void* context, void* prepared_statement, void* extra)
+{
+    am_sqlite3     *am_db = (am_sqlite3*) context;
+    am_trace_args_t args;
+
+    /* the statements amalgalite runs for itself are not traced */
+    if ( am_sqlite3_database_is_schema_cookie_stmt( am_db, prepared_statement ) ) {
+        return 0;
+    }
+
+    /* statistics are kept in C, only the tap needs the GVL */
+    if ( ( NULL != am_db->query_stats ) && am_db->query_stats->collecting ) {
+        am_query_stats_record( am_db->query_stats, trace_type, (sqlite3_stmt*)prepared_statement, extra );
     }
+    if ( ( Qnil == am_db->trace_obj ) || ( SQLITE_TRACE_ROW == trace_type ) ) {
+        return 0;
+    }
+
+    args.trace_type         = trace_type;
+    args.tap                = (void*) am_db->trace_obj;
+    args.prepared_statement = prepared_statement;
+    args.extra              = extra;
+
+    amalgalite_call_with_gvl( amalgalite_xTraceCallback_gvl, &args );
     return 0;
 }
 
+/*
+ * Register the trace callback for the events needed by the trace tap and the
+ * query statistics, or remove it if neither wants any.
+ */
+static void am_sqlite3_database_update_trace( am_sqlite3 *am_db )
+{
+    unsigned mask = 0;
+
+    if ( Qnil != am_db->trace_obj ) {
+        mask |= SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE;
+    }
+    if ( ( NULL != am_db->query_stats ) && am_db->query_stats->collecting ) {
+        mask |= SQLITE_TRACE_STMT | SQLITE_TRACE_ROW | SQLITE_TRACE_PROFILE;
+    }
+
+    if ( 0 == mask ) {
+        sqlite3_trace_v2( am_db->db, 0, NULL, NULL );
+    } else {
+        sqlite3_trace_v2( am_db->db, mask, amalgalite_xTraceCallback, (void *)am_db );
+    }
+}
 
 /**
  * call-seq:
@@ -408,9 +1043,9 @@ VALUE am_sqlite3_database_register_trace_tap(VALUE self, VALUE tap )
      */
     if ( Qnil == tap ) {
 
-        sqlite3_trace_v2( am_db->db, 0, NULL, NULL );
         rb_gc_unregister_address( &(am_db->trace_obj) );
         am_db->trace_obj = Qnil;
+        am_sqlite3_database_update_trace( am_db );
 
     /* register the item and store the reference to the object in the am_db
      * structure.  We also have to tell the Ruby garbage collector that we
@@ -420,9 +1055,81 @@ VALUE am_sqlite3_database_register_trace_tap(VALUE self, VALUE tap )
 
         am_db->trace_obj = tap;
         rb_gc_register_address( &(am_db->trace_obj) );
-        sqlite3_trace_v2( am_db->db, SQLITE_TRACE_STMT | SQLITE_TRACE_PROFILE, amalgalite_xTraceCallback, (void *)am_db->trace_obj );
+        am_sqlite3_database_update_trace( am_db );
+    }
+
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *   database.collect_query_stats = true or false
+ *
+ * Turn on or off the collection of statistics for every statement run on the
+ * connection, aggregated in C by the fingerprint of the statement: the number
+ * of calls, the total, minimum and maximum time, the rows returned and the
+ * full table scan steps.  Turning collection off keeps the statistics already
+ * collected.  They are read from the amalgalite_query_stats virtual table.
+ *
+ */
+VALUE am_sqlite3_database_set_collect_query_stats(VALUE self, VALUE flag)
+{
+    am_sqlite3    *am_db;
+    sqlite3_mutex *mutex;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+
+    if ( NULL == am_db->query_stats ) {
+        if ( !RTEST( flag ) ) {
+            return flag;
+        }
+        am_db->query_stats = am_query_stats_alloc();
+        if ( NULL == am_db->query_stats ) {
+            rb_raise(eAS_Error, "Failure to allocate query stats : [SQLITE_ERROR %d] : out of memory\n", SQLITE_NOMEM );
+        }
     }
 
+    mutex = sqlite3_db_mutex( am_db->db );
+    sqlite3_mutex_enter( mutex );
+    am_db->query_stats->collecting = RTEST( flag ) ? 1 : 0;
+    am_sqlite3_database_update_trace( am_db );
+    sqlite3_mutex_leave( mutex );
+
+    return flag;
+}
+
+/**
+ * call-seq:
+ *   database.collect_query_stats? -> true or false
+ *
+ * Are statement statistics being collected on the connection
+ */
+VALUE am_sqlite3_database_is_collecting_query_stats(VALUE self)
+{
+    am_sqlite3   *am_db;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    return ( ( NULL != am_db->query_stats ) && am_db->query_stats->collecting ) ? Qtrue : Qfalse;
+}
+
+/**
+ * call-seq:
+ *   database.reset_query_stats -> nil
+ *
+ * Forget all the statement statistics collected so far
+ */
+VALUE am_sqlite3_database_reset_query_stats(VALUE self)
+{
+    am_sqlite3    *am_db;
+    sqlite3_mutex *mutex;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+    if ( NULL != am_db->query_stats ) {
+        mutex = sqlite3_db_mutex( am_db->db );
+        sqlite3_mutex_enter( mutex );
+        am_query_stats_clear( am_db->query_stats );
+        sqlite3_mutex_leave( mutex );
+    }
     return Qnil;
 }
 
@@ -505,17 +1212,23 @@ VALUE sqlite3_value_to_ruby_value( sqlite3_value* s_value )
  * This function conforms to the xBusy function specification for
  * sqlite3_busy_handler.
  */
-int amalgalite_xBusy( void *pArg , int nArg)
+typedef struct am_busy_args {
+    void *pArg;
+    int   nArg;
+} am_busy_args_t;
+
+static void* amalgalite_xBusy_gvl( void *data )
 {
+    am_busy_args_t *busy_args = (am_busy_args_t*) data;
     VALUE         *args = ALLOCA_N( VALUE, 1 );
     VALUE          result = Qnil;
     int            state;
     int            busy = 1;
     am_protected_t protected;
 
-    args[0] = INT2FIX(nArg);
+    args[0] = INT2FIX(busy_args->nArg);
 
-    protected.instance = (VALUE)pArg;
+    protected.instance = (VALUE)busy_args->pArg;
     protected.method   = rb_intern("call");
     protected.argc     = 1;
     protected.argv     = args;
@@ -524,7 +1237,16 @@ int amalgalite_xBusy( void *pArg , int nArg)
     if ( state || ( Qnil == result || Qfalse == result ) ){
         busy = 0;
      }
-    return busy;
+    return (void*)(intptr_t)busy;
+}
+
+int amalgalite_xBusy( void *pArg , int nArg)
+{
+    am_busy_args_t args;
+
+    args.pArg = pArg;
+    args.nArg = nArg;
+    return (int)(intptr_t) amalgalite_call_with_gvl( amalgalite_xBusy_gvl, &args );
 }
 
 
@@ -579,7 +1301,7 @@ VALUE am_sqlite3_database_busy_handler( VALUE self, VALUE handler )
  * This function conforms to the xProgress function specification for
  * sqlite3_progress_handler.
  */
-int amalgalite_xProgress( void *pArg )
+static void* amalgalite_xProgress_gvl( void *pArg )
 {
     VALUE          result = Qnil;
     int            state;
@@ -595,7 +1317,12 @@ int amalgalite_xProgress( void *pArg )
     if ( state || ( Qnil == result || Qfalse == result ) ){
         cancel = 1;
      }
-    return cancel;
+    return (void*)(intptr_t)cancel;
+}
+
+int amalgalite_xProgress( void *pArg )
+{
+    return (int)(intptr_t) amalgalite_call_with_gvl( amalgalite_xProgress_gvl, pArg );
 }
 
 
@@ -642,8 +1369,18 @@ VALUE am_sqlite3_database_progress_handler( VALUE self, VALUE op_count, VALUE ha
  * This function conforms to the xFunc function specification for
  * sqlite3_create_function
  */
-void amalgalite_xFunc( sqlite3_context* context, int argc, sqlite3_value** argv )
+typedef struct am_xfunc_args {
+    sqlite3_context  *context;
+    int               argc;
+    sqlite3_value   **argv;
+} am_xfunc_args_t;
+
+static void* amalgalite_xFunc_gvl( void *data )
 {
+    am_xfunc_args_t *func_args = (am_xfunc_args_t*) data;
+    sqlite3_context *context   = func_args->context;
+    int              argc      = func_args->argc;
+    sqlite3_value  **argv      = func_args->argv;
     VALUE         *args = ALLOCA_N( VALUE, argc );
     VALUE          result;
     int            state;
@@ -672,7 +1409,17 @@ void amalgalite_xFunc( sqlite3_context* context, int argc, sqlite3_value** argv
         amalgalite_set_context_result( context, result );
     }
 
-    return; 
+    return NULL;
+}
+
+void amalgalite_xFunc( sqlite3_context* context, int argc, sqlite3_value** argv )
+{
+    am_xfunc_args_t args;
+
+    args.context = context;
+    args.argc    = argc;
+    args.argv    = argv;
+    amalgalite_call_with_gvl( amalgalite_xFunc_gvl, &args );
 }
 
 /**
@@ -758,8 +1505,12 @@ VALUE amalgalite_wrap_new_aggregate( VALUE arg )
  * This function conforms to the xStep function specification for
  * sqlite3_create_function.
  */
-void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv )
+static void* amalgalite_xStep_gvl( void *data )
 {
+    am_xfunc_args_t *func_args = (am_xfunc_args_t*) data;
+    sqlite3_context *context   = func_args->context;
+    int              argc      = func_args->argc;
+    sqlite3_value  **argv      = func_args->argv;
     VALUE         *args = ALLOCA_N( VALUE, argc );
     VALUE          result;
     int            state;
@@ -769,7 +1520,7 @@ void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv
 
     if ( 0 == aggregate_context ) {
         sqlite3_result_error_nomem( context );
-        return;
+        return NULL;
     }
 
     /* instantiate an instance of the aggregate function class if the 
@@ -788,7 +1539,7 @@ void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv
             rb_gc_register_address( aggregate_context );
             VALUE msg = rb_obj_as_string( *aggregate_context );
             sqlite3_result_error( context, RSTRING_PTR(msg), (int)RSTRING_LEN(msg));
-            return;
+            return NULL;
         } else {
             *aggregate_context = result;
             /* mark the instance as protected from collection */
@@ -819,7 +1570,17 @@ void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv
         rb_iv_set( *aggregate_context, "@_exception", rb_gv_get("$!" ));
     }
 
-    return ;
+    return NULL;
+}
+
+void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv )
+{
+    am_xfunc_args_t args;
+
+    args.context = context;
+    args.argc    = argc;
+    args.argv    = argv;
+    amalgalite_call_with_gvl( amalgalite_xStep_gvl, &args );
 }
 
 
@@ -830,8 +1591,9 @@ void amalgalite_xStep( sqlite3_context* context, int argc, sqlite3_value** argv
  * This function conforms to the xFinal function specification for
  * sqlite3_create_function.
  */
-void amalgalite_xFinal( sqlite3_context* context )
+static void* amalgalite_xFinal_gvl( void *data )
 {
+    sqlite3_context *context = (sqlite3_context*) data;
     VALUE          result;
     int            state;
     am_protected_t protected;
@@ -884,7 +1646,12 @@ void amalgalite_xFinal( sqlite3_context* context )
     /* release the aggregate instance from garbage collector protection */
     rb_gc_unregister_address( aggregate_context );
 
-    return ;
+    return NULL;
+}
+
+void amalgalite_xFinal( sqlite3_context* context )
+{
+    amalgalite_call_with_gvl( amalgalite_xFinal_gvl, context );
 }
 
 
@@ -961,6 +1728,12 @@ VALUE am_sqlite3_database_remove_aggregate( VALUE self, VALUE name, VALUE arity,
 }
 
 
+static void* am_sqlite3_database_interrupt_func( void *db )
+{
+    sqlite3_interrupt( (sqlite3*) db );
+    return NULL;
+}
+
 /**
  * call-seq:
  *  database.interrupt!
@@ -973,10 +1746,136 @@ VALUE am_sqlite3_database_interrupt_bang( VALUE self )
     am_sqlite3  *am_db;
 
     Data_Get_Struct(self, am_sqlite3, am_db);
-    sqlite3_interrupt( am_db->db );
+
+    /* the thread running the statement to interrupt may be waiting on the GVL,
+     * let it have it while interrupting */
+    amalgalite_call_without_gvl( am_sqlite3_database_interrupt_func, am_db->db, am_db->db );
     return Qnil;
 }
 
+/* the counters of one statement copied by am_sqlite3_database_statement_stats */
+typedef struct am_statement_snapshot {
+    int   counters[AM_STATEMENT_STATUS_COUNTERS];
+    int   busy;
+    char *sql;
+} am_statement_snapshot_t;
+
+/* the statements of a connection copied by am_sqlite3_database_statement_stats */
+typedef struct am_statement_snapshots {
+    am_statement_snapshot_t *snapshots;
+    long                     count;
+} am_statement_snapshots_t;
+
+/* convert the copied statements to an Array of Hashes, run through rb_ensure */
+static VALUE am_sqlite3_database_statement_snapshots_to_a( VALUE arg )
+{
+    am_statement_snapshots_t *all   = (am_statement_snapshots_t*) arg;
+    VALUE                     list  = rb_ary_new2( all->count );
+    VALUE                     stats;
+    long                      i;
+    int                       c;
+
+    for ( i = 0 ; i < all->count ; i++ ) {
+        stats = rb_hash_new();
+        for ( c = 0 ; c < AM_STATEMENT_STATUS_COUNTERS ; c++ ) {
+            rb_hash_aset( stats, ID2SYM( rb_intern( am_statement_status_counter_names[c] ) ),
+                          INT2NUM( all->snapshots[i].counters[c] ) );
+        }
+        rb_hash_aset( stats, ID2SYM( rb_intern( "sql" ) ), rb_utf8_str_new_cstr( all->snapshots[i].sql ) );
+        rb_hash_aset( stats, ID2SYM( rb_intern( "busy" ) ), all->snapshots[i].busy ? Qtrue : Qfalse );
+        rb_ary_push( list, stats );
+    }
+    return list;
+}
+
+static VALUE am_sqlite3_database_statement_snapshots_free( VALUE arg )
+{
+    am_statement_snapshots_t *all = (am_statement_snapshots_t*) arg;
+
+    /* the sql of the snapshots is in the same allocation */
+    sqlite3_free( all->snapshots );
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *    database.statement_stats( reset = false ) -> Array
+ *
+ * The runtime counters of every statement prepared on the connection that
+ * has not been finalized, found with sqlite3_next_stmt.  Each is a Hash of
+ * the counters of SQLite3::Statement#stats, without rows, along with the
+ * :sql of the statement and whether it is :busy, part way through running.
+ * If +reset+ is true the counters are set back to 0 after they are read.
+ *
+ */
+VALUE am_sqlite3_database_statement_stats(int argc, VALUE *argv, VALUE self)
+{
+    am_sqlite3               *am_db;
+    sqlite3_stmt             *stmt = NULL;
+    sqlite3_mutex            *mutex;
+    am_statement_snapshots_t  all;
+    VALUE                     reset;
+    sqlite3_uint64            size = 0;
+    char                     *sql;
+    const char               *text;
+    long                      count = 0;
+    int                       c;
+
+    rb_scan_args( argc, argv, "01", &reset );
+    Data_Get_Struct(self, am_sqlite3, am_db);
+
+    /* The garbage collector may finalize statements, so no ruby objects are
+     * created while walking the list of statements.  The counters and sql are
+     * copied with the connection mutex held, since another thread may be
+     * preparing or finalizing statements without the GVL. */
+    mutex = sqlite3_db_mutex( am_db->db );
+    sqlite3_mutex_enter( mutex );
+    while ( NULL != ( stmt = sqlite3_next_stmt( am_db->db, stmt ) ) ) {
+        text  = sqlite3_sql( stmt );
+        size += ( text ? strlen( text ) : 0 ) + 1;
+        count++;
+    }
+
+    all.count     = 0;
+    all.snapshots = sqlite3_malloc64( count * sizeof( am_statement_snapshot_t ) + size + 1 );
+    if ( NULL == all.snapshots ) {
+        sqlite3_mutex_leave( mutex );
+        rb_raise(eAS_Error, "Failure to copy the statement stats : [SQLITE_ERROR %d] : out of memory\n", SQLITE_NOMEM );
+    }
+
+    sql = (char*)( all.snapshots + count );
+    while ( NULL != ( stmt = sqlite3_next_stmt( am_db->db, stmt ) ) ) {
+        if ( am_sqlite3_database_is_schema_cookie_stmt( am_db, stmt ) ) {
+            continue;
+        }
+        for ( c = 0 ; c < AM_STATEMENT_STATUS_COUNTERS ; c++ ) {
+            all.snapshots[all.count].counters[c] = sqlite3_stmt_status( stmt, am_statement_status_counter_ops[c], RTEST( reset ) );
+        }
+        all.snapshots[all.count].busy = sqlite3_stmt_busy( stmt );
+        all.snapshots[all.count].sql  = sql;
+        text = sqlite3_sql( stmt );
+        strcpy( sql, text ? text : "" );
+        sql += strlen( sql ) + 1;
+        all.count++;
+    }
+    sqlite3_mutex_leave( mutex );
+
+    return rb_ensure( am_sqlite3_database_statement_snapshots_to_a, (VALUE)&all,
+                      am_sqlite3_database_statement_snapshots_free, (VALUE)&all );
+}
+
+/* arguments for sqlite3_backup_step() invoked without the GVL */
+typedef struct am_backup_step_args {
+    sqlite3_backup *backup;
+    int             pages;
+} am_backup_step_args_t;
+
+static void* am_sqlite3_database_backup_step_func( void *data )
+{
+    am_backup_step_args_t *args = (am_backup_step_args_t*) data;
+    return (void*)(intptr_t) sqlite3_backup_step( args->backup, args->pages );
+}
+
 /**
  * call-seq:
  *  database.replicate_to( other_db  ) -> other_db
@@ -996,6 +1895,7 @@ VALUE am_sqlite3_database_replicate_to( VALUE self, VALUE other )
 
     int             rc_s;
     int             rc_f;
+    am_backup_step_args_t args;
 
     /* source database */
     Data_Get_Struct(self, am_sqlite3, am_src_db);
@@ -1011,7 +1911,9 @@ VALUE am_sqlite3_database_replicate_to( VALUE self, VALUE other )
                  sqlite3_errcode( dest ), sqlite3_errmsg( dest ));
     }
 
-    rc_s = sqlite3_backup_step( backup, -1 ); /* copy the whole thing at once */
+    args.backup = backup;
+    args.pages  = -1; /* copy the whole thing at once */
+    rc_s = (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_database_backup_step_func, &args, src );
     rc_f = sqlite3_backup_finish( backup ); 
 
     /* report the rc_s error if that one is bad, 
@@ -1027,6 +1929,129 @@ VALUE am_sqlite3_database_replicate_to( VALUE self, VALUE other )
     return other;
 }
 
+/* the state of an incremental backup driven by am_sqlite3_database_backup_to */
+typedef struct am_backup_loop {
+    sqlite3_backup *backup;
+    sqlite3        *src;
+    sqlite3        *dest;
+    int             pages;     /* pages copied per step */
+    int             sleep_ms;  /* pause between steps */
+    VALUE           progress;  /* called with remaining and pagecount */
+    int             rc;        /* result of the last step */
+} am_backup_loop_t;
+
+/* wait +ms+ milliseconds with the GVL released */
+static void am_backup_sleep( int ms )
+{
+    struct timeval tv;
+
+    tv.tv_sec  = ms / 1000;
+    tv.tv_usec = ( ms % 1000 ) * 1000;
+    rb_thread_wait_for( tv );
+}
+
+/* step the backup to completion, run through rb_ensure */
+static VALUE am_sqlite3_database_backup_loop( VALUE arg )
+{
+    am_backup_loop_t     *loop = (am_backup_loop_t*) arg;
+    am_backup_step_args_t args;
+
+    args.backup = loop->backup;
+    args.pages  = loop->pages;
+
+    while ( 1 ) {
+        loop->rc = (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_database_backup_step_func, &args, loop->src );
+
+        if ( ( SQLITE_OK != loop->rc ) && ( SQLITE_DONE != loop->rc ) &&
+             ( SQLITE_BUSY != loop->rc ) && ( SQLITE_LOCKED != loop->rc ) ) {
+            break;
+        }
+
+        if ( Qnil != loop->progress ) {
+            rb_funcall( loop->progress, rb_intern("call"), 2,
+                        INT2FIX( sqlite3_backup_remaining( loop->backup ) ),
+                        INT2FIX( sqlite3_backup_pagecount( loop->backup ) ) );
+        }
+
+        if ( SQLITE_DONE == loop->rc ) {
+            break;
+        }
+
+        /* give writers a turn, and a busy or locked source time to clear */
+        if ( loop->sleep_ms > 0 ) {
+            am_backup_sleep( loop->sleep_ms );
+        } else if ( SQLITE_OK != loop->rc ) {
+            am_backup_sleep( 1 );
+        }
+    }
+    return Qnil;
+}
+
+/* finish the backup however the loop ended */
+static VALUE am_sqlite3_database_backup_finish( VALUE arg )
+{
+    am_backup_loop_t *loop = (am_backup_loop_t*) arg;
+
+    sqlite3_backup_finish( loop->backup );
+    loop->backup = NULL;
+    return Qnil;
+}
+
+/**
+ * call-seq:
+ *  database.backup_to( other_db, dest_name, src_name, pages_per_step, sleep_ms, progress ) -> other_db
+ *
+ * Copies the +src_name+ database of this connection to the +dest_name+
+ * database of +other_db+ using the sqlite3_backup api, +pages_per_step+ pages
+ * at a time.  The source is only locked while a step runs, and the GVL is
+ * released for each step and for the +sleep_ms+ pause between them.
+ *
+ * If +progress+ is not nil, its call method is invoked after each step with
+ * the number of pages remaining and the total page count.  A write to the
+ * source by another connection restarts the copy, which is seen as the
+ * remaining count going back up.  If the source is busy or locked the step
+ * is retried.
+ *
+ */
+VALUE am_sqlite3_database_backup_to( VALUE self, VALUE other, VALUE dest_name, VALUE src_name,
+                                     VALUE pages_per_step, VALUE sleep_ms, VALUE progress )
+{
+    am_sqlite3       *am_src_db;
+    am_sqlite3       *am_dest_db;
+    am_backup_loop_t  loop;
+
+    Data_Get_Struct(self, am_sqlite3, am_src_db);
+    Data_Get_Struct(other, am_sqlite3, am_dest_db);
+
+    loop.src      = am_src_db->db;
+    loop.dest     = am_dest_db->db;
+    loop.pages    = NUM2INT( pages_per_step );
+    loop.sleep_ms = NUM2INT( sleep_ms );
+    loop.progress = progress;
+    loop.rc       = SQLITE_OK;
+
+    if ( 0 == loop.pages ) {
+        rb_raise( rb_eArgError, "pages_per_step must not be 0" );
+    }
+
+    loop.backup = sqlite3_backup_init( loop.dest, StringValueCStr( dest_name ),
+                                       loop.src, StringValueCStr( src_name ) );
+    if ( NULL == loop.backup ) {
+        rb_raise(eAS_Error, "Failure to initialize backup:  [SQLITE_ERROR %d] : %s\n",
+                 sqlite3_errcode( loop.dest ), sqlite3_errmsg( loop.dest ));
+    }
+
+    rb_ensure( am_sqlite3_database_backup_loop, (VALUE)&loop,
+               am_sqlite3_database_backup_finish, (VALUE)&loop );
+
+    if ( SQLITE_DONE != loop.rc ) {
+        rb_raise(eAS_Error, "Failure in backup : [SQLITE_ERROR %d] : %s\n",
+                 loop.rc, sqlite3_errmsg( loop.dest ) );
+    }
+
+    return other;
+}
+
 /**
  * call-seq:
  *    database.table_column_metadata( db_name, table_name, column_name) -> Hash
@@ -1083,6 +2108,37 @@ VALUE am_sqlite3_database_table_column_metadata(VALUE self, VALUE db_name, VALUE
     return rHash;
 }
 
+/**
+ * call-seq:
+ *    database.rowid_column?( db_name, table_name, column_name ) -> true or false
+ *
+ * Is the column the rowid of the table, or an alias for it.  That is the
+ * column is an INTEGER PRIMARY KEY, or it is one of ROWID, OID or _ROWID_ and
+ * no column of the table has that name.  Returns false if the table or column
+ * does not exist.
+ *
+ */
+VALUE am_sqlite3_database_is_rowid_column(VALUE self, VALUE db_name, VALUE tbl_name, VALUE col_name)
+{
+    am_sqlite3  *am_db;
+    const char  *pzDataType = NULL;
+    int          pPrimaryKey = 0;
+    int          rc;
+
+    Data_Get_Struct(self, am_sqlite3, am_db);
+
+    rc = sqlite3_table_column_metadata( am_db->db,
+                                        StringValueCStr( db_name ),
+                                        StringValueCStr( tbl_name ),
+                                        StringValueCStr( col_name ),
+                                        &pzDataType, NULL, NULL, &pPrimaryKey, NULL );
+    if ( SQLITE_OK != rc ) {
+        return Qfalse;
+    }
+
+    return ( pPrimaryKey && ( NULL != pzDataType ) && ( 0 == sqlite3_stricmp( pzDataType, "INTEGER" ) ) ) ? Qtrue : Qfalse;
+}
+
 /***********************************************************************
  * Ruby life cycle methods
  ***********************************************************************/
@@ -1113,6 +2169,14 @@ void am_sqlite3_database_free(am_sqlite3* am_db)
         rb_gc_unregister_address( &(am_db->progress_handler_obj) );
         am_db->progress_handler_obj = Qnil;
     }
+
+    am_sqlite3_database_finalize_schema_cookies( am_db );
+    am_sqlite3_database_free_rowid_tracker( am_db );
+    if ( NULL != am_db->db ) {
+        sqlite3_trace_v2( am_db->db, 0, NULL, NULL );
+    }
+    am_query_stats_free( am_db->query_stats );
+    am_db->query_stats = NULL;
     am_db->db = NULL;
 
     free(am_db);
@@ -1132,6 +2196,9 @@ VALUE am_sqlite3_database_alloc(VALUE klass)
     am_db->busy_handler_obj     = Qnil;
     am_db->progress_handler_obj = Qnil;
     am_db->db                   = NULL;
+    memset( am_db->schema_cookies, 0, sizeof( am_db->schema_cookies ) );
+    am_db->rowid_tracker        = NULL;
+    am_db->query_stats          = NULL;
 
     obj = Data_Wrap_Struct(klass, NULL, am_sqlite3_database_free, am_db);
     return obj;
@@ -1157,13 +2224,20 @@ void Init_amalgalite_database( )
     rb_define_alloc_func(cAS_Database, am_sqlite3_database_alloc);
     rb_define_singleton_method(cAS_Database, "open", am_sqlite3_database_open, -1);
     rb_define_singleton_method(cAS_Database, "open16", am_sqlite3_database_open16, 1);
-    rb_define_method(cAS_Database, "prepare", am_sqlite3_database_prepare, 1);
+    rb_define_method(cAS_Database, "prepare", am_sqlite3_database_prepare, -1);
+    rb_define_method(cAS_Database, "schema_version", am_sqlite3_database_schema_version, -1); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "close", am_sqlite3_database_close, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "last_insert_rowid", am_sqlite3_database_last_insert_rowid, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "autocommit?", am_sqlite3_database_is_autocommit, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "register_trace_tap", am_sqlite3_database_register_trace_tap, 1); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "collect_query_stats=", am_sqlite3_database_set_collect_query_stats, 1); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "collect_query_stats?", am_sqlite3_database_is_collecting_query_stats, 0); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "reset_query_stats", am_sqlite3_database_reset_query_stats, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "table_column_metadata", am_sqlite3_database_table_column_metadata, 3); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "rowid_column?", am_sqlite3_database_is_rowid_column, 3); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "row_changes", am_sqlite3_database_row_changes, 0); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "start_rowid_tracking", am_sqlite3_database_start_rowid_tracking, 2); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "stop_rowid_tracking", am_sqlite3_database_stop_rowid_tracking, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "total_changes", am_sqlite3_database_total_changes, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "last_error_code", am_sqlite3_database_last_error_code, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "last_error_message", am_sqlite3_database_last_error_message, 0); /* in amalgalite_database.c */
@@ -1175,6 +2249,10 @@ void Init_amalgalite_database( )
     rb_define_method(cAS_Database, "progress_handler", am_sqlite3_database_progress_handler, 2); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "interrupt!", am_sqlite3_database_interrupt_bang, 0); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "replicate_to", am_sqlite3_database_replicate_to, 1); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "backup_to", am_sqlite3_database_backup_to, 6); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "statement_stats", am_sqlite3_database_statement_stats, -1); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "status_counters", am_sqlite3_database_status_counters, -1); /* in amalgalite_database.c */
+    rb_define_method(cAS_Database, "configure_lookaside", am_sqlite3_database_configure_lookaside, 2); /* in amalgalite_database.c */
     rb_define_method(cAS_Database, "execute_batch", am_sqlite3_database_exec, 1); /* in amalgalite_database.c */
 
 
@@ -0,0 +1,414 @@
+#include "amalgalite.h"
+/**
+ * Copyright (c) 2008 Jeremy Hinegardner
+ * All rights reserved.  See LICENSE and/or COPYING for details.
+ *
+ * vim: shiftwidth=4
+ */
+
+/*
+ * Strict parsing and fixed format formatting of the date and time strings
+ * that SQLite and Amalgalite store.  Parsing accepts:
+ *
+ *   YYYY-MM-DD
+ *   YYYY-MM-DD HH:MM
+ *   YYYY-MM-DD HH:MM:SS
+ *   YYYY-MM-DD HH:MM:SS.SSSSSSSSS
+ *
+ * with either a ' ' or a 'T' between the date and the time, and an optional
+ * time zone of 'Z', 'UTC', +HH, +HHMM or +HH:MM, which may be preceeded by a
+ * space.  Anything else is left to the ruby parsers.
+ */
+
+/* the pieces of a parsed date and time string */
+typedef struct am_datetime {
+    int  year, month, day;
+    int  hour, minute, second;
+    long nsec;
+    int  has_time;
+    int  has_zone;
+    int  utc;
+    int  offset;   /* seconds east of UTC */
+} am_datetime;
+
+static ID id_civil;
+static ID id_local;
+static ID id_utc;
+static ID id_new;
+static ID id_year;
+static ID id_mon;
+static ID id_mday;
+static ID id_hour;
+static ID id_min;
+static ID id_sec;
+static ID id_zone;
+static ID id_utc_p;
+static ID id_parse;
+static ID id_date;
+static ID id_datetime;
+static ID id_time;
+
+/* Date and DateTime, loaded when first used */
+static VALUE cDate     = Qnil;
+static VALUE cDateTime = Qnil;
+
+static void am_load_date( )
+{
+    if ( Qnil == cDate ) {
+        rb_require( "date" );
+        cDate     = rb_const_get( rb_cObject, rb_intern( "Date" ) );
+        cDateTime = rb_const_get( rb_cObject, rb_intern( "DateTime" ) );
+    }
+}
+
+static int am_days_in_month( int year, int month )
+{
+    static const int days[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+    if ( ( 2 == month ) && ( ( 0 == year % 4 ) && ( ( 0 != year % 100 ) || ( 0 == year % 400 ) ) ) ) {
+        return 29;
+    }
+    return days[ month - 1 ];
+}
+
+/* read exactly n digits from *p into *out, advancing *p */
+static int am_read_digits( const char **p, const char *end, int n, int *out )
+{
+    int v = 0;
+    int i;
+
+    if ( end - *p < n ) { return 0; }
+    for ( i = 0 ; i < n ; i++ ) {
+        if ( (*p)[i] < '0' || (*p)[i] > '9' ) { return 0; }
+        v = ( v * 10 ) + ( (*p)[i] - '0' );
+    }
+    *p  += n;
+    *out = v;
+    return 1;
+}
+
+/*
+ * Parse str into dt.  Returns 1 if the whole string is in one of the strict
+ * formats and the date and time are valid, 0 otherwise.
+ */
+static int am_parse_datetime( VALUE str, am_datetime *dt )
+{
+    const char *p   = RSTRING_PTR( str );
+    const char *end = p + RSTRING_LEN( str );
+    int         sign, zh, zm = 0, digits;
+
+    memset( dt, 0, sizeof( am_datetime ) );
+
+    if ( !am_read_digits( &p, end, 4, &dt->year ) )  { return 0; }
+    if ( p >= end || *p++ != '-' )                   { return 0; }
+    if ( !am_read_digits( &p, end, 2, &dt->month ) ) { return 0; }
+    if ( p >= end || *p++ != '-' )                   { return 0; }
+    if ( !am_read_digits( &p, end, 2, &dt->day ) )   { return 0; }
+
+    if ( dt->month < 1 || dt->month > 12 )                               { return 0; }
+    if ( dt->day < 1 || dt->day > am_days_in_month( dt->year, dt->month ) ) { return 0; }
+
+    if ( p < end && ( *p == 'T' || *p == ' ' ) && ( end - p ) > 1 && p[1] >= '0' && p[1] <= '9' ) {
+        p++;
+        dt->has_time = 1;
+        if ( !am_read_digits( &p, end, 2, &dt->hour ) )   { return 0; }
+        if ( p >= end || *p++ != ':' )                    { return 0; }
+        if ( !am_read_digits( &p, end, 2, &dt->minute ) ) { return 0; }
+        if ( p < end && *p == ':' ) {
+            p++;
+            if ( !am_read_digits( &p, end, 2, &dt->second ) ) { return 0; }
+            if ( p < end && *p == '.' ) {
+                p++;
+                digits = 0;
+                while ( p < end && *p >= '0' && *p <= '9' ) {
+                    if ( digits < 9 ) {
+                        dt->nsec = ( dt->nsec * 10 ) + ( *p - '0' );
+                        digits++;
+                    }
+                    p++;
+                }
+                if ( 0 == digits ) { return 0; }
+                for ( ; digits < 9 ; digits++ ) { dt->nsec *= 10; }
+            }
+        }
+        if ( dt->hour > 23 || dt->minute > 59 || dt->second > 59 ) { return 0; }
+
+        if ( p < end && *p == ' ' ) { p++; }
+        if ( p < end ) {
+            dt->has_zone = 1;
+            if ( *p == 'Z' ) {
+                p++;
+                dt->utc = 1;
+            } else if ( ( end - p ) >= 3 && 0 == strncmp( p, "UTC", 3 ) ) {
+                p += 3;
+                dt->utc = 1;
+            } else if ( *p == '+' || *p == '-' ) {
+                sign = ( *p++ == '-' ) ? -1 : 1;
+                if ( !am_read_digits( &p, end, 2, &zh ) ) { return 0; }
+                if ( p < end && *p == ':' ) {
+                    /* a separator must be followed by the minutes */
+                    p++;
+                    if ( !am_read_digits( &p, end, 2, &zm ) ) { return 0; }
+                } else if ( p < end && !am_read_digits( &p, end, 2, &zm ) ) {
+                    return 0;
+                }
+                if ( zh > 23 || zm > 59 ) { return 0; }
+                dt->offset = sign * ( ( zh * 3600 ) + ( zm * 60 ) );
+            } else {
+                return 0;
+            }
+        }
+    }
+
+    return ( p == end );
+}
+
+/* the seconds of dt, a Rational if there are fractional seconds */
+static VALUE am_datetime_seconds( am_datetime *dt )
+{
+    if ( 0 == dt->nsec ) {
+        return INT2FIX( dt->second );
+    }
+    return rb_rational_new( LL2NUM( ( (LONG_LONG)dt->second * 1000000000LL ) + dt->nsec ),
+                            LL2NUM( 1000000000LL ) );
+}
+
+/* the zone offset of dt as +HH:MM */
+static VALUE am_datetime_zone( am_datetime *dt )
+{
+    char buf[8];
+    int  offset = dt->offset < 0 ? -dt->offset : dt->offset;
+    snprintf( buf, sizeof( buf ), "%c%02d:%02d", ( dt->offset < 0 ? '-' : '+' ),
+              offset / 3600, ( offset % 3600 ) / 60 );
+    return rb_str_new2( buf );
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.parse_date( str ) -> Date or nil
+ *
+ * Parse the ISO-8601 or SQLite date, or date and time, in +str+ as a Date.
+ * Returns nil if +str+ is not in one of the strict formats.
+ */
+VALUE am_sqlite3_parse_date( VALUE self, VALUE str )
+{
+    am_datetime dt;
+
+    StringValue( str );
+    if ( !am_parse_datetime( str, &dt ) ) {
+        return Qnil;
+    }
+    am_load_date( );
+    return rb_funcall( cDate, id_civil, 3,
+                       INT2FIX( dt.year ), INT2FIX( dt.month ), INT2FIX( dt.day ) );
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.parse_datetime( str ) -> DateTime or nil
+ *
+ * Parse the ISO-8601 or SQLite date and time in +str+ as a DateTime.  If there
+ * is no time zone the DateTime is in UTC.  Returns nil if +str+ is not in one
+ * of the strict formats.
+ */
+VALUE am_sqlite3_parse_datetime( VALUE self, VALUE str )
+{
+    am_datetime dt;
+
+    StringValue( str );
+    if ( !am_parse_datetime( str, &dt ) ) {
+        return Qnil;
+    }
+    am_load_date( );
+    return rb_funcall( cDateTime, id_civil, 7,
+                       INT2FIX( dt.year ), INT2FIX( dt.month ), INT2FIX( dt.day ),
+                       INT2FIX( dt.hour ), INT2FIX( dt.minute ), am_datetime_seconds( &dt ),
+                       am_datetime_zone( &dt ) );
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.parse_time( str ) -> Time or nil
+ *
+ * Parse the ISO-8601 or SQLite date and time in +str+ as a Time.  If there is
+ * no time zone the Time is in local time.  Returns nil if +str+ is not in one
+ * of the strict formats.
+ */
+VALUE am_sqlite3_parse_time( VALUE self, VALUE str )
+{
+    am_datetime dt;
+    VALUE       args[7];
+
+    StringValue( str );
+    if ( !am_parse_datetime( str, &dt ) ) {
+        return Qnil;
+    }
+
+    args[0] = INT2FIX( dt.year );
+    args[1] = INT2FIX( dt.month );
+    args[2] = INT2FIX( dt.day );
+    args[3] = INT2FIX( dt.hour );
+    args[4] = INT2FIX( dt.minute );
+    args[5] = am_datetime_seconds( &dt );
+
+    if ( !dt.has_zone ) {
+        return rb_funcallv( rb_cTime, id_local, 6, args );
+    } else if ( dt.utc ) {
+        return rb_funcallv( rb_cTime, id_utc, 6, args );
+    }
+    args[6] = am_datetime_zone( &dt );
+    return rb_funcallv( rb_cTime, id_new, 7, args );
+}
+
+/* convert days since 1970-01-01 to a civil year, month and day */
+static void am_civil_from_days( LONG_LONG z, int *year, int *month, int *day )
+{
+    LONG_LONG era, doe, yoe, y, doy, mp;
+
+    z  += 719468;
+    era = ( z >= 0 ? z : z - 146096 ) / 146097;
+    doe = z - era * 146097;
+    yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    y   = yoe + era * 400;
+    doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    mp  = ( 5 * doy + 2 ) / 153;
+    *day   = (int)( doy - ( 153 * mp + 2 ) / 5 + 1 );
+    *month = (int)( mp < 10 ? mp + 3 : mp - 9 );
+    *year  = (int)( y + ( *month <= 2 ) );
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.format_time( obj ) -> String
+ *
+ * Format a Time, DateTime or Date as a String for binding to a statement.  The
+ * result is the same as +obj.to_s+, built with a fixed format.  Any other
+ * object is converted with +to_s+.
+ */
+VALUE am_sqlite3_format_time( VALUE self, VALUE obj )
+{
+    char            buf[64];
+    struct timespec ts;
+    LONG_LONG       secs, days;
+    long            offset, abs_offset;
+    int             year, month, day, rem;
+    VALUE           zone;
+
+    if ( rb_obj_is_kind_of( obj, rb_cTime ) ) {
+        ts     = rb_time_timespec( obj );
+        offset = NUM2LONG( rb_time_utc_offset( obj ) );
+        secs   = (LONG_LONG)ts.tv_sec + offset;
+        days   = ( secs >= 0 ? secs : secs - 86399 ) / 86400;
+        rem    = (int)( secs - ( days * 86400 ) );
+        am_civil_from_days( days, &year, &month, &day );
+        if ( year < 0 || year > 9999 ) {
+            return rb_obj_as_string( obj );
+        }
+        if ( RTEST( rb_funcall( obj, id_utc_p, 0 ) ) ) {
+            snprintf( buf, sizeof( buf ), "%04d-%02d-%02d %02d:%02d:%02d UTC",
+                      year, month, day, rem / 3600, ( rem % 3600 ) / 60, rem % 60 );
+        } else {
+            abs_offset = offset < 0 ? -offset : offset;
+            snprintf( buf, sizeof( buf ), "%04d-%02d-%02d %02d:%02d:%02d %c%02ld%02ld",
+                      year, month, day, rem / 3600, ( rem % 3600 ) / 60, rem % 60,
+                      ( offset < 0 ? '-' : '+' ), abs_offset / 3600, ( abs_offset % 3600 ) / 60 );
+        }
+        return rb_str_new2( buf );
+    }
+
+    /* if Date has not been loaded obj cannot be one */
+    if ( ( Qnil == cDate ) && rb_const_defined( rb_cObject, rb_intern( "Date" ) ) ) {
+        am_load_date( );
+    }
+
+    if ( ( Qnil != cDate ) && rb_obj_is_kind_of( obj, cDate ) ) {
+        year = NUM2INT( rb_funcall( obj, id_year, 0 ) );
+        if ( year < 0 || year > 9999 ) {
+            return rb_obj_as_string( obj );
+        }
+        month = NUM2INT( rb_funcall( obj, id_mon, 0 ) );
+        day   = NUM2INT( rb_funcall( obj, id_mday, 0 ) );
+
+        if ( rb_obj_is_kind_of( obj, cDateTime ) ) {
+            zone = rb_funcall( obj, id_zone, 0 );
+            snprintf( buf, sizeof( buf ), "%04d-%02d-%02dT%02d:%02d:%02d%s",
+                      year, month, day,
+                      NUM2INT( rb_funcall( obj, id_hour, 0 ) ),
+                      NUM2INT( rb_funcall( obj, id_min, 0 ) ),
+                      NUM2INT( rb_funcall( obj, id_sec, 0 ) ),
+                      StringValueCStr( zone ) );
+        } else {
+            snprintf( buf, sizeof( buf ), "%04d-%02d-%02d", year, month, day );
+        }
+        return rb_str_new2( buf );
+    }
+
+    return rb_obj_as_string( obj );
+}
+
+/*
+ * Convert the String value with the :date, :datetime or :time conversion plan
+ * entry id, using the strict parser and falling back to Date.parse,
+ * DateTime.parse or Time.parse.  Values that are not Strings are left as they
+ * are.  Returns 1 and sets result if id is one of those conversions, 0
+ * otherwise.
+ */
+int am_sqlite3_datetime_conversion( VALUE value, ID id, VALUE *result )
+{
+    if ( ( id != id_date ) && ( id != id_datetime ) && ( id != id_time ) ) {
+        return 0;
+    }
+
+    if ( !RB_TYPE_P( value, T_STRING ) ) {
+        *result = value;
+    } else if ( id == id_date ) {
+        *result = am_sqlite3_parse_date( Qnil, value );
+        if ( Qnil == *result ) {
+            am_load_date( );
+            *result = rb_funcall( cDate, id_parse, 1, value );
+        }
+    } else if ( id == id_datetime ) {
+        *result = am_sqlite3_parse_datetime( Qnil, value );
+        if ( Qnil == *result ) {
+            am_load_date( );
+            *result = rb_funcall( cDateTime, id_parse, 1, value );
+        }
+    } else if ( id == id_time ) {
+        *result = am_sqlite3_parse_time( Qnil, value );
+        if ( Qnil == *result ) {
+            rb_require( "time" );
+            *result = rb_funcall( rb_cTime, id_parse, 1, value );
+        }
+    }
+    return 1;
+}
+
+void Init_amalgalite_datetime( )
+{
+    VALUE ma  = rb_define_module("Amalgalite");
+    VALUE mas = rb_define_module_under(ma, "SQLite3");
+
+    rb_gc_register_address( &cDate );
+    rb_gc_register_address( &cDateTime );
+
+    id_civil = rb_intern( "civil" );
+    id_local = rb_intern( "local" );
+    id_utc   = rb_intern( "utc" );
+    id_new   = rb_intern( "new" );
+    id_year  = rb_intern( "year" );
+    id_mon   = rb_intern( "mon" );
+    id_mday  = rb_intern( "mday" );
+    id_hour  = rb_intern( "hour" );
+    id_min   = rb_intern( "min" );
+    id_sec   = rb_intern( "sec" );
+    id_zone  = rb_intern( "zone" );
+    id_utc_p = rb_intern( "utc?" );
+    id_parse = rb_intern( "parse" );
+    id_date  = rb_intern( "date" );
+    id_datetime = rb_intern( "datetime" );
+    id_time  = rb_intern( "time" );
+
+    rb_define_module_function(mas, "parse_date", am_sqlite3_parse_date, 1);
+    rb_define_module_function(mas, "parse_datetime", am_sqlite3_parse_datetime, 1);
+    rb_define_module_function(mas, "parse_time", am_sqlite3_parse_time, 1);
+    rb_define_module_function(mas, "format_time", am_sqlite3_format_time, 1);
+}
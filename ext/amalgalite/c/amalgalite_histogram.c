@@ -0,0 +1,291 @@
+#include "amalgalite.h"
+#include <math.h>
+/**
+ * Copyright (c) 2008 Jeremy Hinegardner
+ * All rights reserved.  See LICENSE and/or COPYING for details.
+ *
+ * vim: shiftwidth=4
+ */
+
+/* class Amalgalite::Histogram */
+VALUE cA_Histogram;
+
+/* the first value counted in the last bucket */
+#define AM_HISTOGRAM_LIMIT ( ((sqlite3_uint64)1) << AM_HISTOGRAM_MAX_BITS )
+
+/* the number of sub buckets in each power of 2 above the first */
+#define AM_HISTOGRAM_HALF ( 1 << ( AM_HISTOGRAM_SUB_BUCKET_BITS - 1 ) )
+
+/* the position of the highest set bit of a non zero value */
+static int am_histogram_msb( sqlite3_uint64 v )
+{
+#if defined(__GNUC__)
+    return 63 - __builtin_clzll( v );
+#else
+    int bit = 0;
+    while ( v >>= 1 ) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/*
+ * the bucket of a value.  Values below 2^AM_HISTOGRAM_SUB_BUCKET_BITS have a
+ * bucket each, above that each power of 2 is split in AM_HISTOGRAM_HALF
+ * buckets.
+ */
+static int am_histogram_index( sqlite3_uint64 v )
+{
+    int shift;
+
+    if ( v >= AM_HISTOGRAM_LIMIT ) {
+        v = AM_HISTOGRAM_LIMIT - 1;
+    }
+    if ( v < ( 1 << AM_HISTOGRAM_SUB_BUCKET_BITS ) ) {
+        return (int)v;
+    }
+    shift = am_histogram_msb( v ) - ( AM_HISTOGRAM_SUB_BUCKET_BITS - 1 );
+    return ( ( shift + 1 ) * AM_HISTOGRAM_HALF ) + (int)( v >> shift ) - AM_HISTOGRAM_HALF;
+}
+
+/* the largest value counted in a bucket */
+static sqlite3_uint64 am_histogram_highest_value( int index )
+{
+    int shift;
+
+    if ( index < ( 1 << AM_HISTOGRAM_SUB_BUCKET_BITS ) ) {
+        return (sqlite3_uint64)index;
+    }
+    shift = ( index / AM_HISTOGRAM_HALF ) - 1;
+    return ( ( (sqlite3_uint64)( index - shift * AM_HISTOGRAM_HALF ) + 1 ) << shift ) - 1;
+}
+
+static am_histogram* am_histogram_struct( VALUE self )
+{
+    am_histogram *histogram;
+
+    Data_Get_Struct(self, am_histogram, histogram);
+    return histogram;
+}
+
+/**
+ * call-seq:
+ *    histogram.record( value ) -> histogram
+ *
+ * Count a sample.  Negative values are counted as 0, NaN and infinite values
+ * raise an ArgumentError.  The cost is the same however many samples have
+ * been recorded.
+ */
+VALUE am_histogram_record( VALUE self, VALUE value )
+{
+    am_histogram   *histogram = am_histogram_struct( self );
+    sqlite3_uint64  v;
+    double          d;
+
+    if ( FIXNUM_P( value ) ) {
+        v = ( FIX2LONG( value ) < 0 ) ? 0 : (sqlite3_uint64)FIX2LONG( value );
+    } else {
+        d = NUM2DBL( value );
+        if ( !isfinite( d ) ) {
+            rb_raise( rb_eArgError, "cannot record %f in a histogram", d );
+        }
+        v = ( d <= 0.0 ) ? 0 : ( d >= 18446744073709551615.0 ) ? (sqlite3_uint64)-1 : (sqlite3_uint64)llround( d );
+    }
+
+    if ( ( 0 == histogram->total ) || ( v < histogram->min ) ) {
+        histogram->min = v;
+    }
+    if ( v > histogram->max ) {
+        histogram->max = v;
+    }
+    histogram->counts[ am_histogram_index( v ) ]++;
+    histogram->total++;
+    return self;
+}
+
+/**
+ * call-seq:
+ *    histogram.count -> Integer
+ *
+ * The number of samples recorded
+ */
+VALUE am_histogram_count( VALUE self )
+{
+    return SQLUINT64_2NUM( am_histogram_struct( self )->total );
+}
+
+/**
+ * call-seq:
+ *    histogram.min -> Integer
+ *
+ * The smallest sample recorded, exactly, or 0 if there are none
+ */
+VALUE am_histogram_min( VALUE self )
+{
+    return SQLUINT64_2NUM( am_histogram_struct( self )->min );
+}
+
+/**
+ * call-seq:
+ *    histogram.max -> Integer
+ *
+ * The largest sample recorded, exactly, or 0 if there are none
+ */
+VALUE am_histogram_max( VALUE self )
+{
+    return SQLUINT64_2NUM( am_histogram_struct( self )->max );
+}
+
+/**
+ * call-seq:
+ *    histogram.percentile( 99.9 ) -> Integer
+ *
+ * The value that +percent+ percent of the samples are at or below.  This is
+ * the largest value of the bucket the percentile falls in, so it is within
+ * 1 part in 64 of the real value.  Returns 0 if there are no samples.
+ */
+VALUE am_histogram_percentile( VALUE self, VALUE percent )
+{
+    am_histogram   *histogram = am_histogram_struct( self );
+    double          p         = NUM2DBL( percent );
+    sqlite3_uint64  target;
+    sqlite3_uint64  seen      = 0;
+    sqlite3_uint64  v;
+    int             i;
+
+    if ( 0 == histogram->total ) {
+        return INT2FIX( 0 );
+    }
+    if ( !( p >= 0.0 && p <= 100.0 ) ) {
+        rb_raise( rb_eArgError, "percentile must be between 0 and 100, not %f", p );
+    }
+
+    target = (sqlite3_uint64)ceil( ( p / 100.0 ) * (double)histogram->total );
+    if ( target < 1 ) {
+        target = 1;
+    } else if ( target > histogram->total ) {
+        target = histogram->total;
+    }
+
+    for ( i = 0 ; i < AM_HISTOGRAM_BUCKETS ; i++ ) {
+        seen += histogram->counts[i];
+        if ( seen >= target ) {
+            break;
+        }
+    }
+
+    v = am_histogram_highest_value( i );
+    if ( v > histogram->max ) {
+        v = histogram->max;
+    }
+    if ( v < histogram->min ) {
+        v = histogram->min;
+    }
+    return SQLUINT64_2NUM( v );
+}
+
+/**
+ * call-seq:
+ *    histogram.merge!( other ) -> histogram
+ *
+ * Add all the samples of +other+ to this histogram
+ */
+VALUE am_histogram_merge_bang( VALUE self, VALUE other )
+{
+    am_histogram *histogram = am_histogram_struct( self );
+    am_histogram *from;
+    int           i;
+
+    if ( !rb_obj_is_kind_of( other, cA_Histogram ) ) {
+        rb_raise( rb_eTypeError, "a Histogram can only be merged with another Histogram" );
+    }
+    from = am_histogram_struct( other );
+    if ( 0 == from->total ) {
+        return self;
+    }
+
+    for ( i = 0 ; i < AM_HISTOGRAM_BUCKETS ; i++ ) {
+        histogram->counts[i] += from->counts[i];
+    }
+    if ( ( 0 == histogram->total ) || ( from->min < histogram->min ) ) {
+        histogram->min = from->min;
+    }
+    if ( from->max > histogram->max ) {
+        histogram->max = from->max;
+    }
+    histogram->total += from->total;
+    return self;
+}
+
+/**
+ * call-seq:
+ *    histogram.reset! -> histogram
+ *
+ * Forget all the samples
+ */
+VALUE am_histogram_reset_bang( VALUE self )
+{
+    memset( am_histogram_struct( self ), 0, sizeof( am_histogram ) );
+    return self;
+}
+
+/*
+ * dup and clone copy the counts, so a copy is a snapshot of the histogram
+ */
+VALUE am_histogram_initialize_copy( VALUE self, VALUE orig )
+{
+    if ( self != orig ) {
+        memcpy( am_histogram_struct( self ), am_histogram_struct( orig ), sizeof( am_histogram ) );
+    }
+    return self;
+}
+
+/***********************************************************************
+ * Ruby life cycle methods
+ ***********************************************************************/
+
+void am_histogram_free( am_histogram *histogram )
+{
+    free( histogram );
+    return;
+}
+
+/*
+ * allocate an empty histogram
+ */
+VALUE am_histogram_alloc( VALUE klass )
+{
+    am_histogram *histogram = ALLOC( am_histogram );
+    VALUE         obj;
+
+    memset( histogram, 0, sizeof( am_histogram ) );
+    obj = Data_Wrap_Struct(klass, NULL, am_histogram_free, histogram);
+    return obj;
+}
+
+/**
+ * Document-class: Amalgalite::Histogram
+ *
+ * A fixed size log-linear histogram, in the style of HdrHistogram, of non
+ * negative integer samples such as the nanosecond times of profile events.
+ * Recording a sample takes the same time however many have been recorded,
+ * and percentiles are accurate to within 1 part in 64.  Histograms can be
+ * merged, and a dup of one is a snapshot.
+ */
+void Init_amalgalite_histogram( )
+{
+    VALUE ma = rb_define_module("Amalgalite");
+
+    cA_Histogram = rb_define_class_under( ma, "Histogram", rb_cObject );
+    rb_define_alloc_func(cA_Histogram, am_histogram_alloc);
+    rb_define_method(cA_Histogram, "initialize_copy", am_histogram_initialize_copy, 1); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "record", am_histogram_record, 1); /* in amalgalite_histogram.c */
+    rb_define_alias(cA_Histogram, "<<", "record");
+    rb_define_method(cA_Histogram, "count", am_histogram_count, 0); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "min", am_histogram_min, 0); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "max", am_histogram_max, 0); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "percentile", am_histogram_percentile, 1); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "merge!", am_histogram_merge_bang, 1); /* in amalgalite_histogram.c */
+    rb_define_method(cA_Histogram, "reset!", am_histogram_reset_bang, 0); /* in amalgalite_histogram.c */
+}
@@ -0,0 +1,479 @@
+#include "amalgalite.h"
+#ifdef HAVE_PTHREAD_H
+#include <pthread.h>
+#endif
+/**
+ * Copyright (c) 2008 Jeremy Hinegardner
+ * All rights reserved.  See LICENSE and/or COPYING for details.
+ *
+ * vim: shiftwidth=4
+ */
+
+/* the number of database connections open, SQLite may only be reconfigured
+ * when there are none */
+int am_sqlite3_open_connections = 0;
+
+/*----------------------------------------------------------------------
+ * The size class pool allocator
+ *---------------------------------------------------------------------*/
+
+/* allocations larger than this go straight to the system allocator */
+#define AM_MEMORY_POOL_MAX 65536
+
+/* the size classes are 16 byte steps up to 128, then 4 per power of 2 */
+#define AM_MEMORY_CLASSES 44
+
+/* the most bytes of one size class a thread keeps for reuse */
+#define AM_MEMORY_CACHE_BYTES ( 128 * 1024 )
+
+/* each block is preceded by its size, padded to keep the block 16 byte
+ * aligned */
+#define AM_MEMORY_HEADER 16
+
+#if defined(HAVE_PTHREAD_H) && defined(__GNUC__)
+#define AM_MEMORY_THREAD_CACHE 1
+#endif
+
+static sqlite3_int64 am_memory_class_size[AM_MEMORY_CLASSES];
+
+#ifdef AM_MEMORY_THREAD_CACHE
+/* a free block waiting in a thread cache */
+typedef struct am_memory_block {
+    struct am_memory_block *next;
+} am_memory_block;
+
+/* the free blocks of each size class kept by one thread */
+typedef struct am_memory_cache {
+    am_memory_block *blocks[AM_MEMORY_CLASSES];
+    int              count[AM_MEMORY_CLASSES];
+} am_memory_cache;
+
+static __thread am_memory_cache *am_memory_thread_cache = NULL;
+static pthread_key_t             am_memory_cache_key;
+static pthread_once_t            am_memory_cache_once = PTHREAD_ONCE_INIT;
+
+/* give the blocks of a thread that exits back to the system */
+static void am_memory_cache_release( void *data )
+{
+    am_memory_cache *cache = (am_memory_cache*)data;
+    am_memory_block *block;
+    int              i;
+
+    am_memory_thread_cache = NULL;
+    for ( i = 0 ; i < AM_MEMORY_CLASSES ; i++ ) {
+        while ( NULL != ( block = cache->blocks[i] ) ) {
+            cache->blocks[i] = block->next;
+            free( ((char*)block) - AM_MEMORY_HEADER );
+        }
+    }
+    free( cache );
+}
+
+static void am_memory_cache_create_key( void )
+{
+    pthread_key_create( &am_memory_cache_key, am_memory_cache_release );
+}
+
+/* the cache of the calling thread, NULL if it cannot have one */
+static am_memory_cache* am_memory_cache_get( void )
+{
+    am_memory_cache *cache = am_memory_thread_cache;
+
+    if ( NULL == cache ) {
+        cache = (am_memory_cache*)calloc( 1, sizeof( am_memory_cache ) );
+        if ( NULL != cache ) {
+            if ( 0 != pthread_setspecific( am_memory_cache_key, cache ) ) {
+                free( cache );
+                return NULL;
+            }
+            am_memory_thread_cache = cache;
+        }
+    }
+    return cache;
+}
+#endif
+
+/* the position of the highest set bit of a non zero value */
+static int am_memory_msb( unsigned int v )
+{
+#if defined(__GNUC__)
+    return 31 - __builtin_clz( v );
+#else
+    int bit = 0;
+    while ( v >>= 1 ) {
+        bit++;
+    }
+    return bit;
+#endif
+}
+
+/* the size class of an allocation of n bytes, or -1 if it is too large */
+static int am_memory_class( int n )
+{
+    int shift;
+
+    if ( n <= 128 ) {
+        return ( n <= 16 ) ? 0 : ( n - 1 ) >> 4;
+    }
+    if ( n > AM_MEMORY_POOL_MAX ) {
+        return -1;
+    }
+    /* the power of 2 above 128 that n falls in, and the quarter of it */
+    shift = am_memory_msb( (unsigned int)( n - 1 ) ) - 2;
+    return 8 + ( ( shift - 5 ) << 2 ) + (int)( ( ( n - 1 ) >> shift ) & 3 );
+}
+
+static void* am_memory_pool_malloc( int n )
+{
+    int               size_class = am_memory_class( n );
+    sqlite3_int64     size       = ( size_class < 0 ) ? (sqlite3_int64)n : am_memory_class_size[size_class];
+    char             *p;
+#ifdef AM_MEMORY_THREAD_CACHE
+    am_memory_cache  *cache;
+    am_memory_block  *block;
+
+    if ( size_class >= 0 && NULL != ( cache = am_memory_cache_get() ) && NULL != ( block = cache->blocks[size_class] ) ) {
+        cache->blocks[size_class] = block->next;
+        cache->count[size_class]--;
+        return (void*)block;
+    }
+#endif
+    p = (char*)malloc( (size_t)( size + AM_MEMORY_HEADER ) );
+    if ( NULL == p ) {
+        return NULL;
+    }
+    *(sqlite3_int64*)p = size;
+    return (void*)( p + AM_MEMORY_HEADER );
+}
+
+static int am_memory_pool_size( void *p )
+{
+    return ( NULL == p ) ? 0 : (int)*(sqlite3_int64*)( ((char*)p) - AM_MEMORY_HEADER );
+}
+
+static void am_memory_pool_free( void *p )
+{
+    int               size = am_memory_pool_size( p );
+#ifdef AM_MEMORY_THREAD_CACHE
+    int               size_class;
+    am_memory_cache  *cache;
+    am_memory_block  *block;
+
+    if ( size <= AM_MEMORY_POOL_MAX && NULL != ( cache = am_memory_cache_get() ) ) {
+        size_class = am_memory_class( size );
+        if ( cache->count[size_class] * am_memory_class_size[size_class] < AM_MEMORY_CACHE_BYTES ) {
+            block = (am_memory_block*)p;
+            block->next = cache->blocks[size_class];
+            cache->blocks[size_class] = block;
+            cache->count[size_class]++;
+            return;
+        }
+    }
+#endif
+    free( ((char*)p) - AM_MEMORY_HEADER );
+}
+
+static void* am_memory_pool_realloc( void *p, int n )
+{
+    int   size = am_memory_pool_size( p );
+    char *q;
+
+    /* the block already has room, and is not more than twice the size */
+    if ( n <= size && ( size <= 16 || n > size / 2 ) ) {
+        return p;
+    }
+    /* neither size is pooled, so the system may be able to resize in place */
+    if ( size > AM_MEMORY_POOL_MAX && n > AM_MEMORY_POOL_MAX ) {
+        q = (char*)realloc( ((char*)p) - AM_MEMORY_HEADER, (size_t)n + AM_MEMORY_HEADER );
+        if ( NULL == q ) {
+            return NULL;
+        }
+        *(sqlite3_int64*)q = n;
+        return (void*)( q + AM_MEMORY_HEADER );
+    }
+    q = am_memory_pool_malloc( n );
+    if ( NULL != q ) {
+        memcpy( q, p, (size_t)( ( n < size ) ? n : size ) );
+        am_memory_pool_free( p );
+    }
+    return q;
+}
+
+static int am_memory_pool_roundup( int n )
+{
+    int size_class = am_memory_class( n );
+
+    return ( size_class < 0 ) ? ( ( n + 7 ) & ~7 ) : (int)am_memory_class_size[size_class];
+}
+
+static int am_memory_pool_init( void *data )
+{
+#ifdef AM_MEMORY_THREAD_CACHE
+    pthread_once( &am_memory_cache_once, am_memory_cache_create_key );
+#endif
+    return SQLITE_OK;
+}
+
+static void am_memory_pool_shutdown( void *data )
+{
+    return;
+}
+
+static const sqlite3_mem_methods am_memory_pool_methods = {
+    am_memory_pool_malloc,
+    am_memory_pool_free,
+    am_memory_pool_realloc,
+    am_memory_pool_size,
+    am_memory_pool_roundup,
+    am_memory_pool_init,
+    am_memory_pool_shutdown,
+    NULL
+};
+
+/*----------------------------------------------------------------------
+ * Accounting of the SQLite heap to the ruby GC
+ *---------------------------------------------------------------------*/
+
+/* the allocator the accounting is wrapped around */
+static sqlite3_mem_methods am_memory_base;
+
+/* the default SQLite allocator, saved before it is first replaced */
+static sqlite3_mem_methods am_memory_system;
+static int                 am_memory_have_system = 0;
+
+/* what is installed, see SQLite3.memory_configuration */
+static int am_memory_pool       = 0;
+static int am_memory_accounting = 0;
+static int am_memory_lookaside_size  = -1;
+static int am_memory_lookaside_count = -1;
+
+/* bytes allocated or freed that the GC has not been told of yet, and the
+ * bytes it has been told of */
+static sqlite3_int64 am_memory_unreported = 0;
+static sqlite3_int64 am_memory_reported   = 0;
+
+/* the GC is told once this many bytes are waiting */
+#define AM_MEMORY_REPORT_BYTES ( 64 * 1024 )
+
+#if defined(__GNUC__)
+#define AM_ATOMIC_ADD( ptr, v )    __atomic_add_fetch( (ptr), (v), __ATOMIC_RELAXED )
+#define AM_ATOMIC_EXCHANGE( ptr )  __atomic_exchange_n( (ptr), 0, __ATOMIC_RELAXED )
+#elif defined(_MSC_VER)
+#define AM_ATOMIC_ADD( ptr, v )    ( InterlockedExchangeAdd64( (ptr), (v) ) + (v) )
+#define AM_ATOMIC_EXCHANGE( ptr )  InterlockedExchange64( (ptr), 0 )
+#endif
+
+/*
+ * Tell the GC of the bytes SQLite allocated or freed since it was last told.
+ * This must be called holding the GVL.
+ */
+void am_memory_report_to_gc( void )
+{
+    sqlite3_int64 delta;
+
+    if ( !am_memory_accounting ) {
+        return;
+    }
+    delta = AM_ATOMIC_EXCHANGE( &am_memory_unreported );
+    if ( 0 != delta ) {
+        am_memory_reported += delta;
+        rb_gc_adjust_memory_usage( (ssize_t)delta );
+    }
+}
+
+/* count the bytes, and tell the GC of them if enough are waiting and it can be told */
+static void am_memory_account( sqlite3_int64 bytes )
+{
+    sqlite3_int64 unreported = AM_ATOMIC_ADD( &am_memory_unreported, bytes );
+
+    if ( ( unreported > AM_MEMORY_REPORT_BYTES || unreported < -AM_MEMORY_REPORT_BYTES ) && amalgalite_has_gvl() ) {
+        am_memory_report_to_gc();
+    }
+}
+
+static void* am_memory_accounted_malloc( int n )
+{
+    void *p = am_memory_base.xMalloc( n );
+
+    if ( NULL != p ) {
+        am_memory_account( am_memory_base.xSize( p ) );
+    }
+    return p;
+}
+
+static void am_memory_accounted_free( void *p )
+{
+    am_memory_account( -am_memory_base.xSize( p ) );
+    am_memory_base.xFree( p );
+}
+
+static void* am_memory_accounted_realloc( void *p, int n )
+{
+    int   before = am_memory_base.xSize( p );
+    void *q      = am_memory_base.xRealloc( p, n );
+
+    if ( NULL != q ) {
+        am_memory_account( am_memory_base.xSize( q ) - before );
+    }
+    return q;
+}
+
+static int am_memory_accounted_size( void *p )
+{
+    return am_memory_base.xSize( p );
+}
+
+static int am_memory_accounted_roundup( int n )
+{
+    return am_memory_base.xRoundup( n );
+}
+
+static int am_memory_accounted_init( void *data )
+{
+    return am_memory_base.xInit( am_memory_base.pAppData );
+}
+
+static void am_memory_accounted_shutdown( void *data )
+{
+    am_memory_base.xShutdown( am_memory_base.pAppData );
+}
+
+static const sqlite3_mem_methods am_memory_accounted_methods = {
+    am_memory_accounted_malloc,
+    am_memory_accounted_free,
+    am_memory_accounted_realloc,
+    am_memory_accounted_size,
+    am_memory_accounted_roundup,
+    am_memory_accounted_init,
+    am_memory_accounted_shutdown,
+    NULL
+};
+
+/*----------------------------------------------------------------------
+ * Amalgalite::SQLite3 methods
+ *---------------------------------------------------------------------*/
+
+/*
+ * Shut SQLite down so that it can be configured.  Raises an error if any
+ * database connection is open, SQLite may only be shut down without them.
+ */
+void am_sqlite3_shutdown_for_configuration( const char *what )
+{
+    int rc;
+
+    if ( am_sqlite3_open_connections > 0 ) {
+        rb_raise(eAS_Error, "Failure to configure %s : %d database connections are open\n", what, am_sqlite3_open_connections);
+    }
+    rc = sqlite3_shutdown();
+    if ( SQLITE_OK != rc ) {
+        rb_raise(eAS_Error, "Failure to shutdown the sqlite3 library : [SQLITE_ERROR %d]\n", rc);
+    }
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.configure_memory!( pool, gc_accounting, lookaside_size, lookaside_count ) -> nil
+ *
+ * Shut SQLite down, install its allocator and start it again.  If pool is
+ * true the size class pool allocator is used, otherwise the system one.  If
+ * gc_accounting is true the memory SQLite holds is reported to the ruby GC.
+ * If lookaside_size and lookaside_count are not nil they are the default
+ * lookaside of new connections.
+ *
+ * This may only be done while no database connections are open.  Use
+ * Amalgalite::SQLite3.configure_memory.
+ */
+VALUE am_sqlite3_configure_memory_bang( VALUE self, VALUE pool, VALUE gc_accounting, VALUE lookaside_size, VALUE lookaside_count )
+{
+    int rc;
+
+#if !defined(__GNUC__) && !defined(_MSC_VER)
+    if ( RTEST( gc_accounting ) ) {
+        rb_raise(rb_eNotImpError, "accounting SQLite memory to the GC is not supported on this platform");
+    }
+#endif
+    am_sqlite3_shutdown_for_configuration( "memory" );
+
+    /* SQLite has freed everything, so the GC should no longer count any of it */
+    am_memory_report_to_gc();
+    if ( 0 != am_memory_reported ) {
+        rb_gc_adjust_memory_usage( (ssize_t)-am_memory_reported );
+        am_memory_reported = 0;
+    }
+
+    if ( !am_memory_have_system ) {
+        rc = sqlite3_config( SQLITE_CONFIG_GETMALLOC, &am_memory_system );
+        if ( SQLITE_OK != rc ) {
+            sqlite3_initialize();
+            rb_raise(eAS_Error, "Failure to read the sqlite3 allocator : [SQLITE_ERROR %d]\n", rc);
+        }
+        am_memory_have_system = 1;
+    }
+
+    if ( RTEST( pool ) ) {
+        memcpy( &am_memory_base, &am_memory_pool_methods, sizeof( sqlite3_mem_methods ) );
+    } else {
+        memcpy( &am_memory_base, &am_memory_system, sizeof( sqlite3_mem_methods ) );
+    }
+    rc = sqlite3_config( SQLITE_CONFIG_MALLOC, RTEST( gc_accounting ) ? &am_memory_accounted_methods : &am_memory_base );
+
+    if ( SQLITE_OK == rc && Qnil != lookaside_size && Qnil != lookaside_count ) {
+        rc = sqlite3_config( SQLITE_CONFIG_LOOKASIDE, NUM2INT( lookaside_size ), NUM2INT( lookaside_count ) );
+        if ( SQLITE_OK == rc ) {
+            am_memory_lookaside_size  = NUM2INT( lookaside_size );
+            am_memory_lookaside_count = NUM2INT( lookaside_count );
+        }
+    }
+
+    if ( SQLITE_OK == rc ) {
+        am_memory_pool       = RTEST( pool );
+        am_memory_accounting = RTEST( gc_accounting );
+        am_memory_unreported = 0;
+        rc = sqlite3_initialize();
+    } else {
+        sqlite3_config( SQLITE_CONFIG_MALLOC, &am_memory_system );
+        am_memory_pool       = 0;
+        am_memory_accounting = 0;
+        sqlite3_initialize();
+    }
+    if ( SQLITE_OK != rc ) {
+        rb_raise(eAS_Error, "Failure to configure the sqlite3 memory : [SQLITE_ERROR %d]\n", rc);
+    }
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.memory_configuration -> Hash
+ *
+ * The memory configuration of SQLite as a Hash with the keys :allocator,
+ * :system or :pool, :gc_accounting, true or false, :gc_bytes, the bytes
+ * reported to the GC, and :lookaside, the default [ slot_size, slot_count ]
+ * of new connections or nil if it has not been configured.
+ */
+VALUE am_sqlite3_memory_configuration( VALUE self )
+{
+    VALUE config = rb_hash_new();
+
+    am_memory_report_to_gc();
+    rb_hash_aset( config, ID2SYM( rb_intern( "allocator" ) ), ID2SYM( rb_intern( am_memory_pool ? "pool" : "system" ) ) );
+    rb_hash_aset( config, ID2SYM( rb_intern( "gc_accounting" ) ), am_memory_accounting ? Qtrue : Qfalse );
+    rb_hash_aset( config, ID2SYM( rb_intern( "gc_bytes" ) ), SQLINT64_2NUM( am_memory_reported ) );
+    rb_hash_aset( config, ID2SYM( rb_intern( "lookaside" ) ),
+                  ( am_memory_lookaside_size < 0 ) ? Qnil : rb_assoc_new( INT2NUM( am_memory_lookaside_size ), INT2NUM( am_memory_lookaside_count ) ) );
+    return config;
+}
+
+void Init_amalgalite_memory( )
+{
+    VALUE ma  = rb_define_module("Amalgalite");
+    VALUE mas = rb_define_module_under(ma, "SQLite3");
+    int   i;
+
+    for ( i = 0 ; i < AM_MEMORY_CLASSES ; i++ ) {
+        am_memory_class_size[i] = ( i < 8 ) ? ( ( i + 1 ) << 4 ) : ( (sqlite3_int64)( 4 + ( ( i - 8 ) & 3 ) + 1 ) << ( 5 + ( ( i - 8 ) >> 2 ) ) );
+    }
+
+    rb_define_module_function(mas, "configure_memory!", am_sqlite3_configure_memory_bang, 4); /* in amalgalite_memory.c */
+    rb_define_module_function(mas, "memory_configuration", am_sqlite3_memory_configuration, 0); /* in amalgalite_memory.c */
+}
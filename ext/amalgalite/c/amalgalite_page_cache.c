@@ -0,0 +1,654 @@
+#include "amalgalite.h"
+#ifdef HAVE_SYS_MMAN_H
+#include <sys/mman.h>
+#endif
+/**
+ * Copyright (c) 2008 Jeremy Hinegardner
+ * All rights reserved.  See LICENSE and/or COPYING for details.
+ *
+ * vim: shiftwidth=4
+ */
+
+/*
+ * A page cache, SQLITE_CONFIG_PCACHE2, shared by all the connections of the
+ * process.  Each cache SQLite creates keeps its own pages, but the unpinned
+ * pages of all of them are on one LRU list, and the pages of all of them
+ * together are kept within one budget.  When a cache needs a page and the
+ * budget is spent the least recently used unpinned page of any cache is
+ * evicted, and its memory reused if it is the right size.
+ */
+
+#define AM_ROUND8( x ) ( ( (x) + 7 ) & ~7 )
+
+/* the most extra bytes SQLite asks for with each page */
+#define AM_PAGE_CACHE_MAX_EXTRA 256
+
+/* a page, its content and extra bytes follow it in the same allocation */
+typedef struct am_page {
+    sqlite3_pcache_page  base;
+    unsigned int         key;
+    int                  pinned;
+    int                  in_region;
+    sqlite3_int64        size;      /* bytes of the allocation */
+    struct am_page_cache *cache;
+    struct am_page      *next_hash;
+    struct am_page      *lru_prev;  /* on the LRU list while unpinned */
+    struct am_page      *lru_next;
+} am_page;
+
+/* a cache created by SQLite, normally one for each database file of each
+ * connection */
+typedef struct am_page_cache {
+    int            size_page;
+    int            size_extra;
+    int            purgeable;
+    sqlite3_int64  page_bytes;  /* the allocation size of each page */
+    unsigned int   page_count;
+    unsigned int   hash_size;
+    am_page      **hash;
+} am_page_cache;
+
+/* the state shared by every cache */
+static struct {
+    sqlite3_mutex  *mutex;
+    am_page         lru;          /* sentinel, lru.lru_next is the most recent */
+    sqlite3_int64   budget;
+    sqlite3_int64   used;         /* bytes of the pages of purgeable caches */
+    sqlite3_int64   pages;
+
+    char           *region;       /* preallocated page slots, or NULL */
+    size_t          region_size;
+    sqlite3_int64   slot_size;
+    void           *free_slots;
+    int             huge_pages;
+
+    sqlite3_int64   hits;
+    sqlite3_int64   misses;
+    sqlite3_int64   evictions;
+    sqlite3_int64   overflows;    /* pages allocated past the budget */
+} am_page_cache_global;
+
+/* the page cache SQLite comes with, saved before it is first replaced */
+static sqlite3_pcache_methods2 am_page_cache_default;
+static int                     am_page_cache_have_default = 0;
+static int                     am_page_cache_installed    = 0;
+
+/*----------------------------------------------------------------------
+ * page memory
+ *---------------------------------------------------------------------*/
+
+static am_page* am_page_alloc( sqlite3_int64 size )
+{
+    am_page *page = NULL;
+    int      in_region = 0;
+
+    if ( NULL != am_page_cache_global.free_slots && size <= am_page_cache_global.slot_size ) {
+        page = (am_page*)am_page_cache_global.free_slots;
+        am_page_cache_global.free_slots = *(void**)page;
+        in_region = 1;
+    } else {
+        page = (am_page*)sqlite3_malloc64( (sqlite3_uint64)size );
+    }
+    if ( NULL != page ) {
+        page->in_region = in_region;
+    }
+    return page;
+}
+
+static void am_page_release( am_page *page )
+{
+    if ( page->in_region ) {
+        *(void**)page = am_page_cache_global.free_slots;
+        am_page_cache_global.free_slots = (void*)page;
+    } else {
+        sqlite3_free( page );
+    }
+}
+
+/*----------------------------------------------------------------------
+ * the LRU list and the hash table of a cache, the global mutex is held
+ *---------------------------------------------------------------------*/
+
+static void am_page_lru_remove( am_page *page )
+{
+    page->lru_prev->lru_next = page->lru_next;
+    page->lru_next->lru_prev = page->lru_prev;
+    page->lru_prev = page->lru_next = NULL;
+}
+
+static void am_page_lru_push( am_page *page )
+{
+    am_page *head = &am_page_cache_global.lru;
+
+    page->lru_next = head->lru_next;
+    page->lru_prev = head;
+    head->lru_next->lru_prev = page;
+    head->lru_next = page;
+}
+
+static void am_page_hash_remove( am_page_cache *cache, am_page *page )
+{
+    am_page **pp = &cache->hash[ page->key % cache->hash_size ];
+
+    while ( *pp != page ) {
+        pp = &(*pp)->next_hash;
+    }
+    *pp = page->next_hash;
+    cache->page_count--;
+}
+
+static void am_page_hash_grow( am_page_cache *cache )
+{
+    unsigned int  size = ( cache->hash_size < 256 ) ? 256 : cache->hash_size * 2;
+    am_page     **hash = (am_page**)sqlite3_malloc64( sizeof( am_page* ) * size );
+    am_page      *page;
+    unsigned int  i;
+
+    /* a cache with a full hash table is slower, not broken */
+    if ( NULL == hash ) {
+        return;
+    }
+    memset( hash, 0, sizeof( am_page* ) * size );
+    for ( i = 0 ; i < cache->hash_size ; i++ ) {
+        while ( NULL != ( page = cache->hash[i] ) ) {
+            cache->hash[i]  = page->next_hash;
+            page->next_hash = hash[ page->key % size ];
+            hash[ page->key % size ] = page;
+        }
+    }
+    sqlite3_free( cache->hash );
+    cache->hash      = hash;
+    cache->hash_size = size;
+}
+
+/* take a page out of its cache and give back its memory */
+static void am_page_discard( am_page *page )
+{
+    am_page_cache *cache = page->cache;
+
+    if ( NULL != page->lru_next ) {
+        am_page_lru_remove( page );
+    }
+    am_page_hash_remove( cache, page );
+    if ( cache->purgeable ) {
+        am_page_cache_global.used -= page->size;
+    }
+    am_page_cache_global.pages--;
+    am_page_release( page );
+}
+
+/*
+ * Evict the least recently used unpinned pages until size more bytes fit in
+ * the budget.  An evicted page of exactly size bytes is not released but
+ * returned to be reused.
+ */
+static am_page* am_page_cache_make_room( sqlite3_int64 size )
+{
+    am_page *victim;
+
+    while ( am_page_cache_global.used + size > am_page_cache_global.budget ) {
+        victim = am_page_cache_global.lru.lru_prev;
+        if ( victim == &am_page_cache_global.lru ) {
+            return NULL;
+        }
+        am_page_cache_global.evictions++;
+        if ( victim->size == size ) {
+            am_page_lru_remove( victim );
+            am_page_hash_remove( victim->cache, victim );
+            am_page_cache_global.used -= victim->size;
+            am_page_cache_global.pages--;
+            return victim;
+        }
+        am_page_discard( victim );
+    }
+    return NULL;
+}
+
+/*----------------------------------------------------------------------
+ * sqlite3_pcache_methods2
+ *---------------------------------------------------------------------*/
+
+static int am_page_cache_init( void *data )
+{
+    am_page_cache_global.mutex = sqlite3_mutex_alloc( SQLITE_MUTEX_FAST );
+    if ( NULL == am_page_cache_global.mutex && sqlite3_threadsafe() ) {
+        return SQLITE_NOMEM;
+    }
+    am_page_cache_global.lru.lru_next = &am_page_cache_global.lru;
+    am_page_cache_global.lru.lru_prev = &am_page_cache_global.lru;
+    am_page_cache_global.used  = 0;
+    am_page_cache_global.pages = 0;
+    return SQLITE_OK;
+}
+
+static void am_page_cache_shutdown( void *data )
+{
+    sqlite3_mutex_free( am_page_cache_global.mutex );
+    am_page_cache_global.mutex = NULL;
+}
+
+static sqlite3_pcache* am_page_cache_create( int size_page, int size_extra, int purgeable )
+{
+    am_page_cache *cache = (am_page_cache*)sqlite3_malloc64( sizeof( am_page_cache ) );
+
+    if ( NULL == cache ) {
+        return NULL;
+    }
+    memset( cache, 0, sizeof( am_page_cache ) );
+    cache->size_page  = size_page;
+    cache->size_extra = size_extra;
+    cache->purgeable  = purgeable;
+    cache->page_bytes = AM_ROUND8( sizeof( am_page ) ) + AM_ROUND8( size_page ) + AM_ROUND8( size_extra );
+    return (sqlite3_pcache*)cache;
+}
+
+/* PRAGMA cache_size is advisory, the budget limits all the caches instead */
+static void am_page_cache_cachesize( sqlite3_pcache *pcache, int max_pages )
+{
+    return;
+}
+
+static int am_page_cache_pagecount( sqlite3_pcache *pcache )
+{
+    am_page_cache *cache = (am_page_cache*)pcache;
+    int            count;
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    count = (int)cache->page_count;
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+    return count;
+}
+
+static sqlite3_pcache_page* am_page_cache_fetch( sqlite3_pcache *pcache, unsigned int key, int create )
+{
+    am_page_cache *cache = (am_page_cache*)pcache;
+    am_page       *page  = NULL;
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+
+    if ( cache->hash_size > 0 ) {
+        for ( page = cache->hash[ key % cache->hash_size ] ; NULL != page ; page = page->next_hash ) {
+            if ( page->key == key ) {
+                break;
+            }
+        }
+    }
+
+    if ( NULL != page ) {
+        am_page_cache_global.hits++;
+        if ( NULL != page->lru_next ) {
+            am_page_lru_remove( page );
+        }
+        page->pinned = 1;
+        sqlite3_mutex_leave( am_page_cache_global.mutex );
+        return &(page->base);
+    }
+
+    if ( 0 == create ) {
+        sqlite3_mutex_leave( am_page_cache_global.mutex );
+        return NULL;
+    }
+    am_page_cache_global.misses++;
+
+    if ( cache->purgeable ) {
+        page = am_page_cache_make_room( cache->page_bytes );
+        if ( NULL == page && am_page_cache_global.used + cache->page_bytes > am_page_cache_global.budget ) {
+            /* every page is pinned, SQLite spills and asks again with 2 */
+            if ( 1 == create ) {
+                sqlite3_mutex_leave( am_page_cache_global.mutex );
+                return NULL;
+            }
+            am_page_cache_global.overflows++;
+        }
+    }
+    if ( NULL == page ) {
+        page = am_page_alloc( cache->page_bytes );
+        if ( NULL == page ) {
+            sqlite3_mutex_leave( am_page_cache_global.mutex );
+            return NULL;
+        }
+    }
+
+    if ( cache->page_count >= cache->hash_size ) {
+        am_page_hash_grow( cache );
+    }
+    if ( 0 == cache->hash_size ) {
+        am_page_release( page );
+        sqlite3_mutex_leave( am_page_cache_global.mutex );
+        return NULL;
+    }
+
+    page->base.pBuf   = ((char*)page) + AM_ROUND8( sizeof( am_page ) );
+    page->base.pExtra = ((char*)page->base.pBuf) + AM_ROUND8( cache->size_page );
+    memset( page->base.pExtra, 0, (size_t)cache->size_extra );
+    page->key       = key;
+    page->pinned    = 1;
+    page->size      = cache->page_bytes;
+    page->cache     = cache;
+    page->lru_prev  = page->lru_next = NULL;
+    page->next_hash = cache->hash[ key % cache->hash_size ];
+    cache->hash[ key % cache->hash_size ] = page;
+    cache->page_count++;
+    if ( cache->purgeable ) {
+        am_page_cache_global.used += page->size;
+    }
+    am_page_cache_global.pages++;
+
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+    return &(page->base);
+}
+
+static void am_page_cache_unpin( sqlite3_pcache *pcache, sqlite3_pcache_page *pcache_page, int discard )
+{
+    am_page_cache *cache = (am_page_cache*)pcache;
+    am_page       *page  = (am_page*)pcache_page;
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    page->pinned = 0;
+    if ( discard || !cache->purgeable ) {
+        am_page_discard( page );
+    } else {
+        am_page_lru_push( page );
+        /* pages allocated past the budget go as soon as they can */
+        am_page_cache_make_room( 0 );
+    }
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+}
+
+static void am_page_cache_rekey( sqlite3_pcache *pcache, sqlite3_pcache_page *pcache_page, unsigned int old_key, unsigned int new_key )
+{
+    am_page_cache *cache = (am_page_cache*)pcache;
+    am_page       *page  = (am_page*)pcache_page;
+    am_page       *other;
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    for ( other = cache->hash[ new_key % cache->hash_size ] ; NULL != other ; other = other->next_hash ) {
+        if ( other->key == new_key ) {
+            am_page_discard( other );
+            break;
+        }
+    }
+    am_page_hash_remove( cache, page );
+    page->key       = new_key;
+    page->next_hash = cache->hash[ new_key % cache->hash_size ];
+    cache->hash[ new_key % cache->hash_size ] = page;
+    cache->page_count++;
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+}
+
+/* discard the pages of a cache with a key of at least limit */
+static void am_page_cache_discard_from( am_page_cache *cache, unsigned int limit, int unpinned_only )
+{
+    am_page      *page;
+    am_page      *next;
+    unsigned int  i;
+
+    for ( i = 0 ; i < cache->hash_size ; i++ ) {
+        for ( page = cache->hash[i] ; NULL != page ; page = next ) {
+            next = page->next_hash;
+            if ( page->key >= limit && !( unpinned_only && page->pinned ) ) {
+                am_page_discard( page );
+            }
+        }
+    }
+}
+
+static void am_page_cache_truncate( sqlite3_pcache *pcache, unsigned int limit )
+{
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    am_page_cache_discard_from( (am_page_cache*)pcache, limit, 0 );
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+}
+
+static void am_page_cache_destroy( sqlite3_pcache *pcache )
+{
+    am_page_cache *cache = (am_page_cache*)pcache;
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    am_page_cache_discard_from( cache, 0, 0 );
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+    sqlite3_free( cache->hash );
+    sqlite3_free( cache );
+}
+
+static void am_page_cache_shrink( sqlite3_pcache *pcache )
+{
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    am_page_cache_discard_from( (am_page_cache*)pcache, 0, 1 );
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+}
+
+static const sqlite3_pcache_methods2 am_page_cache_methods = {
+    1,
+    NULL,
+    am_page_cache_init,
+    am_page_cache_shutdown,
+    am_page_cache_create,
+    am_page_cache_cachesize,
+    am_page_cache_pagecount,
+    am_page_cache_fetch,
+    am_page_cache_unpin,
+    am_page_cache_rekey,
+    am_page_cache_truncate,
+    am_page_cache_destroy,
+    am_page_cache_shrink
+};
+
+/*----------------------------------------------------------------------
+ * the preallocated region
+ *---------------------------------------------------------------------*/
+
+static void am_page_cache_free_region( void )
+{
+#ifdef HAVE_SYS_MMAN_H
+    if ( NULL != am_page_cache_global.region ) {
+        munmap( am_page_cache_global.region, am_page_cache_global.region_size );
+    }
+#endif
+    am_page_cache_global.region      = NULL;
+    am_page_cache_global.region_size = 0;
+    am_page_cache_global.free_slots  = NULL;
+    am_page_cache_global.huge_pages  = 0;
+}
+
+/* a mapped region of page slots, not yet handed to the page cache */
+typedef struct am_page_region {
+    char   *region;
+    size_t  size;
+    void   *free_slots;
+    int     huge_pages;
+} am_page_region;
+
+/*
+ * Map a region of size bytes of page slots of slot_size bytes into r, on huge
+ * pages if they are asked for and the system has them.  The page cache is not
+ * touched.  Returns 0 if the region could not be mapped.
+ */
+static int am_page_cache_map_region( am_page_region *r, size_t size, sqlite3_int64 slot_size, int huge_pages )
+{
+#ifdef HAVE_SYS_MMAN_H
+    void   *region = MAP_FAILED;
+    size_t  offset;
+
+    r->huge_pages = 0;
+#ifdef MAP_HUGETLB
+    if ( huge_pages ) {
+        /* huge pages are 2MB, and the mapping must be a multiple of them */
+        size = ( size + ( 2 << 20 ) - 1 ) & ~( (size_t)( 2 << 20 ) - 1 );
+        region = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0 );
+        r->huge_pages = ( MAP_FAILED != region );
+    }
+#endif
+    if ( MAP_FAILED == region ) {
+        region = mmap( NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+        if ( MAP_FAILED == region ) {
+            return 0;
+        }
+#ifdef MADV_HUGEPAGE
+        if ( huge_pages ) {
+            r->huge_pages = ( 0 == madvise( region, size, MADV_HUGEPAGE ) );
+        }
+#endif
+    }
+
+    r->region     = (char*)region;
+    r->size       = size;
+    r->free_slots = NULL;
+    for ( offset = 0 ; offset + (size_t)slot_size <= size ; offset += (size_t)slot_size ) {
+        void *slot = r->region + ( size - offset - (size_t)slot_size );
+        *(void**)slot = r->free_slots;
+        r->free_slots = slot;
+    }
+    return 1;
+#else
+    return 0;
+#endif
+}
+
+/*----------------------------------------------------------------------
+ * Amalgalite::SQLite3 methods
+ *---------------------------------------------------------------------*/
+
+static void am_page_cache_reset_counters( void )
+{
+    am_page_cache_global.hits      = 0;
+    am_page_cache_global.misses    = 0;
+    am_page_cache_global.evictions = 0;
+    am_page_cache_global.overflows = 0;
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.configure_page_cache!( budget, page_size, preallocate, huge_pages ) -> nil
+ *
+ * Shut SQLite down and start it again with the shared page cache holding up
+ * to budget bytes of pages, or with its own page cache if budget is nil.  If
+ * preallocate is true the budget is mapped up front, in slots for pages of up
+ * to page_size bytes, on huge pages if huge_pages is true and the system has
+ * them.
+ *
+ * This may only be done while no database connections are open.  Use
+ * Amalgalite::SQLite3.configure_page_cache.
+ */
+VALUE am_sqlite3_configure_page_cache_bang( VALUE self, VALUE budget, VALUE page_size, VALUE preallocate, VALUE huge_pages )
+{
+    am_page_region region;
+    sqlite3_int64  new_budget    = 0;
+    sqlite3_int64  new_slot_size = 0;
+    int            rc;
+
+    /* everything that may fail is done before the page cache is changed, so
+     * that a failure leaves SQLite running with the page cache it had */
+    memset( &region, 0, sizeof( region ) );
+    if ( Qnil != budget ) {
+        new_budget    = NUM2SQLINT64( budget );
+        new_slot_size = AM_ROUND8( sizeof( am_page ) ) + AM_ROUND8( NUM2INT( page_size ) ) + AM_PAGE_CACHE_MAX_EXTRA;
+    }
+
+    am_sqlite3_shutdown_for_configuration( "the page cache" );
+
+    if ( !am_page_cache_have_default ) {
+        rc = sqlite3_config( SQLITE_CONFIG_GETPCACHE2, &am_page_cache_default );
+        if ( SQLITE_OK != rc ) {
+            sqlite3_initialize();
+            rb_raise(eAS_Error, "Failure to read the sqlite3 page cache : [SQLITE_ERROR %d]\n", rc);
+        }
+        am_page_cache_have_default = 1;
+    }
+
+    if ( ( Qnil != budget ) && RTEST( preallocate ) &&
+         !am_page_cache_map_region( &region, (size_t)new_budget, new_slot_size, RTEST( huge_pages ) ) ) {
+        sqlite3_initialize();
+        rb_raise(eAS_Error, "Failure to preallocate %lld bytes for the page cache\n", (long long)new_budget);
+    }
+
+    am_page_cache_free_region();
+    am_page_cache_reset_counters();
+    am_page_cache_installed = 0;
+
+    if ( Qnil == budget ) {
+        rc = sqlite3_config( SQLITE_CONFIG_PCACHE2, &am_page_cache_default );
+    } else {
+        am_page_cache_global.budget      = new_budget;
+        am_page_cache_global.slot_size   = new_slot_size;
+        am_page_cache_global.region      = region.region;
+        am_page_cache_global.region_size = region.size;
+        am_page_cache_global.free_slots  = region.free_slots;
+        am_page_cache_global.huge_pages  = region.huge_pages;
+        rc = sqlite3_config( SQLITE_CONFIG_PCACHE2, &am_page_cache_methods );
+        am_page_cache_installed = ( SQLITE_OK == rc );
+
+        /* SQLite would otherwise carry on with the cache it had, which may be
+         * this one, so go back to its own */
+        if ( SQLITE_OK != rc ) {
+            sqlite3_config( SQLITE_CONFIG_PCACHE2, &am_page_cache_default );
+            am_page_cache_free_region();
+        }
+    }
+
+    if ( SQLITE_OK == rc ) {
+        rc = sqlite3_initialize();
+    } else {
+        sqlite3_initialize();
+    }
+    if ( SQLITE_OK != rc ) {
+        rb_raise(eAS_Error, "Failure to configure the sqlite3 page cache : [SQLITE_ERROR %d]\n", rc);
+    }
+    return Qnil;
+}
+
+/*
+ * call-seq:
+ *    Amalgalite::SQLite3.page_cache_stats( reset = false ) -> Hash or nil
+ *
+ * The state of the shared page cache, nil if it is not installed, as a Hash
+ * with the keys :budget, :used, the bytes of pages of database files, :pages,
+ * all the pages cached, :hits, :misses, :evictions, the pages evicted to keep
+ * within the budget, :overflows, the pages SQLite needed past the budget,
+ * :preallocated, the bytes mapped for pages, and :huge_pages.  If reset is
+ * true the counters start again from 0.
+ */
+VALUE am_sqlite3_page_cache_stats( int argc, VALUE *argv, VALUE self )
+{
+    VALUE         reset;
+    VALUE         stats;
+    sqlite3_int64 counters[6];
+
+    rb_scan_args( argc, argv, "01", &reset );
+    if ( !am_page_cache_installed ) {
+        return Qnil;
+    }
+
+    sqlite3_mutex_enter( am_page_cache_global.mutex );
+    counters[0] = am_page_cache_global.used;
+    counters[1] = am_page_cache_global.pages;
+    counters[2] = am_page_cache_global.hits;
+    counters[3] = am_page_cache_global.misses;
+    counters[4] = am_page_cache_global.evictions;
+    counters[5] = am_page_cache_global.overflows;
+    if ( RTEST( reset ) ) {
+        am_page_cache_reset_counters();
+    }
+    sqlite3_mutex_leave( am_page_cache_global.mutex );
+
+    stats = rb_hash_new();
+    rb_hash_aset( stats, ID2SYM( rb_intern( "budget" ) ), SQLINT64_2NUM( am_page_cache_global.budget ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "used" ) ), SQLINT64_2NUM( counters[0] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "pages" ) ), SQLINT64_2NUM( counters[1] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "hits" ) ), SQLINT64_2NUM( counters[2] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "misses" ) ), SQLINT64_2NUM( counters[3] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "evictions" ) ), SQLINT64_2NUM( counters[4] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "overflows" ) ), SQLINT64_2NUM( counters[5] ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "preallocated" ) ), SIZET2NUM( am_page_cache_global.region_size ) );
+    rb_hash_aset( stats, ID2SYM( rb_intern( "huge_pages" ) ), am_page_cache_global.huge_pages ? Qtrue : Qfalse );
+    return stats;
+}
+
+void Init_amalgalite_page_cache( )
+{
+    VALUE ma  = rb_define_module("Amalgalite");
+    VALUE mas = rb_define_module_under(ma, "SQLite3");
+
+    rb_define_module_function(mas, "configure_page_cache!", am_sqlite3_configure_page_cache_bang, 4); /* in amalgalite_page_cache.c */
+    rb_define_module_function(mas, "page_cache_stats", am_sqlite3_page_cache_stats, -1); /* in amalgalite_page_cache.c */
+}
@@ -0,0 +1,478 @@
+#include "amalgalite.h"
+/**
+ * Copyright (c) 2008 Jeremy Hinegardner
+ * All rights reserved.  See LICENSE and/or COPYING for details.
+ *
+ * vim: shiftwidth=4
+ */
+
+/*
+ * Statistics of the statements run on a connection, aggregated by
+ * fingerprint in the trace callback without calling into ruby, and read back
+ * through the eponymous virtual table amalgalite_query_stats.
+ *
+ * The fingerprint of a statement is its normalized sql, with the literals
+ * replaced by '?', when SQLite is compiled with SQLITE_ENABLE_NORMALIZE, and
+ * its sql otherwise.
+ */
+
+/* the name of the virtual table */
+#define AM_QUERY_STATS_MODULE "amalgalite_query_stats"
+
+/* the columns of the virtual table */
+#define AM_QUERY_STATS_COL_FINGERPRINT    0
+#define AM_QUERY_STATS_COL_CALLS          1
+#define AM_QUERY_STATS_COL_TOTAL_TIME     2
+#define AM_QUERY_STATS_COL_MIN_TIME       3
+#define AM_QUERY_STATS_COL_MAX_TIME       4
+#define AM_QUERY_STATS_COL_MEAN_TIME      5
+#define AM_QUERY_STATS_COL_ROWS           6
+#define AM_QUERY_STATS_COL_FULLSCAN_STEPS 7
+
+/* the initial number of slots in the table of fingerprints */
+#define AM_QUERY_STATS_INITIAL_CAPACITY 64
+
+/*
+ * allocate an empty, not collecting, set of statistics.  Returns NULL if out
+ * of memory.
+ */
+am_query_stats* am_query_stats_alloc( )
+{
+    am_query_stats *stats = sqlite3_malloc64( sizeof( am_query_stats ) );
+
+    if ( NULL != stats ) {
+        memset( stats, 0, sizeof( am_query_stats ) );
+    }
+    return stats;
+}
+
+/*
+ * forget every fingerprint and every running statement
+ */
+void am_query_stats_clear( am_query_stats *stats )
+{
+    long i;
+
+    for ( i = 0 ; i < stats->capacity ; i++ ) {
+        sqlite3_free( stats->stats[i].fingerprint );
+    }
+    sqlite3_free( stats->stats );
+    stats->stats    = NULL;
+    stats->capacity = 0;
+    stats->count    = 0;
+    memset( stats->runs, 0, sizeof( stats->runs ) );
+    stats->next_run = 0;
+}
+
+void am_query_stats_free( am_query_stats *stats )
+{
+    if ( NULL != stats ) {
+        am_query_stats_clear( stats );
+        sqlite3_free( stats );
+    }
+}
+
+/*
+ * the text the statistics of a statement are kept under
+ */
+static const char* am_query_stats_fingerprint( sqlite3_stmt *stmt )
+{
+    const char *sql = NULL;
+
+#ifdef SQLITE_ENABLE_NORMALIZE
+    sql = sqlite3_normalized_sql( stmt );
+#endif
+    if ( NULL == sql ) {
+        sql = sqlite3_sql( stmt );
+    }
+    return sql;
+}
+
+/* FNV-1a */
+static unsigned int am_query_stats_hash( const char *s, size_t *length )
+{
+    unsigned int  h = 2166136261u;
+    const char   *p = s;
+
+    while ( *p ) {
+        h ^= (unsigned char)*p++;
+        h *= 16777619u;
+    }
+    *length = p - s;
+    return h;
+}
+
+/*
+ * move the fingerprints into a table of twice the size.  Returns 0 if out of
+ * memory, leaving the table as it was.
+ */
+static int am_query_stats_grow( am_query_stats *stats )
+{
+    long           capacity = ( 0 == stats->capacity ) ? AM_QUERY_STATS_INITIAL_CAPACITY : stats->capacity * 2;
+    am_query_stat *table    = sqlite3_malloc64( capacity * sizeof( am_query_stat ) );
+    long           i, j;
+
+    if ( NULL == table ) {
+        return 0;
+    }
+    memset( table, 0, capacity * sizeof( am_query_stat ) );
+
+    for ( i = 0 ; i < stats->capacity ; i++ ) {
+        if ( NULL != stats->stats[i].fingerprint ) {
+            j = stats->stats[i].hash & ( capacity - 1 );
+            while ( NULL != table[j].fingerprint ) {
+                j = ( j + 1 ) & ( capacity - 1 );
+            }
+            table[j] = stats->stats[i];
+        }
+    }
+
+    sqlite3_free( stats->stats );
+    stats->stats    = table;
+    stats->capacity = capacity;
+    return 1;
+}
+
+/*
+ * find the statistics of +fingerprint+, adding them if they are new.  Returns
+ * NULL if they cannot be added.
+ */
+static am_query_stat* am_query_stats_lookup( am_query_stats *stats, const char *fingerprint )
+{
+    size_t         length;
+    unsigned int   hash = am_query_stats_hash( fingerprint, &length );
+    am_query_stat *stat;
+    long           i;
+
+    if ( stats->capacity > 0 ) {
+        i = hash & ( stats->capacity - 1 );
+        while ( NULL != stats->stats[i].fingerprint ) {
+            if ( ( hash == stats->stats[i].hash ) && ( 0 == strcmp( fingerprint, stats->stats[i].fingerprint ) ) ) {
+                return &( stats->stats[i] );
+            }
+            i = ( i + 1 ) & ( stats->capacity - 1 );
+        }
+    }
+
+    /* keep the table at most half full */
+    if ( stats->count >= AM_QUERY_STATS_MAX ) {
+        return NULL;
+    }
+    if ( ( ( stats->count + 1 ) * 2 > stats->capacity ) && !am_query_stats_grow( stats ) ) {
+        return NULL;
+    }
+
+    i = hash & ( stats->capacity - 1 );
+    while ( NULL != stats->stats[i].fingerprint ) {
+        i = ( i + 1 ) & ( stats->capacity - 1 );
+    }
+    stat = &( stats->stats[i] );
+    stat->fingerprint = sqlite3_malloc64( length + 1 );
+    if ( NULL == stat->fingerprint ) {
+        return NULL;
+    }
+    memcpy( stat->fingerprint, fingerprint, length + 1 );
+    stat->hash = hash;
+    stats->count++;
+    return stat;
+}
+
+/*
+ * the running statement +stmt+, or NULL
+ */
+static am_query_run* am_query_stats_run( am_query_stats *stats, sqlite3_stmt *stmt )
+{
+    int i;
+
+    for ( i = 0 ; i < AM_QUERY_STATS_RUNS ; i++ ) {
+        if ( stmt == stats->runs[i].stmt ) {
+            return &( stats->runs[i] );
+        }
+    }
+    return NULL;
+}
+
+/*
+ * record a trace event.  This is called from the trace callback with the
+ * connection mutex held, and without the GVL.
+ *
+ * SQLITE_TRACE_STMT starts a run of the statement, SQLITE_TRACE_ROW counts the
+ * rows it returns, and SQLITE_TRACE_PROFILE ends the run and adds it to the
+ * statistics of the fingerprint of the statement.
+ */
+void am_query_stats_record( am_query_stats *stats, unsigned trace_type, sqlite3_stmt *stmt, void *extra )
+{
+    am_query_run  *run;
+    am_query_stat *stat;
+    const char    *fingerprint;
+    sqlite3_int64  time;
+    sqlite3_int64  rows     = 0;
+    sqlite3_int64  fullscan = 0;
+
+    switch ( trace_type ) {
+        case SQLITE_TRACE_STMT:
+            /* triggers report their sql as a comment against the statement
+             * that fired them, they are part of its run */
+            if ( 0 == strncmp( (const char*)extra, "--", 2 ) ) {
+                break;
+            }
+            if ( NULL == ( run = am_query_stats_run( stats, stmt ) ) ) {
+                run = &( stats->runs[ stats->next_run ] );
+                stats->next_run = ( stats->next_run + 1 ) % AM_QUERY_STATS_RUNS;
+            }
+            run->stmt           = stmt;
+            run->rows           = 0;
+            run->fullscan_start = sqlite3_stmt_status( stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0 );
+            break;
+
+        case SQLITE_TRACE_ROW:
+            if ( NULL != ( run = am_query_stats_run( stats, stmt ) ) ) {
+                run->rows++;
+            }
+            break;
+
+        case SQLITE_TRACE_PROFILE:
+            time     = (sqlite3_int64)*(sqlite3_uint64*)extra;
+            fullscan = sqlite3_stmt_status( stmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 0 );
+            if ( NULL != ( run = am_query_stats_run( stats, stmt ) ) ) {
+                rows      = run->rows;
+                fullscan -= run->fullscan_start;
+                run->stmt = NULL;
+            }
+            if ( fullscan < 0 ) {
+                fullscan = 0;
+            }
+
+            fingerprint = am_query_stats_fingerprint( stmt );
+            if ( ( NULL == fingerprint ) || ( NULL == ( stat = am_query_stats_lookup( stats, fingerprint ) ) ) ) {
+                break;
+            }
+            if ( ( 0 == stat->calls ) || ( time < stat->min_time ) ) {
+                stat->min_time = time;
+            }
+            if ( time > stat->max_time ) {
+                stat->max_time = time;
+            }
+            stat->calls          += 1;
+            stat->total_time     += time;
+            stat->rows           += rows;
+            stat->fullscan_steps += fullscan;
+            break;
+
+        default:
+            break;
+    }
+}
+
+/***********************************************************************
+ * The amalgalite_query_stats eponymous virtual table
+ **********************************************************************/
+
+typedef struct am_query_stats_vtab {
+    sqlite3_vtab  base;
+    am_sqlite3   *am_db;
+} am_query_stats_vtab;
+
+/* a cursor walks a copy of the statistics taken when it is filtered */
+typedef struct am_query_stats_cursor {
+    sqlite3_vtab_cursor  base;
+    am_query_stat       *rows;
+    long                 count;
+    long                 current;
+} am_query_stats_cursor;
+
+static int am_query_stats_connect( sqlite3 *db, void *aux, int argc, const char *const *argv,
+                                   sqlite3_vtab **vtab, char **err )
+{
+    am_query_stats_vtab *v;
+    int                  rc;
+
+    rc = sqlite3_declare_vtab( db, "CREATE TABLE x( fingerprint TEXT, calls INTEGER, "
+                                   "total_time INTEGER, min_time INTEGER, max_time INTEGER, mean_time REAL, "
+                                   "rows INTEGER, fullscan_steps INTEGER )" );
+    if ( SQLITE_OK != rc ) {
+        return rc;
+    }
+
+    v = sqlite3_malloc( sizeof( am_query_stats_vtab ) );
+    if ( NULL == v ) {
+        return SQLITE_NOMEM;
+    }
+    memset( v, 0, sizeof( am_query_stats_vtab ) );
+    v->am_db = (am_sqlite3*) aux;
+    *vtab = &( v->base );
+    return SQLITE_OK;
+}
+
+static int am_query_stats_disconnect( sqlite3_vtab *vtab )
+{
+    sqlite3_free( vtab );
+    return SQLITE_OK;
+}
+
+static int am_query_stats_best_index( sqlite3_vtab *vtab, sqlite3_index_info *info )
+{
+    am_query_stats *stats = ((am_query_stats_vtab*) vtab)->am_db->query_stats;
+
+    info->estimatedCost = (double)( ( NULL == stats ) ? 1 : stats->count + 1 );
+    info->estimatedRows = ( NULL == stats ) ? 1 : stats->count + 1;
+    return SQLITE_OK;
+}
+
+static void am_query_stats_cursor_free_rows( am_query_stats_cursor *cursor )
+{
+    long i;
+
+    for ( i = 0 ; i < cursor->count ; i++ ) {
+        sqlite3_free( cursor->rows[i].fingerprint );
+    }
+    sqlite3_free( cursor->rows );
+    cursor->rows    = NULL;
+    cursor->count   = 0;
+    cursor->current = 0;
+}
+
+static int am_query_stats_open( sqlite3_vtab *vtab, sqlite3_vtab_cursor **cursor )
+{
+    am_query_stats_cursor *c = sqlite3_malloc( sizeof( am_query_stats_cursor ) );
+
+    if ( NULL == c ) {
+        return SQLITE_NOMEM;
+    }
+    memset( c, 0, sizeof( am_query_stats_cursor ) );
+    *cursor = &( c->base );
+    return SQLITE_OK;
+}
+
+static int am_query_stats_close( sqlite3_vtab_cursor *cursor )
+{
+    am_query_stats_cursor_free_rows( (am_query_stats_cursor*) cursor );
+    sqlite3_free( cursor );
+    return SQLITE_OK;
+}
+
+/*
+ * copy the statistics, so the statements run while the cursor is open may
+ * change them freely
+ */
+static int am_query_stats_filter( sqlite3_vtab_cursor *cursor, int idx_num, const char *idx_str,
+                                  int argc, sqlite3_value **argv )
+{
+    am_query_stats_cursor *c     = (am_query_stats_cursor*) cursor;
+    am_query_stats        *stats = ((am_query_stats_vtab*) cursor->pVtab)->am_db->query_stats;
+    size_t                 length;
+    long                   i;
+
+    am_query_stats_cursor_free_rows( c );
+    if ( ( NULL == stats ) || ( 0 == stats->count ) ) {
+        return SQLITE_OK;
+    }
+
+    c->rows = sqlite3_malloc64( stats->count * sizeof( am_query_stat ) );
+    if ( NULL == c->rows ) {
+        return SQLITE_NOMEM;
+    }
+    for ( i = 0 ; i < stats->capacity ; i++ ) {
+        if ( NULL == stats->stats[i].fingerprint ) {
+            continue;
+        }
+        c->rows[ c->count ] = stats->stats[i];
+        length = strlen( stats->stats[i].fingerprint );
+        c->rows[ c->count ].fingerprint = sqlite3_malloc64( length + 1 );
+        if ( NULL == c->rows[ c->count ].fingerprint ) {
+            return SQLITE_NOMEM;
+        }
+        memcpy( c->rows[ c->count ].fingerprint, stats->stats[i].fingerprint, length + 1 );
+        c->count++;
+    }
+    return SQLITE_OK;
+}
+
+static int am_query_stats_next( sqlite3_vtab_cursor *cursor )
+{
+    ((am_query_stats_cursor*) cursor)->current++;
+    return SQLITE_OK;
+}
+
+static int am_query_stats_eof( sqlite3_vtab_cursor *cursor )
+{
+    am_query_stats_cursor *c = (am_query_stats_cursor*) cursor;
+    return c->current >= c->count;
+}
+
+static int am_query_stats_column( sqlite3_vtab_cursor *cursor, sqlite3_context *context, int column )
+{
+    am_query_stats_cursor *c    = (am_query_stats_cursor*) cursor;
+    am_query_stat         *stat = &( c->rows[ c->current ] );
+
+    switch ( column ) {
+        case AM_QUERY_STATS_COL_FINGERPRINT:
+            sqlite3_result_text( context, stat->fingerprint, -1, SQLITE_TRANSIENT );
+            break;
+        case AM_QUERY_STATS_COL_CALLS:
+            sqlite3_result_int64( context, stat->calls );
+            break;
+        case AM_QUERY_STATS_COL_TOTAL_TIME:
+            sqlite3_result_int64( context, stat->total_time );
+            break;
+        case AM_QUERY_STATS_COL_MIN_TIME:
+            sqlite3_result_int64( context, stat->min_time );
+            break;
+        case AM_QUERY_STATS_COL_MAX_TIME:
+            sqlite3_result_int64( context, stat->max_time );
+            break;
+        case AM_QUERY_STATS_COL_MEAN_TIME:
+            sqlite3_result_double( context, ( 0 == stat->calls ) ? 0.0 : (double)stat->total_time / (double)stat->calls );
+            break;
+        case AM_QUERY_STATS_COL_ROWS:
+            sqlite3_result_int64( context, stat->rows );
+            break;
+        case AM_QUERY_STATS_COL_FULLSCAN_STEPS:
+            sqlite3_result_int64( context, stat->fullscan_steps );
+            break;
+    }
+    return SQLITE_OK;
+}
+
+static int am_query_stats_rowid( sqlite3_vtab_cursor *cursor, sqlite3_int64 *rowid )
+{
+    *rowid = ((am_query_stats_cursor*) cursor)->current + 1;
+    return SQLITE_OK;
+}
+
+/* no xCreate, so the table is eponymous only */
+static sqlite3_module am_query_stats_module = {
+    0,                           /* iVersion */
+    0,                           /* xCreate */
+    am_query_stats_connect,      /* xConnect */
+    am_query_stats_best_index,   /* xBestIndex */
+    am_query_stats_disconnect,   /* xDisconnect */
+    0,                           /* xDestroy */
+    am_query_stats_open,         /* xOpen */
+    am_query_stats_close,        /* xClose */
+    am_query_stats_filter,       /* xFilter */
+    am_query_stats_next,         /* xNext */
+    am_query_stats_eof,          /* xEof */
+    am_query_stats_column,       /* xColumn */
+    am_query_stats_rowid,        /* xRowid */
+    0,                           /* xUpdate */
+    0,                           /* xBegin */
+    0,                           /* xSync */
+    0,                           /* xCommit */
+    0,                           /* xRollback */
+    0,                           /* xFindFunction */
+    0,                           /* xRename */
+    0,                           /* xSavepoint */
+    0,                           /* xRelease */
+    0,                           /* xRollbackTo */
+    0,                           /* xShadowName */
+    0,                           /* xIntegrity */
+};
+
+/*
+ * register the amalgalite_query_stats virtual table on the connection
+ */
+int am_query_stats_create_module( am_sqlite3 *am_db )
+{
+    return sqlite3_create_module( am_db->db, AM_QUERY_STATS_MODULE, &am_query_stats_module, (void*)am_db );
+}
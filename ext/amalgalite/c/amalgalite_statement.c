@@ -1,4 +1,5 @@
 #include "amalgalite.h"
+#include <math.h>
 /**
  * Copyright (c) 2008 Jeremy Hinegardner
  * All rights reserved.  See LICENSE and/or COPYING for details.
@@ -8,6 +9,14 @@
 
 VALUE cAS_Statement;   /* class  Amalgliate::SQLite3::Statement */
 
+/* method names and symbols used by conversion plans */
+static ID id_call;
+static ID id_to_s;
+static ID id_float;
+static ID id_integer;
+static ID id_new;
+static ID id_intern;
+
 /**
  * call-seq:
  *     stmt.bind_null( position ) -> int
@@ -34,23 +43,29 @@ VALUE am_sqlite3_statement_bind_null(VALUE self, VALUE position )
 
 /**
  * call-seq:
- *    stmt.bind_zeroblob( position, length ) -> int
+ *    stmt.bind_zeroblob64( position, length ) -> int
  *
  * bind a blob with +length+ filled with zeros to the position.  This is a Blob
- * that will later filled in with incremental IO routines.
+ * that will later filled in with incremental IO routines.  The +length+ is a
+ * 64 bit value, although it is still limited by SQLITE_LIMIT_LENGTH, and may
+ * not be negative.
  */
 VALUE am_sqlite3_statement_bind_zeroblob( VALUE self, VALUE position, VALUE length)
 {
     am_sqlite3_stmt  *am_stmt;
     int               pos = FIX2INT( position );
-    int               n = (int)FIX2INT( length );
+    sqlite3_int64     n   = NUM2LL( length );
     int               rc;
 
+    if ( n < 0 ) {
+        rb_raise( rb_eArgError, "The length of a zeroblob may not be negative, it is %lld", (long long)n );
+    }
+
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
-    rc = sqlite3_bind_zeroblob( am_stmt->stmt, pos, n );
+    rc = sqlite3_bind_zeroblob64( am_stmt->stmt, pos, (sqlite3_uint64)n );
     if ( SQLITE_OK != rc ) {
-        rb_raise(eAS_Error, "Error binding zeroblob of length %d at position %d in statement: [SQLITE_ERROR %d] : %s\n",
-                n, pos,
+        rb_raise(eAS_Error, "Error binding zeroblob of length %lld at position %d in statement: [SQLITE_ERROR %d] : %s\n",
+                (long long)n, pos,
                 rc, sqlite3_errmsg( sqlite3_db_handle( am_stmt->stmt) ));
     }
 
@@ -60,10 +75,10 @@ VALUE am_sqlite3_statement_bind_zeroblob( VALUE self, VALUE position, VALUE leng
 
 /**
  * call-seq:
- *    stmt.bind_blob( position, blob ) -> int
+ *    stmt.bind_blob64( position, blob ) -> int
  *
  * bind a blob to the variable at position.  This is a blob that is fully held
- * in memory
+ * in memory, its length is passed to SQLite as a 64 bit value.
  */
 VALUE am_sqlite3_statement_bind_blob( VALUE self, VALUE position, VALUE blob )
 {
@@ -73,7 +88,7 @@ VALUE am_sqlite3_statement_bind_blob( VALUE self, VALUE position, VALUE blob )
     int               rc;
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
-    rc = sqlite3_bind_blob( am_stmt->stmt, pos, RSTRING_PTR( str ), (int)RSTRING_LEN( str ), SQLITE_TRANSIENT);
+    rc = sqlite3_bind_blob64( am_stmt->stmt, pos, RSTRING_PTR( str ), (sqlite3_uint64)RSTRING_LEN( str ), SQLITE_TRANSIENT);
     if ( SQLITE_OK != rc ) {
         rb_raise(eAS_Error, "Error binding blob at position %d in statement: [SQLITE_ERROR %d] : %s\n",
                 pos,
@@ -182,6 +197,456 @@ VALUE am_sqlite3_statement_bind_text(VALUE self, VALUE position, VALUE value)
 
     return INT2FIX(rc);
 }
+/*
+ * Amalgalite::Blob, looked up when first needed since it is defined on the
+ * ruby side
+ */
+static VALUE cA_Blob = Qnil;
+
+static int am_sqlite3_is_blob( VALUE value )
+{
+    if ( Qnil == cA_Blob ) {
+        VALUE ma = rb_define_module( "Amalgalite" );
+        if ( !rb_const_defined( ma, rb_intern( "Blob" ) ) ) {
+            return 0;
+        }
+        cA_Blob = rb_const_get( ma, rb_intern( "Blob" ) );
+    }
+    return RTEST( rb_obj_is_kind_of( value, cA_Blob ) );
+}
+
+/*
+ * A parameter value converted from ruby, ready to be bound without the GVL
+ */
+typedef struct am_bind_value {
+    int            type;     /* SQLITE_INTEGER, SQLITE_FLOAT, SQLITE_NULL or SQLITE_TEXT */
+    int            position;
+    sqlite3_int64  i;
+    double         d;
+    const char    *text;
+    int            length;
+} am_bind_value;
+
+/*
+ * Convert value into bv choosing the binding from the ruby type of value, the
+ * same choice Amalgalite::TypeMaps::DefaultMap#bind_type_of makes.  Integer,
+ * Float and nil are bound as themselves, Time, Date and DateTime are
+ * formatted by Amalgalite::SQLite3.format_time and everything else is bound as
+ * the text of +to_s+.  For text the String is returned in *str and the caller
+ * fills in bv->text.  Amalgalite::Blob values cannot be converted and 0 is
+ * returned, otherwise 1 is returned.
+ */
+static int am_sqlite3_statement_bind_value_of( VALUE value, am_bind_value *bv, VALUE *str )
+{
+    switch ( TYPE( value ) ) {
+        case T_FIXNUM:
+        case T_BIGNUM:
+            bv->type = SQLITE_INTEGER;
+            bv->i    = NUM2SQLINT64( value );
+            break;
+
+        case T_FLOAT:
+            bv->type = SQLITE_FLOAT;
+            bv->d    = RFLOAT_VALUE( value );
+            break;
+
+        case T_NIL:
+            bv->type = SQLITE_NULL;
+            break;
+
+        case T_STRING:
+            bv->type = SQLITE_TEXT;
+            *str     = value;
+            break;
+
+        default:
+            if ( am_sqlite3_is_blob( value ) ) {
+                return 0;
+            }
+            bv->type = SQLITE_TEXT;
+            *str     = am_sqlite3_format_time( Qnil, value );
+            break;
+    }
+    if ( SQLITE_TEXT == bv->type ) {
+        bv->length = (int)RSTRING_LEN( *str );
+    }
+    return 1;
+}
+
+/* bind bv to stmt, this does not need the GVL */
+static int am_sqlite3_statement_bind_one( sqlite3_stmt *stmt, am_bind_value *bv )
+{
+    switch ( bv->type ) {
+        case SQLITE_INTEGER:
+            return sqlite3_bind_int64( stmt, bv->position, bv->i );
+        case SQLITE_FLOAT:
+            return sqlite3_bind_double( stmt, bv->position, bv->d );
+        case SQLITE_TEXT:
+            return sqlite3_bind_text( stmt, bv->position, bv->text, bv->length, SQLITE_TRANSIENT );
+        default:
+            return sqlite3_bind_null( stmt, bv->position );
+    }
+}
+
+/*
+ * Bind value to position pos of stmt, see am_sqlite3_statement_bind_value_of.
+ * Amalgalite::Blob values are not bound, 0 is returned so the caller may bind
+ * them, otherwise 1 is returned.
+ */
+static int am_sqlite3_statement_bind_value( sqlite3_stmt *stmt, int pos, VALUE value )
+{
+    am_bind_value  bv;
+    VALUE          str = Qnil;
+    int            rc;
+
+    if ( !am_sqlite3_statement_bind_value_of( value, &bv, &str ) ) {
+        return 0;
+    }
+    bv.position = pos;
+    if ( SQLITE_TEXT == bv.type ) {
+        bv.text = RSTRING_PTR( str );
+    }
+    rc = am_sqlite3_statement_bind_one( stmt, &bv );
+    RB_GC_GUARD( str );
+
+    if ( SQLITE_OK != rc ) {
+        rb_raise(eAS_Error, "Error binding parameter at position %d in statement: [SQLITE_ERROR %d] : %s\n",
+                pos,
+                rc, sqlite3_errmsg( sqlite3_db_handle( stmt ) ));
+    }
+    return 1;
+}
+
+/**
+ * call-seq:
+ *    stmt.bind_array( values ) -> Hash or nil
+ *
+ * bind each of the values to the parameter at its position, the first value
+ * at position 1.  Amalgalite::Blob values are left unbound and returned in a
+ * Hash of position => value for the caller to bind, nil is returned if every
+ * value was bound.
+ */
+VALUE am_sqlite3_statement_bind_array(VALUE self, VALUE values)
+{
+    am_sqlite3_stmt  *am_stmt;
+    VALUE             unbound = Qnil;
+    VALUE             value;
+    long              i;
+
+    Check_Type( values, T_ARRAY );
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+
+    for ( i = 0 ; i < RARRAY_LEN( values ) ; i++ ) {
+        value = rb_ary_entry( values, i );
+        if ( !am_sqlite3_statement_bind_value( am_stmt->stmt, (int)( i + 1 ), value ) ) {
+            if ( Qnil == unbound ) { unbound = rb_hash_new( ); }
+            rb_hash_aset( unbound, LONG2FIX( i + 1 ), value );
+        }
+    }
+
+    return unbound;
+}
+
+/* arguments to am_sqlite3_statement_bind_pair */
+typedef struct am_bind_hash_args {
+    am_sqlite3_stmt *am_stmt;
+    VALUE            unbound;
+} am_bind_hash_args_t;
+
+static int am_sqlite3_statement_bind_pair( VALUE key, VALUE value, VALUE data )
+{
+    am_bind_hash_args_t *args  = (am_bind_hash_args_t*) data;
+    VALUE                index = Qnil;
+
+    if ( Qnil != args->am_stmt->parameter_indexes ) {
+        index = rb_hash_lookup( args->am_stmt->parameter_indexes, key );
+        if ( ( Qnil == index ) && !SYMBOL_P( key ) && !RB_TYPE_P( key, T_STRING ) ) {
+            index = rb_hash_lookup( args->am_stmt->parameter_indexes, rb_obj_as_string( key ) );
+        }
+    }
+
+    if ( ( Qnil == index ) || !am_sqlite3_statement_bind_value( args->am_stmt->stmt, FIX2INT( index ), value ) ) {
+        if ( Qnil == args->unbound ) { args->unbound = rb_hash_new( ); }
+        rb_hash_aset( args->unbound, key, value );
+    }
+
+    return ST_CONTINUE;
+}
+
+/**
+ * call-seq:
+ *    stmt.bind_hash( hash ) -> Hash or nil
+ *
+ * bind each value of the hash to the named parameter that is its key, a
+ * String or Symbol including the leading ':', '@' or '$'.  Amalgalite::Blob
+ * values and keys that are not parameters of the statement are left unbound
+ * and returned in a Hash for the caller to deal with, nil is returned if
+ * every value was bound.
+ */
+VALUE am_sqlite3_statement_bind_hash(VALUE self, VALUE hash)
+{
+    am_bind_hash_args_t args;
+
+    Check_Type( hash, T_HASH );
+    Data_Get_Struct(self, am_sqlite3_stmt, args.am_stmt);
+    args.unbound = Qnil;
+
+    rb_hash_foreach( hash, am_sqlite3_statement_bind_pair, (VALUE)&args );
+
+    return args.unbound;
+}
+
+/* arguments to am_sqlite3_statement_collect_pair */
+typedef struct am_collect_args {
+    am_sqlite3_stmt *am_stmt;
+    am_bind_value   *bvs;
+    VALUE            texts;
+    int              count;
+    int              ok;
+} am_collect_args_t;
+
+/* convert a value of a row to its bind value, returns 0 if it cannot be */
+static int am_sqlite3_statement_collect( am_collect_args_t *args, int pos, VALUE value )
+{
+    am_bind_value *bv  = &(args->bvs[args->count]);
+    VALUE          str = Qnil;
+
+    if ( !am_sqlite3_statement_bind_value_of( value, bv, &str ) ) {
+        return 0;
+    }
+    bv->position = pos;
+    if ( SQLITE_TEXT == bv->type ) {
+        rb_ary_push( args->texts, str );
+    }
+    args->count++;
+    return 1;
+}
+
+static int am_sqlite3_statement_collect_pair( VALUE key, VALUE value, VALUE data )
+{
+    am_collect_args_t *args  = (am_collect_args_t*) data;
+    VALUE              index = Qnil;
+
+    if ( Qnil != args->am_stmt->parameter_indexes ) {
+        index = rb_hash_lookup( args->am_stmt->parameter_indexes, key );
+    }
+    if ( ( Qnil == index ) || !am_sqlite3_statement_collect( args, FIX2INT( index ), value ) ) {
+        args->ok = 0;
+        return ST_STOP;
+    }
+    return ST_CONTINUE;
+}
+
+/*
+ * convert every value of row into args->bvs.  Returns 0 if the row must be
+ * executed by the caller instead, because it does not have as many values as
+ * the statement has parameters or one of them cannot be bound here.
+ */
+static int am_sqlite3_statement_collect_row( am_collect_args_t *args, VALUE row, int param_count )
+{
+    int  start       = args->count;
+    long texts_start = RARRAY_LEN( args->texts );
+    long i;
+
+    args->ok = 1;
+    if ( RB_TYPE_P( row, T_ARRAY ) ) {
+        if ( RARRAY_LEN( row ) != param_count ) {
+            args->ok = 0;
+        }
+        for ( i = 0 ; args->ok && i < param_count ; i++ ) {
+            args->ok = am_sqlite3_statement_collect( args, (int)( i + 1 ), rb_ary_entry( row, i ) );
+        }
+    } else if ( RB_TYPE_P( row, T_HASH ) ) {
+        if ( RHASH_SIZE( row ) != (size_t)param_count ) {
+            args->ok = 0;
+        } else {
+            rb_hash_foreach( row, am_sqlite3_statement_collect_pair, (VALUE)args );
+        }
+    } else {
+        args->ok = ( 1 == param_count ) && am_sqlite3_statement_collect( args, 1, row );
+    }
+
+    if ( !args->ok ) {
+        args->count = start;
+        rb_ary_resize( args->texts, texts_start );
+    }
+    return args->ok;
+}
+
+/* arguments to am_sqlite3_statement_execute_rows_func invoked without the GVL */
+typedef struct am_execute_rows_args {
+    sqlite3_stmt  *stmt;
+    am_bind_value *bvs;
+    long           row_count;
+    int            param_count;
+    long           done;
+    sqlite3_int64  changes;
+    int            rc;
+    char           errmsg[256];
+} am_execute_rows_args_t;
+
+static void* am_sqlite3_statement_execute_rows_func( void *data )
+{
+    am_execute_rows_args_t *args     = (am_execute_rows_args_t*) data;
+    sqlite3               *db       = sqlite3_db_handle( args->stmt );
+    int                    readonly = sqlite3_stmt_readonly( args->stmt );
+    am_bind_value         *bv       = args->bvs;
+    int                    rc       = SQLITE_OK;
+    int                    p;
+
+    for ( args->done = 0 ; args->done < args->row_count ; args->done++ ) {
+        for ( p = 0 ; ( SQLITE_OK == rc ) && ( p < args->param_count ) ; p++, bv++ ) {
+            rc = am_sqlite3_statement_bind_one( args->stmt, bv );
+        }
+        if ( SQLITE_OK == rc ) {
+            while ( SQLITE_ROW == ( rc = sqlite3_step( args->stmt ) ) ) ;
+        }
+        if ( SQLITE_DONE != rc ) {
+            break;
+        }
+        if ( !readonly ) {
+            args->changes += sqlite3_changes( db );
+        }
+        sqlite3_reset( args->stmt );
+        sqlite3_clear_bindings( args->stmt );
+        rc = SQLITE_OK;
+    }
+
+    args->rc = ( SQLITE_DONE == rc || SQLITE_OK == rc ) ? SQLITE_OK : rc;
+    if ( SQLITE_OK != args->rc ) {
+        strncpy( args->errmsg, sqlite3_errmsg( db ), sizeof( args->errmsg ) - 1 );
+        args->errmsg[ sizeof( args->errmsg ) - 1 ] = '\0';
+        sqlite3_reset( args->stmt );
+        sqlite3_clear_bindings( args->stmt );
+    }
+    return NULL;
+}
+
+/**
+ * call-seq:
+ *    stmt.execute_rows( rows ) -> [ changes, executed ]
+ *
+ * Bind, execute to completion and reset the statement once for each row in
+ * the Array rows.  A row is an Array of positional parameters, a Hash of
+ * named parameters, or a single value for a statement with one parameter.
+ * Result rows, if there are any, are discarded.
+ *
+ * All the rows are converted up front and then executed in one go without
+ * the GVL.  Conversion stops at the first row that cannot be bound here,
+ * because it has the wrong number of parameters or holds an Amalgalite::Blob,
+ * and only the rows before it are executed.
+ *
+ * Returns the number of rows changed and the number of rows executed, which is
+ * the index of the row that stopped conversion if it is less than the size of
+ * rows.
+ */
+VALUE am_sqlite3_statement_execute_rows(VALUE self, VALUE rows)
+{
+    am_sqlite3_stmt        *am_stmt;
+    am_collect_args_t       collect;
+    am_execute_rows_args_t  args;
+    VALUE                   bvs_buf = 0, text_buf = 0;
+    char                   *text;
+    long                    row_count, i, t, text_length = 0;
+
+    Check_Type( rows, T_ARRAY );
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+
+    args.stmt        = am_stmt->stmt;
+    args.param_count = sqlite3_bind_parameter_count( am_stmt->stmt );
+    row_count        = RARRAY_LEN( rows );
+
+    collect.am_stmt = am_stmt;
+    collect.texts   = rb_ary_new( );
+    collect.count   = 0;
+    collect.bvs     = ALLOCV_N( am_bind_value, bvs_buf, ( row_count * args.param_count ) + 1 );
+
+    for ( i = 0 ; i < row_count ; i++ ) {
+        if ( !am_sqlite3_statement_collect_row( &collect, rb_ary_entry( rows, i ), args.param_count ) ) {
+            break;
+        }
+    }
+    args.row_count = i;
+
+    /* copy the text out of ruby so it may be bound without the GVL */
+    for ( t = 0 ; t < RARRAY_LEN( collect.texts ) ; t++ ) {
+        text_length += RSTRING_LEN( rb_ary_entry( collect.texts, t ) );
+    }
+    text = ALLOCV( text_buf, text_length + 1 );
+    for ( i = 0, t = 0 ; i < collect.count ; i++ ) {
+        if ( SQLITE_TEXT == collect.bvs[i].type ) {
+            VALUE str = rb_ary_entry( collect.texts, t++ );
+            memcpy( text, RSTRING_PTR( str ), RSTRING_LEN( str ) );
+            collect.bvs[i].text = text;
+            text += RSTRING_LEN( str );
+        }
+    }
+
+    args.bvs     = collect.bvs;
+    args.done    = 0;
+    args.changes = 0;
+    args.rc      = SQLITE_OK;
+
+    sqlite3_reset( am_stmt->stmt );
+    sqlite3_clear_bindings( am_stmt->stmt );
+    amalgalite_call_without_gvl( am_sqlite3_statement_execute_rows_func, &args, sqlite3_db_handle( am_stmt->stmt ) );
+
+    ALLOCV_END( text_buf );
+    ALLOCV_END( bvs_buf );
+    RB_GC_GUARD( collect.texts );
+
+    if ( SQLITE_OK != args.rc ) {
+        rb_raise(eAS_Error, "Failure executing row %ld of the batch : [SQLITE_ERROR %d] : %s\n",
+                args.done, args.rc, args.errmsg );
+    }
+
+    return rb_assoc_new( LL2NUM( args.changes ), LONG2NUM( args.done ) );
+}
+
+/*
+ * Build the table of parameter name => index for a freshly prepared
+ * statement.  Each name is in the table both as a String and as a Symbol.
+ */
+void am_sqlite3_statement_index_parameters( am_sqlite3_stmt *am_stmt )
+{
+    int         count = sqlite3_bind_parameter_count( am_stmt->stmt );
+    int         i;
+    const char *name;
+    VALUE       table = Qnil;
+
+    for ( i = 1 ; i <= count ; i++ ) {
+        name = sqlite3_bind_parameter_name( am_stmt->stmt, i );
+        if ( NULL == name ) { continue; }
+        if ( Qnil == table ) { table = rb_hash_new( ); }
+        rb_hash_aset( table, rb_obj_freeze( rb_str_new2( name ) ), INT2FIX( i ) );
+        rb_hash_aset( table, ID2SYM( rb_intern( name ) ), INT2FIX( i ) );
+    }
+
+    if ( Qnil != table ) {
+        am_stmt->parameter_indexes = rb_obj_freeze( table );
+        rb_gc_register_address( &(am_stmt->parameter_indexes) );
+    }
+}
+
+/**
+ * call-seq:
+ *    stmt.parameter_indexes -> Hash
+ *
+ * returns the frozen Hash of named parameter => index built when the
+ * statement was prepared.  Each name is a key both as a String and as a
+ * Symbol.
+ */
+VALUE am_sqlite3_statement_parameter_indexes(VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+    if ( Qnil == am_stmt->parameter_indexes ) {
+        return rb_hash_new( );
+    }
+    return am_stmt->parameter_indexes;
+}
+
 /**
  * call-seq:
  *    stmt.remaining_sql -> String
@@ -244,6 +709,7 @@ VALUE am_sqlite3_statement_reset(VALUE self)
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
     if ( am_stmt->stmt ) {
         rc = sqlite3_reset( am_stmt->stmt );
+        amalgalite_raise_callback_error( );
         if ( rc != SQLITE_OK ) {
             rb_raise(eAS_Error, "Error resetting statement: [SQLITE_ERROR %d] : %s\n",
                     rc, sqlite3_errmsg( sqlite3_db_handle( am_stmt->stmt) ));
@@ -275,6 +741,64 @@ VALUE am_sqlite3_statement_clear_bindings(VALUE self)
 }
 
 
+/*
+ * sqlite3_step() as a function that may be invoked without the GVL
+ */
+static void* am_sqlite3_statement_step_func( void *stmt )
+{
+    return (void*)(intptr_t) sqlite3_step( (sqlite3_stmt*) stmt );
+}
+
+/*
+ * Step the statement with the GVL released so that other ruby threads may run
+ * while SQLite is working.
+ */
+int am_sqlite3_statement_step_without_gvl( sqlite3_stmt *stmt )
+{
+    return (int)(intptr_t) amalgalite_call_without_gvl( am_sqlite3_statement_step_func,
+                                                        (void*)stmt, sqlite3_db_handle( stmt ) );
+}
+
+/*
+ * Step the statement without the GVL, counting the rows it returns.  SQLite
+ * prepares the statement again within the step if the schema has changed, in
+ * which case its columns may no longer match the conversion plan it was given
+ * and am_stmt->reprepared is set.
+ */
+static int am_sqlite3_statement_step_counted( am_sqlite3_stmt *am_stmt )
+{
+    int rc = am_sqlite3_statement_step_without_gvl( am_stmt->stmt );
+    int reprepares = sqlite3_stmt_status( am_stmt->stmt, SQLITE_STMTSTATUS_REPREPARE, 0 );
+
+    if ( reprepares != am_stmt->reprepares ) {
+        am_stmt->reprepares = reprepares;
+        am_stmt->reprepared = 1;
+    }
+    if ( SQLITE_ROW == rc ) {
+        am_stmt->rows++;
+    }
+    return rc;
+}
+
+/**
+ * call-seq:
+ *    stmt.reprepared? -> true or false
+ *
+ * Has SQLite prepared the statement again, because the schema changed, since
+ * this was last asked.  The rows stepped since then were stored without
+ * their conversion plan, and the result columns must be looked at again.
+ */
+VALUE am_sqlite3_statement_is_reprepared(VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+    int               reprepared;
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+    reprepared = am_stmt->reprepared;
+    am_stmt->reprepared = 0;
+    return reprepared ? Qtrue : Qfalse;
+}
+
 /**
  * call-seq:
  *    stmt.step -> int
@@ -287,7 +811,534 @@ VALUE am_sqlite3_statement_step(VALUE self)
     am_sqlite3_stmt  *am_stmt;
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
-    return INT2FIX( sqlite3_step( am_stmt->stmt ) );
+    return INT2FIX( am_sqlite3_statement_step_counted( am_stmt ) );
+}
+
+/*
+ * The TEXT value of column idx of the current row of stmt as a UTF-8 String
+ * of the length SQLite already knows.  If interned is true the value is the
+ * frozen, deduplicated String from the ruby fstring table, so repeated values
+ * share one String and only the first occurrence allocates.
+ */
+static VALUE am_sqlite3_statement_column_text_value( sqlite3_stmt *stmt, int idx, int interned )
+{
+    const char *text   = (const char*)sqlite3_column_text( stmt, idx );
+    long        length = sqlite3_column_bytes( stmt, idx );
+
+    if ( NULL == text ) {
+        return rb_utf8_str_new( "", 0 );
+    }
+    if ( interned ) {
+        return rb_enc_interned_str( text, length, rb_utf8_encoding() );
+    }
+    return rb_utf8_str_new( text, length );
+}
+
+/*
+ * A column name, or any other metadata String SQLite hands out, as a frozen
+ * UTF-8 String shared with every other statement, or nil.
+ */
+static VALUE am_sqlite3_statement_name_value( const char *name )
+{
+    return ( NULL == name ) ? Qnil : rb_enc_interned_str_cstr( name, rb_utf8_encoding() );
+}
+
+/*
+ * Convert the value in column idx of the current result row to the
+ * appropriate ruby object based upon the sqlite storage class of the value.
+ */
+static VALUE am_sqlite3_statement_column_value( sqlite3_stmt *stmt, int idx, int type )
+{
+    switch ( type ) {
+        case SQLITE_INTEGER:
+            return SQLINT64_2NUM( sqlite3_column_int64( stmt, idx ) );
+        case SQLITE_FLOAT:
+            return rb_float_new( sqlite3_column_double( stmt, idx ) );
+        case SQLITE_TEXT:
+            return am_sqlite3_statement_column_text_value( stmt, idx, 0 );
+        case SQLITE_BLOB:
+            return rb_str_new( (const char*)sqlite3_column_blob( stmt, idx ),
+                               sqlite3_column_bytes( stmt, idx ) );
+        case SQLITE_NULL:
+        default:
+            return Qnil;
+    }
+}
+
+/*
+ * Apply one entry of a conversion plan to a raw value whose SQLite storage
+ * class is type.  The entry is one of:
+ *
+ *   nil       - the value is used as is
+ *   :to_s     - every value is converted to a String, nil becomes ""
+ *   :float    - TEXT values are converted with Kernel#Float
+ *   :integer  - TEXT values are converted with Kernel#Float and truncated
+ *   :date, :datetime, :time
+ *             - TEXT values are parsed into a Date, DateTime or Time
+ *   :intern   - TEXT values are interned, see #step_row
+ *   otherwise - the entry is called with the value
+ *
+ * BLOB values are never converted here, they are left to the ruby side so it
+ * can wrap them in an Amalgalite::Blob.
+ */
+static VALUE am_sqlite3_statement_convert_value( VALUE value, int type, VALUE conversion )
+{
+    ID    id;
+    VALUE result;
+
+    if ( ( Qnil == conversion ) || ( SQLITE_BLOB == type ) ) {
+        return value;
+    }
+
+    if ( SYMBOL_P( conversion ) ) {
+        id = SYM2ID( conversion );
+        if ( id == id_to_s ) {
+            if ( SQLITE_TEXT == type ) { return value; }
+            if ( SQLITE_NULL == type ) { return rb_str_new( "", 0 ); }
+            return rb_funcall( value, id_to_s, 0 );
+        } else if ( id == id_float ) {
+            return ( SQLITE_TEXT == type ) ? rb_Float( value ) : value;
+        } else if ( id == id_integer ) {
+            return ( SQLITE_TEXT == type ) ? rb_dbl2big( trunc( RFLOAT_VALUE( rb_Float( value ) ) ) ) : value;
+        } else if ( id == id_intern ) {
+            return ( ( SQLITE_TEXT == type ) && RB_TYPE_P( value, T_STRING ) ) ? rb_str_to_interned_str( value ) : value;
+        } else if ( am_sqlite3_datetime_conversion( value, id, &result ) ) {
+            return result;
+        }
+        rb_raise( rb_eArgError, "Unknown conversion :%s", rb_id2name( id ) );
+    }
+
+    return rb_funcall( conversion, id_call, 1, value );
+}
+
+/*
+ * Does one entry of a conversion plan leave INTEGER and FLOAT values as they
+ * are, so that a column converted with it may be packed
+ */
+static int am_sqlite3_statement_conversion_keeps_numbers( VALUE conversion )
+{
+    ID id;
+
+    if ( Qnil == conversion ) {
+        return 1;
+    }
+    if ( !SYMBOL_P( conversion ) ) {
+        return 0;
+    }
+    id = SYM2ID( conversion );
+    return ( id == id_float ) || ( id == id_integer ) || ( id == id_intern );
+}
+
+/*
+ * The value of column idx of the current row of stmt, of SQLite storage class
+ * type, converted with one entry of a conversion plan.  TEXT values of an
+ * :intern column are interned straight from SQLite without allocating a
+ * String first.
+ */
+static VALUE am_sqlite3_statement_converted_column_value( sqlite3_stmt *stmt, int idx, int type, VALUE conversion )
+{
+    if ( ( SQLITE_TEXT == type ) && SYMBOL_P( conversion ) && ( SYM2ID( conversion ) == id_intern ) ) {
+        return am_sqlite3_statement_column_text_value( stmt, idx, 1 );
+    }
+    return am_sqlite3_statement_convert_value( am_sqlite3_statement_column_value( stmt, idx, type ), type, conversion );
+}
+
+/*
+ * store every column value of the current row of stmt into the values Array,
+ * and their SQLite3::DataType into the types Array if it is not nil.  If plan
+ * is not nil then each value is converted with the matching entry in plan.
+ */
+static void am_sqlite3_statement_store_row( sqlite3_stmt *stmt, VALUE values, VALUE types, VALUE plan )
+{
+    int   i, type;
+    int   count = sqlite3_column_count( stmt );
+    VALUE value;
+
+    for ( i = 0 ; i < count ; i++ ) {
+        type  = sqlite3_column_type( stmt, i );
+        if ( Qnil != plan ) {
+            value = am_sqlite3_statement_converted_column_value( stmt, i, type, rb_ary_entry( plan, i ) );
+        } else {
+            value = am_sqlite3_statement_column_value( stmt, i, type );
+        }
+        rb_ary_store( values, i, value );
+        if ( Qnil != types ) {
+            rb_ary_store( types, i, INT2FIX( type ) );
+        }
+    }
+}
+
+/**
+ * call-seq:
+ *    stmt.convert_values( values, types, plan ) -> values
+ *
+ * Convert, in place, the raw +values+ whose SQLite3::DataType are in +types+
+ * with +plan+.  If +plan+ is an Array then it holds one conversion per value,
+ * otherwise it is the one conversion used for every value.  See #step_row for
+ * the conversions.
+ */
+VALUE am_sqlite3_statement_convert_values(VALUE self, VALUE values, VALUE types, VALUE plan)
+{
+    long  i;
+    int   per_value;
+    VALUE conversion;
+
+    Check_Type( values, T_ARRAY );
+    Check_Type( types,  T_ARRAY );
+    per_value = ( T_ARRAY == TYPE( plan ) );
+
+    for ( i = 0 ; i < RARRAY_LEN( values ) ; i++ ) {
+        conversion = per_value ? rb_ary_entry( plan, i ) : plan;
+        rb_ary_store( values, i, am_sqlite3_statement_convert_value( rb_ary_entry( values, i ),
+                                                                     NUM2INT( rb_ary_entry( types, i ) ),
+                                                                     conversion ) );
+    }
+    return values;
+}
+
+/*
+ * Make one instance of klass from the Array of values of a row.  Struct
+ * subclasses are filled positionally by rb_struct_alloc, every other class is
+ * sent new with the values as positional arguments.
+ */
+static VALUE am_sqlite3_statement_instantiate_row( VALUE klass, int is_struct, VALUE values )
+{
+    Check_Type( values, T_ARRAY );
+    if ( is_struct ) {
+        return rb_struct_alloc( klass, values );
+    }
+    return rb_funcallv( klass, id_new, (int)RARRAY_LEN( values ), RARRAY_CONST_PTR( values ) );
+}
+
+/**
+ * call-seq:
+ *    stmt.instantiate_rows( rows, klass ) -> rows
+ *
+ * Replace, in place, each Array of values in +rows+ with an instance of
+ * +klass+ made from those values positionally, as if by
+ * <tt>klass.new( *values )</tt>.  Struct subclasses are filled directly
+ * without going through a ruby level splat.
+ */
+VALUE am_sqlite3_statement_instantiate_rows(VALUE self, VALUE rows, VALUE klass)
+{
+    long  i;
+    int   is_struct;
+
+    Check_Type( rows, T_ARRAY );
+    Check_Type( klass, T_CLASS );
+    is_struct = RTEST( rb_class_inherited_p( klass, rb_cStruct ) );
+
+    for ( i = 0 ; i < RARRAY_LEN( rows ) ; i++ ) {
+        rb_ary_store( rows, i, am_sqlite3_statement_instantiate_row( klass, is_struct, RARRAY_AREF( rows, i ) ) );
+    }
+    return rows;
+}
+
+/**
+ * call-seq:
+ *    stmt.step_row( values, types = nil, plan = nil ) -> int
+ *
+ * Step through the next piece of the SQLite3 statement, and if the result is a
+ * row, store every column value of that row into the +values+ Array.  The
+ * values are the raw SQLite values converted to Integer, Float, String or nil.
+ * If +types+ is given it is filled with the SQLite3::DataType constant of each
+ * column value in the row.
+ *
+ * TEXT values are UTF-8 Strings.
+ *
+ * If +plan+ is given it is an Array with one conversion per column that is
+ * applied to each non BLOB value, see Amalgalite::TypeMap#result_conversion_of.
+ * A column whose conversion is :intern has its TEXT values returned as frozen
+ * Strings from the ruby fstring table, so a value repeated in many rows is
+ * one String.
+ *
+ * If +values+ is nil then this is the same as #step.
+ *
+ * Returns the result code of the step, just like #step.
+ */
+VALUE am_sqlite3_statement_step_row(int argc, VALUE *argv, VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+    VALUE             values;
+    VALUE             types;
+    VALUE             plan;
+    int               rc;
+
+    rb_scan_args( argc, argv, "12", &values, &types, &plan );
+
+    if ( Qnil != values ) { Check_Type( values, T_ARRAY ); }
+    if ( Qnil != types  ) { Check_Type( types,  T_ARRAY ); }
+    if ( Qnil != plan   ) { Check_Type( plan,   T_ARRAY ); }
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+    rc = am_sqlite3_statement_step_counted( am_stmt );
+
+    if ( ( SQLITE_ROW == rc ) && ( Qnil != values ) ) {
+        am_sqlite3_statement_store_row( am_stmt->stmt, values, types, am_stmt->reprepared ? Qnil : plan );
+    }
+
+    return INT2FIX( rc );
+}
+
+/**
+ * call-seq:
+ *    stmt.step_rows( rows, max, types = nil, plan = nil ) -> int
+ *
+ * Step through the SQLite3 statement up to +max+ times, appending a new Array
+ * of the raw column values to +rows+ for each row that is returned.  If
+ * +types+ is given then an Array of the SQLite3::DataType constants of each row
+ * is appended to it too, parallel to +rows+.  The values are converted with
+ * +plan+ as in #step_row.
+ *
+ * Returns the result code of the last step.  This is SQLITE_ROW if +max+ rows
+ * were fetched and there may be more to come, SQLITE_DONE if the statement
+ * finished, or the error code if stepping failed.  The rows fetched before the
+ * statement finished or failed are still appended to +rows+.
+ */
+VALUE am_sqlite3_statement_step_rows(int argc, VALUE *argv, VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+    VALUE             rows;
+    VALUE             max;
+    VALUE             types;
+    VALUE             plan;
+    VALUE             values;
+    VALUE             row_types = Qnil;
+    long              n, fetched;
+    int               rc = SQLITE_ROW;
+    int               count;
+
+    rb_scan_args( argc, argv, "22", &rows, &max, &types, &plan );
+
+    Check_Type( rows, T_ARRAY );
+    if ( Qnil != types ) { Check_Type( types, T_ARRAY ); }
+    if ( Qnil != plan  ) { Check_Type( plan,  T_ARRAY ); }
+
+    n = NUM2LONG( max );
+    if ( n < 0 ) {
+        rb_raise( rb_eArgError, "negative number of rows (%ld) to step", n );
+    }
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+    count = sqlite3_column_count( am_stmt->stmt );
+
+    for ( fetched = 0 ; fetched < n ; fetched++ ) {
+        rc = am_sqlite3_statement_step_counted( am_stmt );
+        if ( SQLITE_ROW != rc ) {
+            break;
+        }
+
+        values = rb_ary_new2( count );
+        if ( Qnil != types ) {
+            row_types = rb_ary_new2( count );
+            rb_ary_push( types, row_types );
+        }
+        am_sqlite3_statement_store_row( am_stmt->stmt, values, row_types, am_stmt->reprepared ? Qnil : plan );
+        rb_ary_push( rows, values );
+    }
+
+    return INT2FIX( rc );
+}
+
+/*
+ * Unpack a column of packed int64 or double values back into an Array of
+ * Integer or Float.  Used when a packed column turns out to hold a value of
+ * another type.
+ */
+static VALUE am_sqlite3_statement_unpack_column( VALUE packed, int type, VALUE column_types, VALUE conversion )
+{
+    long         i;
+    long         count = RSTRING_LEN( packed ) / 8;
+    const char  *buf   = RSTRING_PTR( packed );
+    VALUE        column = rb_ary_new2( count );
+    VALUE        value;
+    sqlite3_int64 i64;
+    double        d;
+
+    for ( i = 0 ; i < count ; i++ ) {
+        if ( SQLITE_INTEGER == type ) {
+            memcpy( &i64, buf + ( i * 8 ), 8 );
+            value = SQLINT64_2NUM( i64 );
+        } else {
+            memcpy( &d, buf + ( i * 8 ), 8 );
+            value = rb_float_new( d );
+        }
+        rb_ary_push( column, am_sqlite3_statement_convert_value( value, type, conversion ) );
+        rb_ary_push( column_types, INT2FIX( type ) );
+    }
+    return column;
+}
+
+/**
+ * call-seq:
+ *    stmt.step_columns( columns, types, pack = true, plan = nil ) -> int
+ *
+ * Step through all the remaining rows of the SQLite3 statement gathering the
+ * raw values column by column.  After stepping, +columns+ holds one entry per
+ * result column and +types+ holds the matching SQLite3::DataType information.
+ *
+ * If +pack+ is true and every value in a column is an INTEGER, then the
+ * column is a binary String of native endian 64 bit integers, as in
+ * String#unpack( "q*" ).  If every value is a FLOAT then it is a binary String
+ * of native doubles, as in String#unpack( "d*" ).  The entry in +types+ for a
+ * packed column is the DataType it was packed as.  Only columns whose entry
+ * in +plan+ leaves numbers as they are, nil, :float, :integer or :intern, are
+ * packed.
+ *
+ * Every other column is an Array of the values, converted with +plan+ as in
+ * #step_row, and its entry in +types+ is an Array of the DataType of each
+ * value.
+ *
+ * Returns the result code of the last step, SQLITE_DONE unless there was an
+ * error.
+ */
+VALUE am_sqlite3_statement_step_columns(int argc, VALUE *argv, VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+    VALUE             columns;
+    VALUE             types;
+    VALUE             pack;
+    VALUE             plan;
+    VALUE             column;
+    VALUE             column_types;
+    VALUE             conversion;
+    int               do_pack;
+    int               rc;
+    int               i, count, type, packed;
+    sqlite3_int64     i64;
+    double            d;
+
+    rb_scan_args( argc, argv, "22", &columns, &types, &pack, &plan );
+
+    Check_Type( columns, T_ARRAY );
+    Check_Type( types,   T_ARRAY );
+    if ( Qnil != plan ) { Check_Type( plan, T_ARRAY ); }
+    do_pack = ( argc < 3 ) || RTEST( pack );
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+
+    /* the columns are only known after the first step, which may have
+     * prepared the statement again */
+    rc    = am_sqlite3_statement_step_counted( am_stmt );
+    count = sqlite3_column_count( am_stmt->stmt );
+    if ( am_stmt->reprepared ) {
+        plan = Qnil;
+    }
+
+    for ( i = 0 ; i < count ; i++ ) {
+        rb_ary_store( columns, i, rb_ary_new() );
+        rb_ary_store( types, i, rb_ary_new() );
+    }
+
+    for ( ; SQLITE_ROW == rc ; rc = am_sqlite3_statement_step_counted( am_stmt ) ) {
+        for ( i = 0 ; i < count ; i++ ) {
+            type         = sqlite3_column_type( am_stmt->stmt, i );
+            column       = RARRAY_AREF( columns, i );
+            column_types = RARRAY_AREF( types, i );
+            packed       = FIXNUM_P( column_types ) ? FIX2INT( column_types ) : 0;
+            conversion   = ( Qnil == plan ) ? Qnil : rb_ary_entry( plan, i );
+
+            /* the first value of a column decides if it starts out packed */
+            if ( do_pack && !packed && ( 0 == RARRAY_LEN( column ) ) &&
+                 ( ( SQLITE_INTEGER == type ) || ( SQLITE_FLOAT == type ) ) &&
+                 am_sqlite3_statement_conversion_keeps_numbers( conversion ) ) {
+                column = rb_str_buf_new( 8 * 64 );
+                rb_ary_store( columns, i, column );
+                rb_ary_store( types, i, INT2FIX( type ) );
+                packed = type;
+            }
+
+            /* and any value of a different type unpacks it again */
+            if ( packed && ( packed != type ) ) {
+                column_types = rb_ary_new();
+                column = am_sqlite3_statement_unpack_column( column, packed, column_types, conversion );
+                rb_ary_store( columns, i, column );
+                rb_ary_store( types, i, column_types );
+                packed = 0;
+            }
+
+            if ( SQLITE_INTEGER == packed ) {
+                i64 = sqlite3_column_int64( am_stmt->stmt, i );
+                rb_str_cat( column, (const char*)&i64, 8 );
+            } else if ( SQLITE_FLOAT == packed ) {
+                d = sqlite3_column_double( am_stmt->stmt, i );
+                rb_str_cat( column, (const char*)&d, 8 );
+            } else {
+                rb_ary_push( column, am_sqlite3_statement_converted_column_value( am_stmt->stmt, i, type, conversion ) );
+                rb_ary_push( column_types, INT2FIX( type ) );
+            }
+        }
+    }
+
+    return INT2FIX( rc );
+}
+
+/* the sqlite3_stmt_status counters reported by #stats, and their names */
+const int am_statement_status_counter_ops[AM_STATEMENT_STATUS_COUNTERS] = {
+    SQLITE_STMTSTATUS_FULLSCAN_STEP,
+    SQLITE_STMTSTATUS_SORT,
+    SQLITE_STMTSTATUS_AUTOINDEX,
+    SQLITE_STMTSTATUS_VM_STEP,
+    SQLITE_STMTSTATUS_REPREPARE,
+    SQLITE_STMTSTATUS_RUN,
+    SQLITE_STMTSTATUS_FILTER_MISS,
+    SQLITE_STMTSTATUS_FILTER_HIT,
+    SQLITE_STMTSTATUS_MEMUSED,
+};
+
+const char *am_statement_status_counter_names[AM_STATEMENT_STATUS_COUNTERS] = {
+    "fullscan_step",
+    "sort",
+    "autoindex",
+    "vm_step",
+    "reprepare",
+    "run",
+    "filter_miss",
+    "filter_hit",
+    "memused",
+};
+
+/**
+ * call-seq:
+ *    stmt.stats( reset = false ) -> Hash
+ *
+ * The runtime counters of the statement, read with sqlite3_stmt_status in one
+ * call:
+ *
+ * fullscan_step:: steps forward in a full table scan
+ * sort::          sort operations
+ * autoindex::     rows inserted into automatic indexes
+ * vm_step::       virtual machine operations
+ * reprepare::     times the statement was prepared again after a schema change
+ * run::           times the statement was run
+ * filter_miss::   bloom filter checks that rejected a row
+ * filter_hit::    bloom filter checks that passed a row on
+ * memused::       bytes of heap used by the statement
+ * rows::          rows returned to ruby
+ *
+ * If +reset+ is true the counters, all but memused, are set back to 0.
+ */
+VALUE am_sqlite3_statement_stats(int argc, VALUE *argv, VALUE self)
+{
+    am_sqlite3_stmt  *am_stmt;
+    VALUE             reset;
+    VALUE             stats;
+    int               i;
+
+    rb_scan_args( argc, argv, "01", &reset );
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+
+    stats = rb_hash_new();
+    for ( i = 0 ; i < AM_STATEMENT_STATUS_COUNTERS ; i++ ) {
+        rb_hash_aset( stats, ID2SYM( rb_intern( am_statement_status_counter_names[i] ) ),
+                      INT2NUM( sqlite3_stmt_status( am_stmt->stmt, am_statement_status_counter_ops[i], RTEST( reset ) ) ) );
+    }
+    rb_hash_aset( stats, ID2SYM( rb_intern( "rows" ) ), SQLINT64_2NUM( am_stmt->rows ) );
+    if ( RTEST( reset ) ) {
+        am_stmt->rows       = 0;
+        am_stmt->reprepares = 0;
+    }
+    return stats;
 }
 
 /**
@@ -320,7 +1371,7 @@ VALUE am_sqlite3_statement_column_name(VALUE self, VALUE v_idx)
     
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
 
-    return rb_str_new2( sqlite3_column_name( am_stmt->stmt, idx ) );
+    return am_sqlite3_statement_name_value( sqlite3_column_name( am_stmt->stmt, idx ) );
 }
 
 
@@ -340,11 +1391,7 @@ VALUE am_sqlite3_statement_column_decltype(VALUE self, VALUE v_idx)
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
     decltype = sqlite3_column_decltype( am_stmt->stmt, idx ) ;
-    if ( NULL == decltype) {
-        return Qnil;
-    } else {
-        return rb_str_new2( decltype );
-    }
+    return am_sqlite3_statement_name_value( decltype );
 }
 
 /**
@@ -377,7 +1424,7 @@ VALUE am_sqlite3_statement_column_text(VALUE self, VALUE v_idx)
     int               idx = FIX2INT( v_idx );
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
-    return rb_str_new2( (const char*)sqlite3_column_text( am_stmt->stmt, idx ) );
+    return am_sqlite3_statement_column_text_value( am_stmt->stmt, idx, 0 );
 }
 
 /**
@@ -470,7 +1517,7 @@ VALUE am_sqlite3_statement_column_database_name(VALUE self, VALUE v_idx)
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
     n = sqlite3_column_database_name( am_stmt->stmt, idx ) ;
-    return ( n == NULL ? Qnil : rb_str_new2( n ) ); 
+    return am_sqlite3_statement_name_value( n );
 }
 
 /**
@@ -489,7 +1536,7 @@ VALUE am_sqlite3_statement_column_table_name(VALUE self, VALUE v_idx)
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
     n =  sqlite3_column_table_name( am_stmt->stmt, idx );
-    return ( n == NULL ? Qnil : rb_str_new2( n ) ); 
+    return am_sqlite3_statement_name_value( n );
 }
 
 
@@ -509,10 +1556,24 @@ VALUE am_sqlite3_statement_column_origin_name(VALUE self, VALUE v_idx)
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
     n = sqlite3_column_origin_name( am_stmt->stmt, idx );
-    return ( n == NULL ? Qnil : rb_str_new2( n ) ); 
+    return am_sqlite3_statement_name_value( n );
 }
 
 
+/**
+ * call-seq:
+ *    stmt.readonly? -> true or false
+ *
+ * Return true if the statement makes no direct changes to the database.
+ */
+VALUE am_sqlite3_statement_readonly(VALUE self)
+{
+    am_sqlite3_stmt   *am_stmt;
+
+    Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
+    return sqlite3_stmt_readonly( am_stmt->stmt ) ? Qtrue : Qfalse;
+}
+
 /**
  * call-seq:
  *    stmt.sql -> String
@@ -542,6 +1603,7 @@ VALUE am_sqlite3_statement_close( VALUE self )
 {
 
     am_sqlite3_stmt   *am_stmt;
+    sqlite3           *db;
     int                rc, existing_errcode;
 
     Data_Get_Struct(self, am_sqlite3_stmt, am_stmt);
@@ -550,14 +1612,16 @@ VALUE am_sqlite3_statement_close( VALUE self )
      * closing a statement that has an error, and in that case we do not want to
      * raise an additional error, we want to let the existing error stand
      */
-    existing_errcode = sqlite3_errcode( sqlite3_db_handle( am_stmt->stmt ) );
+    db = sqlite3_db_handle( am_stmt->stmt );
+    existing_errcode = sqlite3_errcode( db );
     rc = sqlite3_finalize( am_stmt->stmt );
+    am_stmt->stmt = NULL;
+    amalgalite_raise_callback_error( );
 
     if ( (SQLITE_OK != rc) && (rc != existing_errcode) ) {
         rb_raise(eAS_Error, "Failure to close statement : [SQLITE_ERROR %d] : %s\n",
-                rc, sqlite3_errmsg( sqlite3_db_handle( am_stmt->stmt) ));
+                rc, sqlite3_errmsg( db ));
     }
-    am_stmt->stmt = NULL;
 
     return Qnil;
 }
@@ -577,6 +1641,10 @@ void am_sqlite3_statement_free(am_sqlite3_stmt* wrapper)
         rb_gc_unregister_address( &(wrapper->remaining_sql) );
         wrapper->remaining_sql = Qnil;
     }
+    if ( Qnil != wrapper->parameter_indexes ) {
+        rb_gc_unregister_address( &(wrapper->parameter_indexes) );
+        wrapper->parameter_indexes = Qnil;
+    }
     if ( NULL != wrapper->stmt ) {
         sqlite3_finalize( wrapper->stmt );
         wrapper->stmt = NULL;
@@ -593,8 +1661,12 @@ VALUE am_sqlite3_statement_alloc(VALUE klass)
     am_sqlite3_stmt  *wrapper = ALLOC(am_sqlite3_stmt);
     VALUE             obj     = (VALUE)NULL;
 
-    wrapper->remaining_sql = Qnil;
-    wrapper->stmt          = NULL;
+    wrapper->remaining_sql     = Qnil;
+    wrapper->parameter_indexes = Qnil;
+    wrapper->stmt              = NULL;
+    wrapper->rows              = 0;
+    wrapper->reprepares        = 0;
+    wrapper->reprepared        = 0;
 
     obj = Data_Wrap_Struct(klass, NULL, am_sqlite3_statement_free, wrapper);
     return obj;
@@ -606,6 +1678,14 @@ VALUE am_sqlite3_statement_alloc(VALUE klass)
 
 void Init_amalgalite_statement( )
 {
+    id_call    = rb_intern( "call" );
+    id_to_s    = rb_intern( "to_s" );
+    id_float   = rb_intern( "float" );
+    id_integer = rb_intern( "integer" );
+    id_new     = rb_intern( "new" );
+    id_intern  = rb_intern( "intern" );
+
+    rb_gc_register_address( &cA_Blob );
 
     VALUE ma  = rb_define_module("Amalgalite");
     VALUE mas = rb_define_module_under(ma, "SQLite3");
@@ -617,7 +1697,15 @@ void Init_amalgalite_statement( )
     rb_define_alloc_func(cAS_Statement, am_sqlite3_statement_alloc); 
     rb_define_method(cAS_Statement, "sql", am_sqlite3_statement_sql, 0); 
     rb_define_method(cAS_Statement, "close", am_sqlite3_statement_close, 0); 
+    rb_define_method(cAS_Statement, "readonly?", am_sqlite3_statement_readonly, 0); 
     rb_define_method(cAS_Statement, "step", am_sqlite3_statement_step, 0); 
+    rb_define_method(cAS_Statement, "reprepared?", am_sqlite3_statement_is_reprepared, 0); /* in amalgalite_statement.c */
+    rb_define_method(cAS_Statement, "stats", am_sqlite3_statement_stats, -1); 
+    rb_define_method(cAS_Statement, "convert_values", am_sqlite3_statement_convert_values, 3); 
+    rb_define_method(cAS_Statement, "instantiate_rows", am_sqlite3_statement_instantiate_rows, 2); 
+    rb_define_method(cAS_Statement, "step_row", am_sqlite3_statement_step_row, -1); 
+    rb_define_method(cAS_Statement, "step_rows", am_sqlite3_statement_step_rows, -1); 
+    rb_define_method(cAS_Statement, "step_columns", am_sqlite3_statement_step_columns, -1); 
 
     rb_define_method(cAS_Statement, "column_count", am_sqlite3_statement_column_count, 0); 
     rb_define_method(cAS_Statement, "column_name", am_sqlite3_statement_column_name, 1); 
@@ -636,14 +1724,20 @@ void Init_amalgalite_statement( )
     rb_define_method(cAS_Statement, "clear_bindings!", am_sqlite3_statement_clear_bindings, 0); 
     rb_define_method(cAS_Statement, "parameter_count", am_sqlite3_statement_bind_parameter_count, 0); 
     rb_define_method(cAS_Statement, "parameter_index", am_sqlite3_statement_bind_parameter_index, 1); 
+    rb_define_method(cAS_Statement, "parameter_indexes", am_sqlite3_statement_parameter_indexes, 0); 
     rb_define_method(cAS_Statement, "remaining_sql", am_sqlite3_statement_remaining_sql, 0); 
     rb_define_method(cAS_Statement, "bind_text", am_sqlite3_statement_bind_text, 2); 
     rb_define_method(cAS_Statement, "bind_int", am_sqlite3_statement_bind_int, 2); 
     rb_define_method(cAS_Statement, "bind_int64", am_sqlite3_statement_bind_int64, 2); 
     rb_define_method(cAS_Statement, "bind_double", am_sqlite3_statement_bind_double, 2); 
     rb_define_method(cAS_Statement, "bind_null", am_sqlite3_statement_bind_null, 1); 
-    rb_define_method(cAS_Statement, "bind_blob", am_sqlite3_statement_bind_blob, 2); 
-    rb_define_method(cAS_Statement, "bind_zeroblob", am_sqlite3_statement_bind_zeroblob, 2); 
+    rb_define_method(cAS_Statement, "bind_blob64", am_sqlite3_statement_bind_blob, 2); 
+    rb_define_alias(cAS_Statement, "bind_blob", "bind_blob64"); 
+    rb_define_method(cAS_Statement, "bind_zeroblob64", am_sqlite3_statement_bind_zeroblob, 2); 
+    rb_define_alias(cAS_Statement, "bind_zeroblob", "bind_zeroblob64"); 
+    rb_define_method(cAS_Statement, "bind_array", am_sqlite3_statement_bind_array, 1); 
+    rb_define_method(cAS_Statement, "bind_hash", am_sqlite3_statement_bind_hash, 1); 
+    rb_define_method(cAS_Statement, "execute_rows", am_sqlite3_statement_execute_rows, 1); 
 }
 
 
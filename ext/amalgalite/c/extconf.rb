@@ -37,12 +37,9 @@ $CFLAGS += " -DSQLITE_ENABLE_SOUNDEX=1"
 $CFLAGS += " -DSQLITE_USE_ALLOCA=1"
 $CFLAGS += " -DSQLITE_OMIT_DEPRECATED=1"
 
-# we compile sqlite the same way that the installation of ruby is compiled.
-if RbConfig::MAKEFILE_CONFIG['configure_args'].include?( "--enable-pthread" ) then
-  $CFLAGS += " -DSQLITE_THREADSAFE=1"
-else
-  $CFLAGS += " -DSQLITE_THREADSAFE=0"
-end
+# every supported ruby runs its threads as native threads, and the extension
+# releases the GVL while sqlite is working, so sqlite must always be threadsafe.
+$CFLAGS += " -DSQLITE_THREADSAFE=1"
 
 # remove the -g flags  if it exists
 %w[ -ggdb\\d* -g\\d* ].each do |debug|
@@ -83,5 +80,17 @@ ignoreable_warnings.each do |warning|
   $CFLAGS += " -Wno-#{warning}"
 end
 
+# files are moved into and out of blobs with mmap and pwrite where available
+have_header( "sys/mman.h" )
+have_header( "unistd.h" )
+have_func( "pwrite", "unistd.h" )
+
+# the pool allocator of SQLite3.configure_memory keeps a cache in each thread
+have_header( "pthread.h" )
+
+# exported by the ruby vm, but not in a public header, the extension tracks the
+# GVL it releases itself where it is missing
+have_func( "ruby_thread_has_gvl_p" )
+
 subdir = RUBY_VERSION.sub(/\.\d+\z/,'')
 create_makefile("amalgalite/#{subdir}/amalgalite")
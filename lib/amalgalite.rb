@@ -37,12 +37,15 @@ require 'amalgalite/database'
 require 'amalgalite/function'
 require 'amalgalite/index'
 require 'amalgalite/memory_database'
+require 'amalgalite/open_metrics'
 require 'amalgalite/paths'
+require 'amalgalite/pool'
 require 'amalgalite/profile_tap'
 require 'amalgalite/progress_handler'
 require 'amalgalite/schema'
 require 'amalgalite/sqlite3'
 require 'amalgalite/statement'
+require 'amalgalite/statement_cache'
 require 'amalgalite/table'
 require 'amalgalite/taps'
 require 'amalgalite/trace_tap'
@@ -90,6 +90,7 @@ module Amalgalite
       end
 
       @source                  = nil
+      @file                    = nil
       @source_length           = 0
       @close_source_after_read = false
       @incremental             = true
@@ -99,6 +100,7 @@ module Amalgalite
       raise Blob::Error, "A :column parameter is required for a Blob" unless @column or params.has_key?( :string )
 
       if params.has_key?( :file ) then
+        @file   = params[:file]
         @source = File.open( params[:file], "r" )
         @length = File.size( params[:file] )
         @close_source_after_read = true
@@ -134,7 +136,13 @@ module Amalgalite
     # Write the Blob to an IO object
     #
     def write_to_io( io )
-      if source.respond_to?( :read ) then
+      if source.kind_of?( SQLite3::Blob ) then
+        # read every block into the same buffer
+        buf = String.new( capacity: block_size )
+        while source.read( block_size, buf ) do
+          io.write( buf )
+        end
+      elsif source.respond_to?( :read ) then
         while buf = source.read( block_size ) do
           io.write( buf )
         end
@@ -166,21 +174,88 @@ module Amalgalite
     ##
     # Write the Blob contents to a File.  
     #
+    # A database blob written to a new file is exported by the extension
+    # straight from SQLite into the file.
+    #
     def write_to_file( filename, modestring="w" )
+      if source.kind_of?( SQLite3::Blob ) and modestring == "w" then
+        source.export_file( filename )
+        source.close if close_source_after_read?
+        return
+      end
       File.open(filename, modestring) do |f|
         write_to_io( f )
       end
     end
 
     ##
-    # Write the Blob contents to the column.  This assumes that the row_id to
-    # insert into is the last row that was inserted into the db
+    # Write the Blob contents to the column of each of the rows +rowids+, by
+    # default the last row inserted into the db.  A :file Blob is imported by
+    # the extension, which maps the file and writes it to the column without
+    # going through ruby.  Writing to more than one row needs a :file Blob or
+    # a source that can be rewound.
     #
-    def write_to_column!
-      last_rowid = column.schema.db.last_insert_rowid
-      SQLite3::Blob.new( column.schema.db.api, column.db, column.table, column.name, last_rowid, "w" ) do |sqlite_blob|
-        write_to_io( sqlite_blob )
+    # +handles+ is an optional Hash of the SQLite3::Blob handles to reuse.  A
+    # handle for the column is moved to each row with SQLite3::Blob#reopen,
+    # and one opened here is added to the Hash and left open for the caller
+    # to close.
+    #
+    def write_to_column!( rowids = nil, handles = nil )
+      db = column.schema.db
+      Array( rowids || db.last_insert_rowid ).each_with_index do |rowid, i|
+        rewind_source unless i.zero?
+        sqlite_blob = handle_for( db, rowid, handles )
+        begin
+          write_contents_to( sqlite_blob )
+        ensure
+          sqlite_blob.close unless handles
+        end
+      end
+    ensure
+      source.close if close_source_after_read?
+    end
+
+    private
+
+    ##
+    # An SQLite3::Blob opened for writing to the column of +rowid+
+    #
+    def handle_for( db, rowid, handles )
+      key = [ column.db, column.table, column.name ]
+      if handles and handle = handles.delete( key ) then
+        begin
+          return handles[key] = handle.reopen( rowid )
+        rescue ::Amalgalite::SQLite3::Error
+          handle.close
+        end
       end
+      handle = SQLite3::Blob.new( db.api, column.db, column.table, column.name, rowid, "w" )
+      handles[key] = handle if handles
+      return handle
+    end
+
+    ##
+    # Write all of the source to the SQLite3::Blob +sqlite_blob+
+    #
+    def write_contents_to( sqlite_blob )
+      if @file then
+        sqlite_blob.import_file( @file )
+      elsif source.respond_to?( :read ) then
+        while buf = source.read( block_size ) do
+          sqlite_blob.write( buf )
+        end
+      else
+        sqlite_blob.write( source.to_s )
+      end
+    end
+
+    ##
+    # Go back to the start of the source to write it again
+    #
+    def rewind_source
+      return if @file
+      raise Blob::Error, "The source of the Blob cannot be rewound to write it to another row" unless source.respond_to?( :rewind )
+      source.rewind
     end
   end
 end
@@ -23,9 +23,7 @@ module Amalgalite
     def run
       @database.transaction do |db|
         db.prepare( insert_sql ) do |stmt|
-          ::CSV.foreach( @csv_path, "r:#{@encoding}", **@options ) do |row|
-            stmt.execute( row )
-          end
+          stmt.execute_many( ::CSV.foreach( @csv_path, "r:#{@encoding}", **@options ) )
         end
       end
     end
@@ -87,6 +87,10 @@ module Amalgalite
       "w+" => Open::READWRITE | Open::CREATE,
     }
 
+    # the options of Database.new applied by SQLite3::Database.open as soon as
+    # the database is opened
+    OPEN_SETTINGS = [ :journal_mode, :synchronous, :mmap_size, :cache_size, :temp_store, :busy_timeout ]
+
     # the low level Amalgalite::SQLite3::Database
     attr_reader :api
 
@@ -106,6 +110,10 @@ module Amalgalite
     # A list of the user defined aggregates
     attr_reader :aggregates
 
+    # The StatementCache used by #execute, #first_row_from, #pragma and the
+    # transaction methods
+    attr_reader :statement_cache
+
     ##
     # Create a new Amalgalite database
     #
@@ -135,6 +143,29 @@ module Amalgalite
     # *NOTE* Currently :utf16 is not supported by Amalgalite, it is planned 
     # for a later release
     #
+    # * :statement_cache_size  the number of prepared statements kept in the
+    #   #statement_cache, StatementCache::DEFAULT_CAPACITY by default.  0
+    #   disables the cache.
+    #
+    # How the database is opened:
+    #
+    # * :uri        the filename may be a file: URI, with query parameters such
+    #   as mode=ro or cache=shared.
+    # * :immutable  the database file cannot change while it is open, so
+    #   SQLite reads it without any locking or change detection.  Only for
+    #   read only reference data, best with the "r" mode.
+    # * :nomutex    the connection does not take its own mutex.  Only safe if
+    #   the Database is never used from more than one thread.
+    #
+    # And the settings applied as soon as it is open, in a single call into
+    # the extension:
+    #
+    # * :busy_timeout  milliseconds to wait for a lock before raising BUSY
+    # * :journal_mode, :synchronous, :mmap_size, :cache_size, :temp_store
+    #   the values of the PRAGMAs of the same name, for example
+    #
+    #     Amalgalite::Database.new( "reference.db", "r", :immutable => true, :mmap_size => 256 * 1024 * 1024 )
+    #     Amalgalite::Database.new( "jobs.db", "w+", :journal_mode => "wal", :synchronous => "normal", :busy_timeout => 5000 )
     #
     def initialize( filename, mode = "w+", opts = {})
       @open           = false
@@ -144,6 +175,8 @@ module Amalgalite
       @functions      = Hash.new 
       @aggregates     = Hash.new
       @utf16          = false
+      @rowid_columns  = {}
+      @row_classes    = {}
 
       unless VALID_MODES.keys.include?( mode ) 
         raise InvalidModeError, "#{mode} is invalid, must be one of #{VALID_MODES.keys.join(', ')}" 
@@ -152,8 +185,14 @@ module Amalgalite
       if not File.exist?( filename ) and opts[:utf16] then
         raise NotImplementedError, "Currently Amalgalite has not implemented utf16 support"
       else
-        @api = Amalgalite::SQLite3::Database.open( filename, VALID_MODES[mode] )
+        flags    = VALID_MODES[mode]
+        flags   |= Open::URI     if opts[:uri] or opts[:immutable]
+        flags   |= Open::NOMUTEX if opts[:nomutex]
+        filename = immutable_uri( filename, opts[:uri] ) if opts[:immutable]
+        settings = opts.select { |key, _| OPEN_SETTINGS.include?( key ) }
+        @api = Amalgalite::SQLite3::Database.open( filename, flags, ( settings.empty? ? nil : settings ) )
       end
+      @statement_cache = StatementCache.new( self, opts.fetch( :statement_cache_size, StatementCache::DEFAULT_CAPACITY ) )
       @open = true
     end
 
@@ -169,6 +208,8 @@ module Amalgalite
     #
     def close
       if open? then
+        @statement_cache.clear
+        @rowid_columns.clear
         @api.close
         @open = false
       end
@@ -275,7 +316,37 @@ module Amalgalite
     end
 
     ##
-    # Execute a single SQL statement. 
+    # Insert or update many rows holding incremental Blobs in one transaction.
+    # Each of +rows+ is the bind parameters for one execution of +sql+, see
+    # Statement#execute_many.  The Blobs are streamed into their rows through
+    # one SQLite3::Blob handle per column, moved from row to row, and the rows
+    # are bound and stepped +batch_size+ at a time.
+    #
+    # The load is atomic, if any row fails none of them are kept.  Inside a
+    # transaction the load is made in a savepoint, so a failure only undoes the
+    # load, and the rows are committed with the enclosing transaction.
+    #
+    #   column = db.schema.tables['files'].columns['data']
+    #   db.ingest_blobs( "INSERT INTO files(name, data) VALUES( ?, ? )",
+    #                    paths.map { |p| [ p, Amalgalite::Blob.new( :file => p, :column => column ) ] } )
+    #
+    # Returns the total number of rows changed.
+    #
+    def ingest_blobs( sql, rows, batch_size: Statement::EXECUTE_MANY_BATCH_SIZE )
+      changes = 0
+      load = proc do
+        prepare( sql ) { |stmt| changes = stmt.execute_many( rows, batch_size: batch_size ) }
+      end
+      if in_transaction? then
+        savepoint( "amalgalite_ingest_blobs", &load )
+      else
+        transaction( &load )
+      end
+      return changes
+    end
+
+    ##
+    # Execute a single SQL statement.
     #
     # If called with a block and there are result rows, then they are iteratively
     # yielded to the block.
@@ -291,8 +362,26 @@ module Amalgalite
     # This is just a wrapper around the preparation of an Amalgalite Statement and
     # iterating over the results.
     #
-    def execute( sql, *bind_params )
-      stmt = prepare( sql )
+    def execute( sql, *bind_params, &block )
+      execute_with( {}, sql, *bind_params, &block )
+    end
+
+    ##
+    # :call-seq:
+    #   db.execute_with( options, sql, *bind_params ) -> Array
+    #   db.execute_with( options, sql, *bind_params ) { |row| ... }
+    #
+    # Exactly like #execute, with the row options in the +options+ Hash.  +:as+
+    # says what each row is returned as, see Statement#row_type=, and
+    # +:intern+ lists the columns whose values are interned, see
+    # Statement#intern_columns=.  The options are kept apart from the bind
+    # parameters, so named parameters such as :as are still bound by #execute.
+    #
+    #   db.execute_with( { as: :struct }, "SELECT name, two_letter FROM country" ).first.name
+    #
+    def execute_with( options, sql, *bind_params )
+      stmt = @statement_cache.checkout( sql )
+      stmt.apply_row_options( options )
       stmt.bind( *bind_params )
       if block_given? then
         stmt.each { |row| yield row }
@@ -300,7 +389,23 @@ module Amalgalite
         return stmt.all_rows
       end
     ensure
-      stmt.close if stmt
+      @statement_cache.checkin( sql, stmt ) if stmt
+    end
+
+    ##
+    # Execute a single SQL statement and return the results column by column,
+    # as a Hash of field name to column.  See Statement#columns for the details
+    # of packed numeric columns.
+    #
+    #   cols = db.execute_columnar( "SELECT id, price FROM items WHERE qty > ?", 10 )
+    #   ids  = cols['id'].unpack( "q*" )
+    #
+    def execute_columnar( sql, *bind_params, pack: true )
+      stmt = @statement_cache.checkout( sql )
+      stmt.bind( *bind_params )
+      return stmt.columns( pack: pack )
+    ensure
+      @statement_cache.checkin( sql, stmt ) if stmt
     end
 
     ##
@@ -326,6 +431,36 @@ module Amalgalite
       return count
     end
 
+    ##
+    # call-seq:
+    #   db.statement_stats( reset = false ) -> Array of Hash
+    #
+    # The runtime counters of every open statement of the connection, the
+    # ones in the statement_cache included, in one call.  Each Hash has the
+    # counters of Statement#stats, except :rows, and the :sql and :busy state
+    # of the statement.  For instance, to find the statements not using an
+    # index:
+    #
+    #   db.statement_stats.select { |s| s[:fullscan_step] > 0 or s[:autoindex] > 0 }
+    #
+    def statement_stats( reset = false )
+      @api.statement_stats( reset )
+    end
+
+    ##
+    # call-seq:
+    #   db.configure_lookaside( slot_size, slot_count )
+    #
+    # Give this connection +slot_count+ lookaside memory slots of +slot_size+
+    # bytes, which SQLite uses for small, short lived allocations instead of
+    # the heap.  It fails if the lookaside memory is in use, so call it before
+    # using the database.  See SQLite3.configure_memory for the default of
+    # all connections.
+    #
+    def configure_lookaside( slot_size, slot_count )
+      @api.configure_lookaside( slot_size, slot_count )
+    end
+
     ## 
     # Execute a batch of statements via sqlite3_exec. This does the same as
     # execute_batch, but doesn't update the statement statistics.
@@ -348,12 +483,22 @@ module Amalgalite
     #
     # It is in all other was, exactly like #execute()
     #
-    def first_row_from( sql, *bind_params ) 
-      stmt = prepare( sql )
+    def first_row_from( sql, *bind_params )
+      first_row_with( {}, sql, *bind_params )
+    end
+
+    ##
+    # Exactly like #first_row_from, with the row options in the +options+
+    # Hash, see #execute_with
+    #
+    def first_row_with( options, sql, *bind_params )
+      stmt = @statement_cache.checkout( sql )
+      stmt.apply_row_options( options )
       stmt.bind( *bind_params)
       row = stmt.next_row || []
-      stmt.close
       return row
+    ensure
+      @statement_cache.checkin( sql, stmt ) if stmt
     end
 
     ##
@@ -422,6 +567,59 @@ module Amalgalite
       @trace_tap.trace( 'registered as trace tap' )
     end
 
+    ##
+    # call-seq:
+    #   db.collect_query_stats = true
+    #
+    # Turn on or off the collection of statistics for every statement run on
+    # this connection.  The statistics are aggregated by the extension, without
+    # calling into ruby, under the fingerprint of each statement, its sql with
+    # the literal values replaced by '?'.  Turning collection off keeps what
+    # has been collected so far.
+    #
+    def collect_query_stats=( flag )
+      @api.collect_query_stats = flag
+    end
+
+    ##
+    # Are statement statistics being collected
+    #
+    def collect_query_stats?
+      @api.collect_query_stats?
+    end
+
+    ##
+    # call-seq:
+    #   db.query_stats -> Array of rows
+    #
+    # A snapshot of the statement statistics, the most expensive statements
+    # first.  Each row has the columns:
+    #
+    # fingerprint::    the normalized sql of the statements
+    # calls::          the number of times they were run
+    # total_time::     the total wall clock time they took, in nanoseconds
+    # min_time::       the shortest run
+    # max_time::       the longest run
+    # mean_time::      the average run
+    # rows::           the total number of rows they returned
+    # fullscan_steps:: the total number of steps forward in a full table scan
+    #
+    # The same statistics may be queried in SQL from the
+    # amalgalite_query_stats virtual table.
+    #
+    #   db.execute( "SELECT fingerprint, calls FROM amalgalite_query_stats WHERE fullscan_steps > 0" )
+    #
+    def query_stats
+      execute( "SELECT * FROM amalgalite_query_stats ORDER BY total_time DESC" )
+    end
+
+    ##
+    # Forget all the statement statistics collected so far
+    #
+    def reset_query_stats!
+      @api.reset_query_stats
+    end
+
     ##
     # call-seq:
     #   db.type_map = DefaultMap.new
@@ -445,16 +643,84 @@ module Amalgalite
     #   db.schema( dbname = "main" ) -> Schema
     #
     # Returns a Schema object containing the table and column structure of the
-    # database.
+    # database.  If the schema has changed since it was loaded, only the tables
+    # that changed are reloaded.
     #
     def schema( dbname = "main" )
       @schema ||= ::Amalgalite::Schema.new( self, dbname )
       if @schema and @schema.dirty?
-        reload_schema!( dbname )
+        @schema.refresh!
       end
       return @schema
     end
 
+    ##
+    # :call-seq:
+    #   db.unique_field_names( fields ) -> Array
+    #
+    # The names of +fields+ as Strings, with each name that repeats an earlier
+    # one given the number of its occurrence, as in 'name', 'name_2',
+    # 'name_3'.  A number is skipped if a field already has that name.
+    #
+    def unique_field_names( fields )
+      names  = fields.map { |field| field.to_s }
+      taken  = names.uniq
+      counts = Hash.new( 0 )
+      names.map do |name|
+        counts[name] += 1
+        next name if counts[name] == 1
+        unique = "#{name}_#{counts[name]}"
+        unique = "#{name}_#{counts[name] += 1}" while taken.include?( unique )
+        taken << unique
+        unique
+      end
+    end
+
+    ##
+    # :call-seq:
+    #   db.row_class_for( kind, fields ) -> Class
+    #
+    # The Struct, or Data if +kind+ is :data, subclass used for rows of a
+    # result with the Array of +fields+.  One class is generated for each
+    # result shape and kept for the life of the Database.  Repeated field
+    # names are made unique with #unique_field_names, as in 'name_2'.
+    #
+    def row_class_for( kind, fields )
+      @row_classes[[ kind, fields ]] ||= begin
+        members = unique_field_names( fields ).map { |name| name.to_sym }
+        case kind
+        when :struct
+          ::Struct.new( *members )
+        when :data
+          raise Amalgalite::Error, "Data rows need a ruby with Data.define" unless defined?( ::Data ) and ::Data.respond_to?( :define )
+          ::Data.define( *members )
+        else
+          raise Amalgalite::Error, "Unknown kind of row class #{kind.inspect}"
+        end
+      end
+    end
+
+    ##
+    # :call-seq:
+    #   db.rowid_column?( db_name, table_name, column_name ) -> true or false
+    #
+    # Is the column the rowid of the table, or an alias for it.  The answer is
+    # looked up with SQLite3::Database#rowid_column? and kept for each table
+    # until the schema version of +db_name+ changes, so this does not need
+    # the Schema to be loaded.
+    #
+    def rowid_column?( db_name, table_name, column_name )
+      version = @api.schema_version( db_name )
+      cached  = @rowid_columns[db_name]
+      if cached.nil? or version.nil? or cached.first != version then
+        cached = @rowid_columns[db_name] = [ version, {} ]
+      end
+      columns = ( cached.last[table_name] ||= {} )
+      columns.fetch( column_name ) do
+        columns[column_name] = @api.rowid_column?( db_name, table_name, column_name )
+      end
+    end
+
     ##
     # :call-seq:
     #   db.reload_schema! -> Schema
@@ -891,20 +1157,44 @@ module Amalgalite
     # * backup on sqlite database to another location
     # 
     def replicate_to( location )
-      to_db = nil
-      case location 
-      when String
-        to_db = Amalgalite::Database.new( location )
-      when Amalgalite::Database
-        to_db = location
-      else
-        raise ArgumentError, "replicate_to( #{location} ) must be a String or a Database" 
-      end
-
+      to_db = database_at( location, "replicate_to" )
       @api.replicate_to( to_db.api )
       return to_db
     end
 
+    # The default number of pages copied in each step of #backup_to
+    BACKUP_PAGES_PER_STEP = 1024
+
+    ##
+    # call-seq:
+    #   db.backup_to( "/some/location/backup.db" ) -> new_db
+    #   db.backup_to( other_db, pages_per_step: 256, sleep_between: 0.01 ) -> other_db
+    #   db.backup_to( "backup.db", progress: ->( remaining, total ) { ... } ) -> new_db
+    #
+    # Copy the database online to another location, a String or an
+    # Amalgalite::Database as with #replicate_to.  Unlike #replicate_to, the
+    # copy is made +pages_per_step+ pages at a time and the source is only
+    # locked while a step runs, so writers on other connections can proceed in
+    # between.  +sleep_between+ is the number of seconds to pause after each
+    # step to throttle the backup.  The GVL is released during the steps and
+    # the pauses.
+    #
+    # +progress+, or the block, is called after each step with the number of
+    # pages remaining and the total number of pages.  If the source is written
+    # to by another connection during the backup, SQLite starts the copy over
+    # and the number remaining goes back up.
+    #
+    # +database+ is the name of the database of this connection to copy, such
+    # as "main" or the name of an attached database.
+    #
+    def backup_to( location, pages_per_step: BACKUP_PAGES_PER_STEP, sleep_between: 0, progress: nil, database: "main", &block )
+      to_db    = database_at( location, "backup_to" )
+      progress ||= block
+      @api.backup_to( to_db.api, "main", database.to_s, Integer( pages_per_step ),
+                      ( sleep_between * 1000 ).round, progress )
+      return to_db
+    end
+
     ##
     # call-seq:
     #   db.import_csv_to_table( "/some/location/data.csv", "my_table" )
@@ -928,6 +1218,35 @@ module Amalgalite
       importer = CSVTableImporter.new( csv_path, self, table_name, options )
       importer.run
     end
+
+    private
+
+    ##
+    # The Database at +location+, a String to open or a Database, for the
+    # copying method +method+
+    #
+    def database_at( location, method )
+      case location
+      when String
+        Amalgalite::Database.new( location )
+      when Amalgalite::Database
+        location
+      else
+        raise ArgumentError, "#{method}( #{location} ) must be a String or a Database"
+      end
+    end
+
+    ##
+    # The file: URI opening +filename+ with immutable=1.  If +uri+ is true
+    # the filename may already be a URI.
+    #
+    def immutable_uri( filename, uri )
+      if uri and filename.start_with?( "file:" ) then
+        return "#{filename}#{filename.include?( '?' ) ? '&' : '?'}immutable=1"
+      end
+      path = filename.gsub( /[%?#]/ ) { |c| "%%%02X" % c.ord }
+      "file:#{path}?immutable=1"
+    end
   end
 end
 
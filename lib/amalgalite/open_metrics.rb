@@ -0,0 +1,141 @@
+#--
+# Copyright (c) 2008 Jeremy Hinegardner
+# All rights reserved.  See LICENSE and/or COPYING for details.
+#++
+module Amalgalite
+  ##
+  # Renders the status counters of the SQLite library and of a set of
+  # Database connections in the OpenMetrics text format, which Prometheus
+  # also scrapes.  Each scrape is a single call into SQLite for the library
+  # and one for each connection.
+  #
+  #   metrics = Amalgalite::OpenMetrics.new
+  #   metrics.register( orders_db, "database" => "orders" )
+  #   metrics.register( users_db,  "database" => "users" )
+  #
+  #   # in the handler of the /metrics endpoint
+  #   [ 200, { "Content-Type" => Amalgalite::OpenMetrics::CONTENT_TYPE }, [ metrics.to_s ] ]
+  #
+  # Each registered connection needs its own labels to tell its samples
+  # apart.  Connections that have been closed are unregistered at the next
+  # scrape.
+  #
+  class OpenMetrics
+    # The content type of the text returned by #to_s
+    CONTENT_TYPE = "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+    # The metrics of the SQLite library, as [ name, type, counter, index into
+    # the [ current, highwater ] pair, help ]
+    LIBRARY_METRICS = [
+      [ "memory_used_bytes",              :gauge, :memory_used,        0, "Memory currently allocated by SQLite" ],
+      [ "memory_used_highwater_bytes",    :gauge, :memory_used,        1, "Most memory allocated by SQLite at any one time" ],
+      [ "malloc_count",                   :gauge, :malloc_count,       0, "Allocations currently outstanding" ],
+      [ "malloc_size_highwater_bytes",    :gauge, :malloc_size,        1, "Largest single allocation requested" ],
+      [ "pagecache_used_pages",           :gauge, :pagecache_used,     0, "Pages used from the page cache memory pool" ],
+      [ "pagecache_overflow_bytes",       :gauge, :pagecache_overflow, 0, "Page cache allocations that did not fit in the pool" ],
+      [ "pagecache_size_highwater_bytes", :gauge, :pagecache_size,     1, "Largest page cache allocation requested" ],
+      [ "parser_stack_highwater",         :gauge, :parser_stack,       1, "Deepest parser stack" ],
+    ]
+
+    # The metrics of each connection, as [ name, type, counter, index into
+    # the [ current, highwater ] pair, help ].  The lookaside hit and miss
+    # counts are only kept in the highwater value.
+    CONNECTION_METRICS = [
+      [ "cache_hit",                      :counter, :cache_hit,           0, "Pager cache hits" ],
+      [ "cache_miss",                     :counter, :cache_miss,          0, "Pager cache misses" ],
+      [ "cache_write",                    :counter, :cache_write,         0, "Dirty pages written to the database file" ],
+      [ "cache_spill",                    :counter, :cache_spill,         0, "Dirty pages spilled to the database file in the middle of a transaction" ],
+      [ "cache_used_bytes",               :gauge,   :cache_used,          0, "Heap memory used by the pager caches" ],
+      [ "cache_used_shared_bytes",        :gauge,   :cache_used_shared,   0, "Heap memory used by the pager caches, shared caches divided between their connections" ],
+      [ "lookaside_used_slots",           :gauge,   :lookaside_used,      0, "Lookaside memory slots in use" ],
+      [ "lookaside_used_highwater_slots", :gauge,   :lookaside_used,      1, "Most lookaside memory slots in use at any one time" ],
+      [ "lookaside_hit",                  :counter, :lookaside_hit,       1, "Allocations satisfied from lookaside memory" ],
+      [ "lookaside_miss_size",            :counter, :lookaside_miss_size, 1, "Allocations too large for lookaside memory" ],
+      [ "lookaside_miss_full",            :counter, :lookaside_miss_full, 1, "Allocations made while lookaside memory was full" ],
+      [ "schema_used_bytes",              :gauge,   :schema_used,         0, "Heap memory used by the schemas" ],
+      [ "stmt_used_bytes",                :gauge,   :stmt_used,           0, "Heap memory used by the prepared statements" ],
+    ]
+
+    # The prefix of every metric name
+    attr_reader :prefix
+
+    def initialize( prefix = "sqlite" )
+      @prefix      = prefix
+      @connections = {}
+      @mutex       = Mutex.new
+    end
+
+    ##
+    # Add the Database +db+ to the connections reported, with the +labels+
+    # Hash on each of its samples.
+    #
+    def register( db, labels = {} )
+      @mutex.synchronize { @connections[db] = format_labels( labels ) }
+      return self
+    end
+
+    ##
+    # Stop reporting the Database +db+
+    #
+    def unregister( db )
+      @mutex.synchronize { @connections.delete( db ) }
+      return self
+    end
+
+    ##
+    # The number of connections registered
+    #
+    def size
+      @mutex.synchronize { @connections.size }
+    end
+
+    ##
+    # The metrics of the library and of every open registered connection in
+    # the OpenMetrics text format.  Registered connections found closed are
+    # dropped.
+    #
+    def to_s
+      connections = @mutex.synchronize do
+        @connections.delete_if { |db, _| not db.open? }
+        @connections.to_a
+      end
+      snapshots = connections.select { |db, _| db.open? }.map { |db, labels| [ labels, db.api.status.to_h ] }
+
+      out = String.new
+      render( out, LIBRARY_METRICS, [ [ "", ::Amalgalite::SQLite3.status.to_h ] ] )
+      render( out, CONNECTION_METRICS, snapshots )
+      out << "# EOF\n"
+    end
+
+    private
+
+    ##
+    # Append each of the +metrics+ to +out+, with a sample from each of the
+    # [ labels, counters ] +snapshots+
+    #
+    def render( out, metrics, snapshots )
+      metrics.each do |name, type, counter, index, help|
+        family = "#{prefix}_#{name}"
+        sample = ( type == :counter ) ? "#{family}_total" : family
+        out << "# TYPE #{family} #{type}\n"
+        out << "# HELP #{family} #{help}\n"
+        snapshots.each do |labels, counters|
+          next unless pair = counters[counter]
+          out << "#{sample}#{labels} #{pair[index]}\n"
+        end
+      end
+    end
+
+    ##
+    # The label set of a sample, {name="value",...}, or the empty String
+    #
+    def format_labels( labels )
+      return "" if labels.empty?
+      pairs = labels.map do |name, value|
+        escaped = value.to_s.gsub( "\\" ) { "\\\\" }.gsub( "\"" ) { "\\\"" }.gsub( "\n" ) { "\\n" }
+        "#{name}=\"#{escaped}\""
+      end
+      "{#{pairs.join( ',' )}}"
+    end
+  end
+end
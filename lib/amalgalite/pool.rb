@@ -0,0 +1,374 @@
+#--
+# Copyright (c) 2008 Jeremy Hinegardner
+# All rights reserved.  See LICENSE and/or COPYING for details.
+#++
+require 'thread'
+require 'amalgalite/database'
+
+module Amalgalite
+  ##
+  # A thread safe pool of connections to one database in WAL mode: a single
+  # read-write connection and up to +readers+ read only connections.  In WAL
+  # mode readers see the last committed state of the database and never wait
+  # for the writer, and as the extension releases the GVL while SQLite is
+  # working, reads on different threads run in parallel.
+  #
+  #   pool = Amalgalite::Pool.new( "app.db", readers: 8, busy_timeout: 5000 )
+  #
+  #   pool.transaction do |db|
+  #     db.execute( "INSERT INTO jobs( name ) VALUES( ? )", name )
+  #   end
+  #
+  #   rows = pool.read( "SELECT * FROM jobs WHERE state = ?", "queued" )
+  #
+  #   pool.with_reader do |db|
+  #     db.execute( "SELECT ..." ) { |row| ... }
+  #   end
+  #
+  # Connections are kept open and reused, and with them their
+  # Database#statement_cache.  A connection given back inside a transaction
+  # is rolled back, and one that is found closed or failing is replaced.
+  #
+  class Pool
+    # Error raised when no connection became free in time
+    class TimeoutError < ::Amalgalite::Error; end
+
+    # Error raised when a closed pool is used
+    class ClosedError < ::Amalgalite::Error; end
+
+    # the number of read only connections by default
+    DEFAULT_READERS = 4
+
+    # the seconds to wait for a connection by default
+    DEFAULT_TIMEOUT = 5
+
+    # connections idle for longer than this many seconds are checked before
+    # they are handed out
+    DEFAULT_IDLE_CHECK = 30
+
+    # the file of the database
+    attr_reader :filename
+
+    # the most read only connections
+    attr_reader :readers
+
+    # the seconds checkout and checkout_writer wait by default
+    attr_reader :timeout
+
+    ##
+    # Open the read-write connection to +filename+, creating it if need be
+    # and putting it in WAL mode.  The read only connections are opened as
+    # they are needed.  The options are:
+    #
+    # * :readers     the most read only connections, DEFAULT_READERS
+    # * :timeout     the seconds to wait for a connection, DEFAULT_TIMEOUT
+    # * :idle_check  the seconds a connection may be idle before it is checked
+    #                on checkout, DEFAULT_IDLE_CHECK
+    #
+    # The rest of the options are passed to Database.new for every
+    # connection, for instance :busy_timeout, :mmap_size or
+    # :statement_cache_size.
+    #
+    def initialize( filename, readers: DEFAULT_READERS, timeout: DEFAULT_TIMEOUT, idle_check: DEFAULT_IDLE_CHECK, **opts )
+      if filename == ":memory:" or filename.empty? then
+        raise ArgumentError, "A Pool needs a database file, every connection to #{filename.inspect} would be a different database"
+      end
+      raise ArgumentError, "A Pool needs at least 1 reader" if readers < 1
+
+      @filename    = filename
+      @readers     = readers
+      @timeout     = timeout
+      @idle_check  = idle_check
+      @opts        = opts.reject { |key, _| key == :journal_mode }
+      @closed      = false
+
+      @mutex        = Mutex.new
+      @reader_freed = ConditionVariable.new
+      @idle_readers = []
+      @busy_readers = {}
+      @opening      = 0
+      @last_used    = {}
+
+      @writer_mutex  = Mutex.new
+      @writer_freed  = ConditionVariable.new
+      @writer        = open_writer
+      @writer_owner  = nil
+      @writer_depth  = 0
+    end
+
+    ##
+    # call-seq:
+    #   pool.checkout( timeout = pool.timeout ) -> Database
+    #
+    # Take a read only connection from the pool, opening a new one if there
+    # are fewer than +readers+.  Waits up to +timeout+ seconds for one to be
+    # checked in, then raises TimeoutError.  Give it back with checkin.
+    #
+    def checkout( timeout = @timeout )
+      deadline = monotonic + timeout
+
+      # the slot stays reserved in @opening while the reader is checked, and
+      # opened or replaced, outside of the mutex
+      db = @mutex.synchronize do
+        loop do
+          raise ClosedError, "The pool of #{filename} is closed" if @closed
+          if not @idle_readers.empty? or reader_count < @readers then
+            @opening += 1
+            break @idle_readers.pop
+          end
+          remaining = deadline - monotonic
+          raise TimeoutError, "No reader of #{filename} was checked in within #{timeout} seconds" if remaining <= 0
+          @reader_freed.wait( @mutex, remaining )
+        end
+      end
+
+      begin
+        db = healthy_reader( db )
+      rescue Exception
+        @mutex.synchronize do
+          @opening -= 1
+          @reader_freed.signal
+        end
+        raise
+      end
+
+      @mutex.synchronize do
+        @opening -= 1
+        @busy_readers[db] = true
+      end
+      return db
+    end
+
+    ##
+    # call-seq:
+    #   pool.checkout_writer( timeout = pool.timeout ) -> Database
+    #
+    # Take the read-write connection, waiting up to +timeout+ seconds for it
+    # to be checked in, then raising TimeoutError.  A thread that already
+    # has the writer gets it again.  Give it back with checkin.
+    #
+    def checkout_writer( timeout = @timeout )
+      deadline = monotonic + timeout
+      @writer_mutex.synchronize do
+        loop do
+          raise ClosedError, "The pool of #{filename} is closed" if @closed
+          break if @writer_owner.nil? or @writer_owner == Thread.current
+          remaining = deadline - monotonic
+          raise TimeoutError, "The writer of #{filename} was not checked in within #{timeout} seconds" if remaining <= 0
+          @writer_freed.wait( @writer_mutex, remaining )
+        end
+        if @writer_depth == 0 then
+          @writer = healthy_writer( @writer )
+          @writer_owner = Thread.current
+        end
+        @writer_depth += 1
+        @writer
+      end
+    end
+
+    ##
+    # Give back a connection from checkout or checkout_writer.  An open
+    # transaction is rolled back, and a connection that cannot be is closed
+    # and replaced on a later checkout.
+    #
+    def checkin( db )
+      if db.equal?( @writer ) then
+        checkin_writer( db )
+      else
+        checkin_reader( db )
+      end
+      return nil
+    end
+
+    ##
+    # Yield a read only connection, checking it in after the block
+    #
+    def with_reader( timeout = @timeout )
+      db = checkout( timeout )
+      begin
+        yield db
+      ensure
+        checkin( db )
+      end
+    end
+
+    ##
+    # Yield the read-write connection, checking it in after the block
+    #
+    def with_writer( timeout = @timeout )
+      db = checkout_writer( timeout )
+      begin
+        yield db
+      ensure
+        checkin( db )
+      end
+    end
+
+    ##
+    # call-seq:
+    #   pool.transaction( mode = TransactionBehavior::DEFERRED ) { |db| ... }
+    #
+    # Run the block in a transaction on the read-write connection, see
+    # Database#transaction
+    #
+    def transaction( mode = Database::TransactionBehavior::DEFERRED, &block )
+      with_writer { |db| db.transaction( mode ) { block.call( db ) } }
+    end
+
+    ##
+    # Execute +sql+ on a read only connection, see Database#execute
+    #
+    def read( sql, *bind_params, &block )
+      with_reader { |db| db.execute( sql, *bind_params, &block ) }
+    end
+
+    ##
+    # Execute +sql+ on the read-write connection, see Database#execute
+    #
+    def write( sql, *bind_params, &block )
+      with_writer { |db| db.execute( sql, *bind_params, &block ) }
+    end
+
+    ##
+    # The number of read only connections open, idle or checked out
+    #
+    def size
+      @mutex.synchronize { reader_count }
+    end
+
+    ##
+    # The number of read only connections that may be checked out without
+    # waiting
+    #
+    def available
+      @mutex.synchronize { @readers - @busy_readers.size - @opening }
+    end
+
+    ##
+    # Close every connection.  Connections that are checked out are closed
+    # when they are checked in.
+    #
+    def close
+      idle = @mutex.synchronize do
+        @closed = true
+        @reader_freed.broadcast
+        @last_used.clear
+        @idle_readers.slice!( 0..-1 )
+      end
+      idle.each { |db| db.close }
+      @writer_mutex.synchronize do
+        @writer_freed.broadcast
+        @writer.close if @writer_owner.nil?
+      end
+      return nil
+    end
+
+    ##
+    # Has the pool been closed
+    #
+    def closed?
+      @closed
+    end
+
+    private
+
+    def monotonic
+      Process.clock_gettime( Process::CLOCK_MONOTONIC )
+    end
+
+    ##
+    # The readers idle, checked out and being opened, with @mutex held
+    #
+    def reader_count
+      @idle_readers.size + @busy_readers.size + @opening
+    end
+
+    def open_writer
+      db = Database.new( filename, "w+", @opts.merge( :journal_mode => "wal" ) )
+      mode = db.pragma( "journal_mode" ).first[0]
+      unless mode == "wal" then
+        db.close
+        raise ::Amalgalite::Error, "#{filename} could not be put in WAL mode, it is in #{mode} mode"
+      end
+      return db
+    end
+
+    def open_reader
+      Database.new( filename, "r", @opts )
+    end
+
+    ##
+    # +db+ if it is fit to use, otherwise a new reader in its place
+    #
+    def healthy_reader( db )
+      return open_reader unless db and healthy?( db )
+      return db
+    end
+
+    def healthy_writer( db )
+      return db if healthy?( db )
+      return open_writer
+    end
+
+    ##
+    # Is +db+ open, and if it has been idle for a while, does it still answer
+    #
+    def healthy?( db )
+      last_used = @mutex.synchronize { @last_used.delete( db ) }
+      return false unless db.open?
+      return true if last_used and monotonic - last_used < @idle_check
+      db.first_value_from( "SELECT 1" ) == 1
+    rescue ::Amalgalite::Error
+      db.close rescue nil
+      return false
+    end
+
+    ##
+    # Roll back what +db+ left open, closing it if that fails.  Returns true
+    # if it can be used again.
+    #
+    def reset( db )
+      return false unless db.open?
+      db.rollback unless db.autocommit?
+      return true
+    rescue ::Amalgalite::Error
+      db.close rescue nil
+      return false
+    end
+
+    def checkin_reader( db )
+      unless @mutex.synchronize { @busy_readers.key?( db ) }
+        raise ::Amalgalite::Error, "#{db.inspect} is not checked out of the pool of #{filename}"
+      end
+      reusable = reset( db )
+      closing = @mutex.synchronize do
+        unless @busy_readers.delete( db )
+          raise ::Amalgalite::Error, "#{db.inspect} is not checked out of the pool of #{filename}"
+        end
+        if reusable and not @closed then
+          @last_used[db] = monotonic
+          @idle_readers.push( db )
+        end
+        @reader_freed.signal
+        @closed
+      end
+      db.close if closing and db.open?
+    end
+
+    def checkin_writer( db )
+      @writer_mutex.synchronize do
+        unless @writer_owner == Thread.current
+          raise ::Amalgalite::Error, "The writer of #{filename} is checked out by another thread"
+        end
+        @writer_depth -= 1
+        return if @writer_depth > 0
+        if reset( db ) then
+          @mutex.synchronize { @last_used[db] = monotonic }
+        end
+        @writer_owner = nil
+        @writer_freed.signal
+        db.close if @closed and db.open?
+      end
+    end
+  end
+end
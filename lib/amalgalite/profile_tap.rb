@@ -9,15 +9,37 @@ module Amalgalite
   # events that happen for the same source.  It is based upon the RFuzz::Sampler 
   # class from the rfuzz gem
   #
+  # The samples are also counted in a Histogram, so the sampler can report
+  # percentiles at a fixed memory and per sample cost.
+  #
   class ProfileSampler
+    # the percentiles reported by to_a, to_h and to_s
+    PERCENTILES = { 'p50' => 50.0, 'p90' => 90.0, 'p99' => 99.0, 'p999' => 99.9 }
+
+    # the Histogram of the samples
+    attr_reader :histogram
+
+    # the number, sum, sum of the squares, minimum and maximum of the samples
+    attr_reader :n, :sum, :sumsq, :min, :max
+
     #
     # create a new sampler with the given name
     #
     def initialize( name )
-      @name = name
+      @name      = name
+      @histogram = Histogram.new
       reset!
     end
 
+    ##
+    # a copy of a sampler has its own copy of the histogram, so it is a
+    # snapshot that may be merged into others
+    #
+    def initialize_copy( other )
+      super
+      @histogram = other.histogram.dup
+    end
+
     ##
     # reset the internal state so it may be used again
     #
@@ -27,6 +49,7 @@ module Amalgalite
       @n     = 0
       @min   = 0.0
       @max   = 0.0
+      @histogram.reset!
     end
 
     ##
@@ -42,6 +65,34 @@ module Amalgalite
         @max = value if value > @max
       end
       @n += 1
+      @histogram.record( value )
+    end
+
+    ##
+    # Add all the samples of another sampler to this one
+    #
+    def merge!( other )
+      return self if other.n.zero?
+      if @n == 0 then
+        @min = other.min
+        @max = other.max
+      else
+        @min = other.min if other.min < @min
+        @max = other.max if other.max > @max
+      end
+      @sum   += other.sum
+      @sumsq += other.sumsq
+      @n     += other.n
+      @histogram.merge!( other.histogram )
+      return self
+    end
+
+    ##
+    # return the value that +percent+ percent of the samples are at or below,
+    # from the histogram
+    #
+    def percentile( percent )
+      @histogram.percentile( percent )
     end
 
     ##
@@ -67,23 +118,25 @@ module Amalgalite
     # return all the values as an array
     #
     def to_a
-      [ @name, @sum, @sumsq, @n, mean, stddev, @min, @max ]
+      [ @name, @sum, @sumsq, @n, mean, stddev, @min, @max ] + PERCENTILES.values.map { |p| percentile( p ) }
     end
 
     ##
     # return all the values as a hash
     #
     def to_h
-      { 'name'    => @name,  'n' => @n,
-        'sum'     => @sum,   'sumsq'   => @sumsq, 'mean'    => mean,
-        'stddev'  => stddev, 'min'     => @min,   'max'     => @max }
+      h = { 'name'    => @name,  'n' => @n,
+            'sum'     => @sum,   'sumsq'   => @sumsq, 'mean'    => mean,
+            'stddev'  => stddev, 'min'     => @min,   'max'     => @max }
+      PERCENTILES.each_pair { |key, p| h[key] = percentile( p ) }
+      return h
     end
 
     ##
     # return a string containing the sampler summary
     #
     def to_s
-      "[%s] => sum: %d, sumsq: %d, n: %d, mean: %0.6f, stddev: %0.6f, min: %d, max: %d" % self.to_a
+      "[%s] => sum: %d, sumsq: %d, n: %d, mean: %0.6f, stddev: %0.6f, min: %d, max: %d, p50: %d, p90: %d, p99: %d, p999: %d" % self.to_a
     end
 
   end
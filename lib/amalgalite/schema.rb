@@ -10,8 +10,10 @@ require 'amalgalite/view'
 
 module Amalgalite
   #
-  # An object view of the schema  in the SQLite database.  If the schema changes
-  # after this class is created, it has no knowledge of that.
+  # An object view of the schema  in the SQLite database.  The whole catalog is
+  # loaded with a couple of queries over the pragma table valued functions.
+  # When the schema_version of the database changes, #refresh! reloads only the
+  # tables whose definition changed.
   #
   class Schema
 
@@ -34,6 +36,7 @@ module Amalgalite
       @catalog        = catalog
       @schema_version = nil
       @tables         = {}
+      @table_signatures = {}
       @views          = {}
       @master_table   = master_table
 
@@ -60,18 +63,39 @@ module Amalgalite
     end
 
     def current_version
-      @db.first_value_from("PRAGMA #{catalog}.schema_version")
+      @db.api.schema_version( catalog )
     end
 
     #
     # load the schema from the database
     def load_schema!
+      @schema_version = self.current_version
       load_tables
       load_views
       if @temp_schema then
         @temp_schema.load_schema!
       end
-      @schema_version = self.current_version
+      nil
+    end
+
+    ##
+    # Bring the schema up to date with the database, rebuilding only the tables
+    # whose definition, or the definition of one of their indexes, has changed
+    # since they were loaded.  The views are all reloaded.
+    #
+    def refresh!
+      if @schema_version != self.current_version then
+        @schema_version = self.current_version
+        signatures = table_signatures
+        ( @table_signatures.keys - signatures.keys ).each { |name| @tables.delete( name ) }
+        signatures.each_pair do |name, signature|
+          load_table( name ) unless @table_signatures[name] == signature
+        end
+        @table_signatures = signatures
+        @views = {}
+        load_views
+      end
+      @temp_schema.refresh! if @temp_schema
       nil
     end
 
@@ -80,7 +104,7 @@ module Amalgalite
     # If there is a temp table and a normal table with the same name, then the
     # temp table is the one that is returned in the hash.
     def tables
-      load_schema! if dirty?
+      refresh! if dirty?
       t = @tables
       if @temp_schema then
         t = @tables.merge( @temp_schema.tables )
@@ -89,30 +113,22 @@ module Amalgalite
     end
 
     ##
-    # load all the tables
+    # load all the tables, with their columns and indexes
     #
     def load_tables
-      @tables = {}
-      @db.execute("SELECT tbl_name FROM #{catalog_master_table} WHERE type = 'table' AND name != 'sqlite_sequence'") do |table_info|
-        table = load_table( table_info['tbl_name'] )
-        table.indexes = load_indexes( table )
-        @tables[table.name] = table
-      end
+      @table_signatures = table_signatures
+      @tables = load_table_definitions
       return @tables
     end
 
     ##
     # Load a single table
     def load_table( table_name )
-      rows = @db.execute("SELECT tbl_name, sql FROM #{catalog_master_table} WHERE type = 'table' AND tbl_name = ?", table_name)
-      table_info = rows.first
-      table = nil
-      if table_info then
-        table = Amalgalite::Table.new( table_info['tbl_name'], table_info['sql'] )
-        table.schema = self
-        table.columns = load_columns( table )
-        table.indexes = load_indexes( table )
+      table = load_table_definitions( table_name )[table_name]
+      if table then
         @tables[table.name] = table
+      else
+        @tables.delete( table_name )
       end
       return table
     end
@@ -122,28 +138,8 @@ module Amalgalite
     #
     def load_indexes( table )
       indexes = {}
-
-      @db.prepare("SELECT name, sql FROM #{catalog_master_table} WHERE type ='index' and tbl_name = $name") do |idx_stmt|
-        idx_stmt.execute( "$name" => table.name) do |idx_info|
-          indexes[idx_info['name']] = Amalgalite::Index.new( idx_info['name'], idx_info['sql'], table )
-        end
-      end
-
-      @db.execute("PRAGMA index_list( #{@db.quote(table.name)} );") do |idx_list|
-        idx = indexes[idx_list['name']]
-
-        # temporary indexes do not show up in the previous list
-        if idx.nil? then
-          idx = Amalgalite::Index.new( idx_list['name'], nil, table )
-          indexes[idx_list['name']] = idx
-        end
-
-        idx.sequence_number = idx_list['seq']
-        idx.unique          = Boolean.to_bool( idx_list['unique'] )
-
-        @db.execute("PRAGMA index_info( #{@db.quote(idx.name)} );") do |col_info|
-          idx.columns << table.columns[col_info['name']]
-        end
+      each_catalog_row( :indexes, table.name ) do |row|
+        load_index_row( indexes, table, row )
       end
       return indexes
     end
@@ -153,34 +149,9 @@ module Amalgalite
     #
     def load_columns( table )
       cols = {}
-      idx = 0
-      @db.execute("PRAGMA #{catalog}.table_info(#{@db.quote(table.name)})") do |row|
-        col = Amalgalite::Column.new( catalog,  table.name, row['name'], row['cid'])
-
-        col.default_value       = row['dflt_value']
-
-        col.declared_data_type  = row['type']
-        col.not_null_constraint = row['notnull']
-        col.primary_key         = row['pk']
-
-        # need to remove leading and trailing ' or " from the default value
-        if col.default_value and col.default_value.kind_of?( String ) and ( col.default_value.length >= 2 ) then
-          fc = col.default_value[0].chr
-          lc = col.default_value[-1].chr
-          if fc == lc and ( fc == "'" || fc == '"' ) then
-            col.default_value = col.default_value[1..-2]
-          end
-        end
-
-        unless table.temporary? then
-          # get more exact information
-          @db.api.table_column_metadata( catalog, table.name, col.name ).each_pair do |key, value|
-            col.send("#{key}=", value)
-          end
-        end
-        col.schema = self
+      each_catalog_row( :columns, table.name ) do |row|
+        col = load_column_row( table, row )
         cols[col.name] = col
-        idx += 1
       end
       return cols
     end
@@ -192,7 +163,7 @@ module Amalgalite
     # temporary view is the one that is returned in the hash.
     #
     def views
-      reload_schema! if dirty?
+      refresh! if dirty?
       v = @views
       if @temp_schema then
         v = @views.merge( @temp_schema.views )
@@ -216,10 +187,135 @@ module Amalgalite
     #
     def load_views
       @db.execute("SELECT name, sql FROM #{catalog_master_table} WHERE type = 'view'") do |view_info|
-        view = load_view( view_info['name'] )
+        view = Amalgalite::View.new( view_info['name'], view_info['sql'] )
+        view.schema = self
         @views[view.name] = view
       end
       return @views
     end
+
+    private
+
+    ##
+    # The columns of every table, or of just the named table, in one query over
+    # the pragma_table_info table valued function
+    #
+    def columns_sql( one_table )
+      "SELECT m.tbl_name AS tbl_name, m.sql AS sql, c.cid AS cid, c.name AS name, c.type AS type, " \
+      "c.\"notnull\" AS \"notnull\", c.dflt_value AS dflt_value, c.pk AS pk " \
+      "FROM #{catalog_master_table} AS m JOIN pragma_table_info( m.tbl_name, #{@db.quote( catalog )} ) AS c " \
+      "WHERE m.type = 'table' AND m.name != 'sqlite_sequence' #{one_table ? 'AND m.tbl_name = ?' : ''} " \
+      "ORDER BY m.tbl_name, c.cid"
+    end
+
+    ##
+    # The indexes, and their columns, of every table, or of just the named
+    # table, in one query over the pragma_index_list and pragma_index_info table
+    # valued functions
+    #
+    def indexes_sql( one_table )
+      "SELECT m.tbl_name AS tbl_name, il.name AS name, il.seq AS seq, il.\"unique\" AS \"unique\", " \
+      "s.sql AS sql, ii.seqno AS seqno, ii.name AS column_name " \
+      "FROM #{catalog_master_table} AS m JOIN pragma_index_list( m.tbl_name, #{@db.quote( catalog )} ) AS il " \
+      "LEFT JOIN pragma_index_info( il.name, #{@db.quote( catalog )} ) AS ii " \
+      "LEFT JOIN #{catalog_master_table} AS s ON s.type = 'index' AND s.name = il.name " \
+      "WHERE m.type = 'table' AND m.name != 'sqlite_sequence' #{one_table ? 'AND m.tbl_name = ?' : ''} " \
+      "ORDER BY m.tbl_name, il.seq, ii.seqno"
+    end
+
+    ##
+    # yield each row of the :columns or :indexes catalog query, for every table
+    # or for just +table_name+
+    #
+    def each_catalog_row( what, table_name = nil, &block )
+      sql = send( "#{what}_sql", table_name )
+      if table_name then
+        @db.execute( sql, table_name, &block )
+      else
+        @db.execute( sql, &block )
+      end
+    end
+
+    ##
+    # Build the Tables, with their columns and indexes, of every table or of
+    # just +table_name+ with two catalog queries
+    #
+    def load_table_definitions( table_name = nil )
+      tables = {}
+      each_catalog_row( :columns, table_name ) do |row|
+        table = tables[row['tbl_name']]
+        unless table then
+          table = tables[row['tbl_name']] = Amalgalite::Table.new( row['tbl_name'], row['sql'] )
+          table.schema = self
+        end
+        col = load_column_row( table, row )
+        table.columns[col.name] = col
+      end
+
+      each_catalog_row( :indexes, table_name ) do |row|
+        table = tables[row['tbl_name']]
+        load_index_row( table.indexes, table, row ) if table
+      end
+      return tables
+    end
+
+    ##
+    # Build a Column from a row of the :columns catalog query
+    #
+    def load_column_row( table, row )
+      col = Amalgalite::Column.new( catalog,  table.name, row['name'], row['cid'])
+
+      col.default_value       = row['dflt_value']
+
+      col.declared_data_type  = row['type']
+      col.not_null_constraint = row['notnull']
+      col.primary_key         = row['pk']
+
+      # need to remove leading and trailing ' or " from the default value
+      if col.default_value and col.default_value.kind_of?( String ) and ( col.default_value.length >= 2 ) then
+        fc = col.default_value[0].chr
+        lc = col.default_value[-1].chr
+        if fc == lc and ( fc == "'" || fc == '"' ) then
+          col.default_value = col.default_value[1..-2]
+        end
+      end
+
+      unless table.temporary? then
+        # get more exact information
+        @db.api.table_column_metadata( catalog, table.name, col.name ).each_pair do |key, value|
+          col.send("#{key}=", value)
+        end
+      end
+      col.schema = self
+      return col
+    end
+
+    ##
+    # Add a row of the :indexes catalog query to the Index it belongs to in
+    # +indexes+.  There is one row per column of the index.
+    #
+    def load_index_row( indexes, table, row )
+      idx = indexes[row['name']]
+      unless idx then
+        idx = indexes[row['name']] = Amalgalite::Index.new( row['name'], row['sql'], table )
+        idx.sequence_number = row['seq']
+        idx.unique          = Boolean.to_bool( row['unique'] )
+      end
+      idx.columns << table.columns[row['column_name']] if row['seqno']
+      return idx
+    end
+
+    ##
+    # A signature of the definition of each table, and its indexes, taken from
+    # the sql in the master table.  A table whose signature changes needs to be
+    # reloaded.
+    #
+    def table_signatures
+      signatures = Hash.new { |h, k| h[k] = [] }
+      @db.execute( "SELECT tbl_name, name, sql FROM #{catalog_master_table} WHERE type IN ( 'table', 'index' ) AND tbl_name != 'sqlite_sequence' ORDER BY tbl_name, type DESC, name" ) do |row|
+        signatures[row['tbl_name']] << row['name'] << row['sql']
+      end
+      return Hash[ signatures ]
+    end
   end
 end
@@ -4,3 +4,4 @@ require 'amalgalite/sqlite3/constants'
 require 'amalgalite/sqlite3/status'
 require 'amalgalite/sqlite3/database/status'
 require 'amalgalite/sqlite3/database/function'
+require 'amalgalite/sqlite3/memory'
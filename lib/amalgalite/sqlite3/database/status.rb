@@ -58,6 +58,16 @@ module Amalgalite::SQLite3
       def initialize( api_db )
         @api_db = api_db
       end
+
+      #
+      # All of the stats at once, as a Hash of the stat name to a [ current,
+      # highwater ] pair.  This is a single call into SQLite, use it instead
+      # of the individual Stat objects to read many stats.  If +reset+ is true
+      # the stats are reset.
+      #
+      def to_h( reset = false )
+        api_db.status_counters( reset )
+      end
     end
 
     # return the DBstatus object for the sqlite database
@@ -0,0 +1,61 @@
+module Amalgalite::SQLite3
+  # The allocators SQLite3.configure_memory can give SQLite
+  ALLOCATORS = [ :system, :pool ]
+
+  ##
+  # call-seq:
+  #   Amalgalite::SQLite3.configure_memory( allocator: :pool, gc_accounting: true, lookaside: [ 1200, 100 ] )
+  #
+  # Configure how SQLite allocates memory.  SQLite is shut down and started
+  # again, so this may only be called while no databases are open, normally
+  # once at startup.  The options are:
+  #
+  # * :allocator      :system, the default, is the allocator SQLite is built
+  #                   with.  :pool keeps freed allocations of up to 64k in
+  #                   size classes, in a cache for each thread, and reuses
+  #                   them without going back to the system allocator.
+  # * :gc_accounting  if true, the memory SQLite holds is reported to the ruby
+  #                   GC with rb_gc_adjust_memory_usage, so that a process
+  #                   with large page caches collects garbage as often as
+  #                   its real size warrants.  false by default.
+  # * :lookaside      a [ slot_size, slot_count ] pair, the lookaside memory of
+  #                   every new connection.  Database#configure_lookaside
+  #                   changes it for a single connection.
+  #
+  # memory_configuration returns what is installed.
+  #
+  def self.configure_memory( allocator: :system, gc_accounting: false, lookaside: nil )
+    unless ALLOCATORS.include?( allocator ) then
+      raise ArgumentError, "#{allocator} is not an allocator, must be one of #{ALLOCATORS.join(', ')}"
+    end
+    slot_size, slot_count = lookaside
+    configure_memory!( allocator == :pool, gc_accounting, slot_size, slot_count )
+  end
+
+  ##
+  # call-seq:
+  #   Amalgalite::SQLite3.configure_page_cache( budget: 256 * 1024 * 1024 )
+  #   Amalgalite::SQLite3.configure_page_cache( budget: nil )
+  #
+  # Replace the page cache of every connection with one cache shared by all
+  # of them.  The pages of all the database files of all the connections are
+  # kept within +budget+ bytes, and when it is spent the least recently used
+  # page of any connection is evicted.  PRAGMA cache_size no longer limits a
+  # connection.  A +budget+ of nil puts back the page cache of SQLite.
+  #
+  # As with configure_memory SQLite is shut down and started again, so no
+  # databases may be open.  The other options are:
+  #
+  # * :preallocate  if true the budget is mapped at once, in slots for pages
+  #                 of up to :page_size bytes, 4096 by default.  Pages that
+  #                 do not fit, or do not fit in the slots left, are
+  #                 allocated as needed.
+  # * :huge_pages   map the slots on huge pages if the system has them,
+  #                 implies :preallocate.
+  #
+  # page_cache_stats reports the hits, misses and evictions of the cache.
+  #
+  def self.configure_page_cache( budget:, page_size: 4096, preallocate: false, huge_pages: false )
+    configure_page_cache!( budget, page_size, ( preallocate or huge_pages ), huge_pages )
+  end
+end
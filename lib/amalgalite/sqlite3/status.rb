@@ -51,6 +51,16 @@ module Amalgalite::SQLite3
         end
       code
     end
+
+    #
+    # All of the stats at once, as a Hash of the stat name to a [ current,
+    # highwater ] pair.  This is a single call into SQLite, use it instead of
+    # the individual Stat objects to read many stats.  If +reset+ is true the
+    # highwater marks are reset.
+    #
+    def to_h( reset = false )
+      ::Amalgalite::SQLite3.status_counters( reset )
+    end
   end
 
   # return the status object for the sqlite database
@@ -22,20 +22,105 @@ module Amalgalite
     end
 
     ##
-    # Initialize a new statement on the database.  
+    # Initialize a new statement on the database.  A +persistent+ statement is
+    # one that is expected to be kept and reused many times, such as those in
+    # the StatementCache.
     #
-    def initialize( db, sql )
+    def initialize( db, sql, persistent: false )
       @db = db
       #prepare_method   =  @db.utf16? ? :prepare16 : :prepare
       prepare_method   =  :prepare
-      @param_positions = {}
-      @stmt_api        = @db.api.send( prepare_method, sql )
+      @stmt_api        = @db.api.send( prepare_method, sql, persistent )
+      @param_positions = @stmt_api.parameter_indexes
       @blobs_to_write  = []
+      @tracking_rowids = false
+      @blob_handles    = nil
       @rowid_index     = nil
       @result_meta     = nil
+      @column_types    = []
+      @row_type        = nil
+      @row_class       = nil
+      @intern_columns  = nil
       @open            = true
     end
 
+    ##
+    # The kinds of row, other than a Class, that #row_type may be set to
+    #
+    ROW_TYPES = [ :row, :struct, :data ].freeze
+
+    ##
+    # What each row of the result is returned as, see #row_type=.  nil is the
+    # same as :row.
+    #
+    attr_reader :row_type
+
+    ##
+    # Set what each row of the result is returned as:
+    #
+    # :row::    a Result::Row, the default
+    # :struct:: an instance of a Struct subclass with one member per result
+    #           column, generated once per result shape by
+    #           Database#row_class_for
+    # :data::   the same, but a Data subclass
+    # a Class:: an instance of the class, made with the values of the row as
+    #           positional arguments to +new+
+    #
+    # Struct and Data rows are made in the extension from the values of each
+    # row, so reading a field is a plain method call.
+    #
+    def row_type=( kind )
+      unless kind.nil? or ROW_TYPES.include?( kind ) or kind.kind_of?( Class ) then
+        raise Amalgalite::Error, "Unknown row type #{kind.inspect}, it must be one of #{ROW_TYPES.join(', ')} or a Class"
+      end
+      @row_type  = kind
+      @row_class = nil
+    end
+
+    ##
+    # The result columns, by name or index, whose values are interned, see
+    # #intern_columns=
+    #
+    attr_reader :intern_columns
+
+    ##
+    # Intern the TEXT values of the given result +columns+, an Array of column
+    # names or indexes.  Each value of those columns is a frozen String shared
+    # with every other equal value, so a low cardinality column such as a
+    # status or a country code allocates one String per distinct value rather
+    # than one per row.  Only columns whose values the Database#type_map
+    # returns unconverted are interned.  nil turns interning off.
+    #
+    def intern_columns=( columns )
+      @intern_columns = columns.nil? ? nil : Array( columns ).map { |c| c.kind_of?( Integer ) ? c : c.to_s }
+      @conversion_plan_type_map = nil
+    end
+
+    ##
+    # The keys of the row options Hash taken by #execute_with
+    #
+    ROW_OPTIONS = [ :as, :intern ].freeze
+
+    ##
+    # Apply the row +options+, :as for #row_type= and :intern for
+    # #intern_columns=
+    #
+    def apply_row_options( options )
+      unknown = options.keys - ROW_OPTIONS
+      raise ArgumentError, "Unknown row options #{unknown.inspect}, they must be among #{ROW_OPTIONS.inspect}" unless unknown.empty?
+      self.row_type       = options[:as]     if options.key?( :as )
+      self.intern_columns = options[:intern] if options.key?( :intern )
+      return self
+    end
+
+    ##
+    # Put the #row_type and #intern_columns back to their defaults
+    #
+    def reset_row_options!
+      self.row_type       = nil unless @row_type.nil?
+      self.intern_columns = nil unless @intern_columns.nil?
+    end
+
     ##
     # is the statement open for business
     #
@@ -57,8 +142,7 @@ module Amalgalite
     #
     def reset!
       @stmt_api.reset!
-      @param_positions = {}
-      @blobs_to_write.clear
+      clear_blobs_to_write
       @rowid_index = nil
     end
 
@@ -77,7 +161,7 @@ module Amalgalite
     def reset_for_next_execute!
       @stmt_api.reset!
       @stmt_api.clear_bindings!
-      @blobs_to_write.clear
+      clear_blobs_to_write
     end
 
     ##
@@ -111,6 +195,57 @@ module Amalgalite
       end
     end
 
+    ##
+    # :call-seq:
+    #   stmt.execute_with( options, *params ) -> Array
+    #   stmt.execute_with( options, *params ) { |row| ... }
+    #
+    # Exactly like #execute, after setting the #row_type and #intern_columns
+    # of the statement from the +options+ Hash, :as and :intern.  The options
+    # are kept apart from the bind parameters, so named parameters such as
+    # :as are still bound by #execute.
+    #
+    #   stmt.execute_with( { as: :struct, intern: %w[ status ] }, 42 ).first.name
+    #
+    def execute_with( options, *params, &block )
+      apply_row_options( options )
+      execute( *params, &block )
+    end
+
+    ##
+    # The number of rows #execute_many pulls from its rows at a time by default
+    #
+    EXECUTE_MANY_BATCH_SIZE = 1000
+
+    ##
+    # Execute the statement once for each of the +rows+, any Enumerable.  Each
+    # row is bound the same way as a single argument to #execute, an Array of
+    # positional parameters, a Hash of named parameters or a lone value.  Any
+    # result rows are discarded.
+    #
+    # Rows are pulled +batch_size+ at a time and each batch is bound, stepped
+    # and reset in the extension, without holding the GVL while SQLite works.
+    # Rows the extension cannot bind, such as those holding an
+    # Amalgalite::Blob, go through #execute one at a time.  The incremental
+    # Blobs of those rows are streamed through one SQLite3::Blob handle per
+    # column, moved from row to row with SQLite3::Blob#reopen.
+    #
+    # Wrap the call in a transaction to make the whole load atomic, and fast.
+    # Database#ingest_blobs does that.
+    #
+    # Returns the total number of rows changed.
+    #
+    def execute_many( rows, batch_size: EXECUTE_MANY_BATCH_SIZE )
+      changes = 0
+      @blob_handles = {}
+      rows.each_slice( batch_size ) do |batch|
+        changes += execute_batch_of_rows( batch )
+      end
+      return changes
+    ensure
+      close_blob_handles
+    end
+
     ##
     # Bind parameters to the sql statement.
     #
@@ -150,6 +285,9 @@ module Amalgalite
       else
         bind_positional_parameters( params )
       end
+    rescue Exception
+      clear_blobs_to_write
+      raise
     end
 
     ##
@@ -157,6 +295,8 @@ module Amalgalite
     #
     def bind_named_parameters( params )
       check_parameter_count!( params.size )
+      params = @stmt_api.bind_hash( params ) if native_binding?
+      return unless params
       params.each_pair do | param, value |
         position = param_position_of( param )
         if position > 0 then
@@ -172,10 +312,50 @@ module Amalgalite
     #
     def bind_positional_parameters( params )
       check_parameter_count!( params.size )
-      params.each_with_index do |value, index|
-        position = index + 1
-        bind_parameter_to( position, value )
+      if native_binding? then
+        unbound = @stmt_api.bind_array( params )
+        unbound.each_pair { |position, value| bind_parameter_to( position, value ) } if unbound
+      else
+        params.each_with_index do |value, index|
+          position = index + 1
+          bind_parameter_to( position, value )
+        end
+      end
+    end
+
+    ##
+    # Execute the statement for every row in the Array +batch+ returning the
+    # number of rows changed.  See #execute_many.
+    #
+    def execute_batch_of_rows( batch )
+      changes = 0
+      offset  = 0
+      while offset < batch.size do
+        if native_binding? then
+          executed_changes, executed = @stmt_api.execute_rows( offset.zero? ? batch : batch[offset..-1] )
+          changes += executed_changes
+          offset  += executed
+          break if offset >= batch.size
+        end
+        execute( batch[offset] )
+        changes += db.row_changes unless @stmt_api.readonly?
+        offset  += 1
+      end
+      return changes
+    end
+
+    ##
+    # Can the parameters be bound by the extension in one call?  That is the
+    # case when the type map binds the same way as DefaultMap#bind_type_of,
+    # see TypeMap#native_binding?
+    #
+    def native_binding?
+      type_map = db.type_map
+      unless @native_binding_type_map.equal?( type_map )
+        @native_binding = type_map.respond_to?( :native_binding? ) && type_map.native_binding?
+        @native_binding_type_map = type_map
       end
+      return @native_binding
     end
 
     ##
@@ -191,13 +371,19 @@ module Amalgalite
       when DataType::NULL
         @stmt_api.bind_null( position )
       when DataType::TEXT
-        @stmt_api.bind_text( position, value.to_s )
+        case value
+        when ::Time, ::Date
+          @stmt_api.bind_text( position, ::Amalgalite::SQLite3.format_time( value ) )
+        else
+          @stmt_api.bind_text( position, value.to_s )
+        end
       when DataType::BLOB
         if value.incremental? then
-          @stmt_api.bind_zeroblob( position, value.length )
+          check_blob_table!( value )
+          @stmt_api.bind_zeroblob64( position, value.length )
           @blobs_to_write << value
         else
-          @stmt_api.bind_blob( position, value.source )
+          @stmt_api.bind_blob64( position, value.source )
         end
       else
         raise ::Amalgalite::Error, "Unknown binding type of #{bind_type} from #{db.type_map.class.name}.bind_type_of"
@@ -206,14 +392,11 @@ module Amalgalite
 
 
     ##
-    # Find and cache the binding parameter indexes
+    # Find the binding parameter index, from the table of named parameters
+    # built when the statement was prepared
     #
     def param_position_of( name )
-      ns = name.to_s
-      unless pos = @param_positions[ns] 
-        pos = @param_positions[ns] = @stmt_api.parameter_index( ns )
-      end
-      return pos
+      @param_positions[name] || @param_positions[name.to_s] || 0
     end
 
     ##
@@ -229,17 +412,89 @@ module Amalgalite
     end
 
     ##
-    # Write any blobs that have been bound to parameters to the database.  This
-    # assumes that the blobs go into the last inserted row
+    # Raise unless the incremental +blob+ is in the same table as those
+    # already bound.  All the incremental blobs of a statement must be in one
+    # table.
+    #
+    def check_blob_table!( blob )
+      return if @blobs_to_write.empty?
+      column = blob.column
+      first  = @blobs_to_write.first.column
+      unless first.db == column.db and first.table == column.table then
+        raise Amalgalite::Error, "The incremental Blobs bound to a statement must all be in one table, not both #{first.table} and #{column.table}"
+      end
+    end
+
+    ##
+    # Start recording the rows the statement changes in the table of its
+    # incremental blobs, if any were bound, as it is first stepped.
+    #
+    # The rows are recorded with the sqlite3_update_hook of the connection.
+    # Amalgalite has no other use for it, but an update hook installed on the
+    # connection by other means is replaced until the blobs are written and
+    # is not put back.
+    #
+    def track_rowids
+      return if @tracking_rowids or @blobs_to_write.empty?
+      column = @blobs_to_write.first.column
+      db.api.start_rowid_tracking( column.db, column.table )
+      @tracking_rowids = true
+    end
+
+    ##
+    # Stop recording the rows changed for the incremental blobs and return
+    # their rowids
+    #
+    def stop_tracking_rowids
+      return [] unless @tracking_rowids
+      @tracking_rowids = false
+      db.api.stop_rowid_tracking
+    end
+
+    ##
+    # Forget the blobs that were bound but not written, and stop recording the
+    # rows changed for them
+    #
+    def clear_blobs_to_write
+      stop_tracking_rowids
+      @blobs_to_write.clear
+    end
+
+    ##
+    # Write any blobs that have been bound to parameters to the database.  The
+    # blobs go into the rows the statement inserted or updated, as recorded
+    # while it was stepped.  This works for INSERTs of one or many rows,
+    # UPDATEs and statements with a RETURNING clause.
+    #
+    # For each column, a single blob is written to every changed row,
+    # otherwise there must be one blob per changed row, and they are written
+    # in order.
     #
     def write_blobs
-      unless @blobs_to_write.empty?
-        @blobs_to_write.each do |blob|
-          blob.write_to_column!
+      return if @blobs_to_write.empty?
+      rowids = stop_tracking_rowids
+      blobs  = @blobs_to_write.dup
+      @blobs_to_write.clear
+
+      blobs.group_by { |blob| blob.column.name }.each_pair do |name, column_blobs|
+        if column_blobs.size == 1 then
+          column_blobs.first.write_to_column!( rowids, @blob_handles )
+        elsif column_blobs.size == rowids.size then
+          column_blobs.zip( rowids ) { |blob, rowid| blob.write_to_column!( rowid, @blob_handles ) }
+        else
+          raise Amalgalite::Error, "#{column_blobs.size} Blobs were bound for column #{name} of #{sql} but it changed #{rowids.size} rows"
         end
       end
     end
 
+    ##
+    # Close the SQLite3::Blob handles kept by #execute_many
+    #
+    def close_blob_handles
+      @blob_handles.each_value { |handle| handle.close } if @blob_handles
+      @blob_handles = nil
+    end
+
     ##
     # Iterate over the results of the statement returning each row of results 
     # as a hash by +column_name+.  The column names are the value after an 
@@ -256,65 +511,292 @@ module Amalgalite
     # Return the next row of data, with type conversion as indicated by the
     # Database#type_map
     #
+    # The raw values of the whole row are fetched from SQLite in a single call
+    # to the extension, and then converted with the type map.
+    #
     def next_row
+      track_rowids
       row = nil
-      case rc = @stmt_api.step
+      values = []
+      plan = compiled_conversion_plan
+      case rc = @stmt_api.step_row( values, @column_types, plan || nil )
       when ResultCode::ROW
-        row = ::Amalgalite::Result::Row.new(field_map: result_field_map, values: Array.new(result_meta.size))
-        result_meta.each.with_index do |col, idx|
-          value = nil
-          column_type = @stmt_api.column_type( idx )
-          case column_type
-          when DataType::TEXT
-            value = @stmt_api.column_text( idx )
-          when DataType::FLOAT
-            value = @stmt_api.column_double( idx )
-          when DataType::INTEGER
-            value = @stmt_api.column_int64( idx )
-          when DataType::NULL
-            value = nil
-          when DataType::BLOB
-            # if the rowid column is encountered, then we can use an incremental
-            # blob api, otherwise we have to use the all at once version.
-            if using_rowid_column? then
-              value = Amalgalite::Blob.new( :db_blob => SQLite3::Blob.new( db.api,
-                                                                           col.db,
-                                                                           col.table,
-                                                                           col.name,
-                                                                           @stmt_api.column_int64( @rowid_index ),
-                                                                           "r"),
-                                            :column => col)
-            else
-              value = Amalgalite::Blob.new( :string => @stmt_api.column_blob( idx ), :column => col )
-            end
-          else
-            raise ::Amalgalite::Error, "BUG! : Unknown SQLite column type of #{column_type}"
-          end
-
-          row.store_by_index(idx, db.type_map.result_value_of( col.normalized_declared_data_type, value ))
-        end
+        plan = false if refresh_result_meta
+        convert_values( values, @column_types ) if plan == false
+        row = build_rows( [ values ], [ @column_types ] ).first
       when ResultCode::DONE
         write_blobs
       else
-        self.close # must close so that the error message is guaranteed to be pushed into the database handler
-                   # and we can call last_error_message on it
-        msg = "SQLITE ERROR #{rc} (#{Amalgalite::SQLite3::Constants::ResultCode.name_from_value( rc )}) : #{@db.api.last_error_message}"
-        raise Amalgalite::SQLite3::Error, msg
+        raise_step_error( rc )
       end
       return row
     end
 
+    ##
+    # Return an Array of up to +n+ of the next rows of data, with type
+    # conversion as indicated by the Database#type_map.
+    #
+    # All the raw values of the batch are fetched from SQLite in a single call
+    # to the extension.  If fewer than +n+ rows are returned then the statement
+    # has finished.
+    #
+    def fetch_many( n )
+      track_rowids
+      batch = []
+      types = []
+      plan = compiled_conversion_plan
+      rc = @stmt_api.step_rows( batch, n, types, plan || nil )
+      raise_step_error( rc ) unless rc == ResultCode::ROW or rc == ResultCode::DONE
+      plan = false if refresh_result_meta
+
+      batch.each_with_index { |values, i| convert_values( values, types[i] ) } if plan == false
+      rows = build_rows( batch, types )
+      write_blobs if rc == ResultCode::DONE
+      return rows
+    end
+
+    ##
+    # Iterate over the results of the statement yielding an Array of up to +n+
+    # rows at a time.  Each Array is fetched with #fetch_many.
+    #
+    def each_slice( n )
+      raise ArgumentError, "invalid slice size #{n}" unless n.to_i > 0
+      loop do
+        rows = fetch_many( n )
+        yield rows unless rows.empty?
+        break if rows.size < n
+      end
+      return self
+    end
+
+    ##
+    # The number of rows #all_rows fetches from SQLite in each call to the
+    # extension
+    #
+    ALL_ROWS_BATCH_SIZE = 1000
+
     ##
     # Return all rows from the statement as one array
     #
     def all_rows
       rows = []
-      while row = next_row
-        rows << row
+      each_slice( ALL_ROWS_BATCH_SIZE ) do |batch|
+        rows.concat( batch )
       end
       return rows
     end
 
+    ##
+    # Return all the remaining results of the statement column by column, as a
+    # Hash of field name to column.  Repeated field names are made unique with
+    # Database#unique_field_names, so SELECT a, a gives the columns 'a' and
+    # 'a_2'.
+    #
+    # If +pack+ is true then a column whose values are all INTEGER is returned
+    # as a binary String of native 64 bit integers, and a column whose values
+    # are all FLOAT as a binary String of native doubles.  These are packed
+    # straight from SQLite without creating a ruby object per value, and may be
+    # unpacked with String#unpack( "q*" ) and String#unpack( "d*" ).
+    # #packed_columns says which columns were packed and how.  Columns that the
+    # Database#type_map converts are never packed.
+    #
+    # Every other column is an Array of values, with type conversion as
+    # indicated by the Database#type_map.
+    #
+    def columns( pack: true )
+      track_rowids
+      raw   = []
+      types = []
+      plan = compiled_conversion_plan
+      rc = @stmt_api.step_columns( raw, types, pack, plan || nil )
+      plan = false if refresh_result_meta
+      case rc
+      when ResultCode::DONE
+        write_blobs
+      else
+        raise_step_error( rc )
+      end
+
+      @packed_columns = {}
+      result = {}
+      names  = db.unique_field_names( result_fields )
+      result_meta.each_with_index do |col, idx|
+        column = raw[idx]
+
+        # stepped without a plan, so the extension packed every numeric column
+        if plan == false and types[idx].kind_of?( Integer ) and conversion_plan and
+           not PACKABLE_CONVERSIONS.include?( conversion_plan[idx] ) then
+          column     = column.unpack( types[idx] == DataType::INTEGER ? "q*" : "d*" )
+          types[idx] = Array.new( column.size, types[idx] )
+        end
+
+        case types[idx]
+        when DataType::INTEGER
+          @packed_columns[names[idx]] = :int64
+        when DataType::FLOAT
+          @packed_columns[names[idx]] = :double
+        else
+          if plan == false and conversion_plan then
+            @stmt_api.convert_values( column, types[idx], conversion_plan[idx] )
+          end
+          types[idx].each_with_index do |type, i|
+            next unless type == DataType::BLOB
+            column[i] = db.type_map.result_value_of( col.normalized_declared_data_type,
+                                                     Amalgalite::Blob.new( :string => column[i], :column => col ) )
+          end
+        end
+        result[names[idx]] = column
+      end
+      return result
+    end
+
+    ##
+    # The entries of a #conversion_plan that leave INTEGER and FLOAT values as
+    # they are, the columns #columns may pack
+    #
+    PACKABLE_CONVERSIONS = [ nil, :float, :integer, :intern ].freeze
+
+    ##
+    # A Hash of the field name to :int64 or :double for every column of the
+    # last call to #columns that was returned as a packed String
+    #
+    def packed_columns
+      @packed_columns || {}
+    end
+
+    ##
+    # Make the rows, as given by #row_type, of the Array of +batch+ values of
+    # rows, whose SQLite3::DataType are in +types+.  All the values except
+    # BLOBs have already been converted with the #conversion_plan, the BLOBs
+    # are converted here using the Database#type_map.
+    #
+    def build_rows( batch, types )
+      batch.each_with_index { |values, i| convert_blobs( values, types[i] ) }
+      if klass = row_class then
+        @stmt_api.instantiate_rows( batch, klass )
+      else
+        batch.map! { |values| ::Amalgalite::Result::Row.new( field_map: result_field_map, values: values ) }
+      end
+    end
+
+    ##
+    # The class each row of the result is made as, nil for a Result::Row
+    #
+    def row_class
+      return nil if @row_type.nil? or @row_type == :row
+      @row_class ||= @row_type.kind_of?( Class ) ? @row_type : db.row_class_for( @row_type, result_fields )
+    end
+
+    ##
+    # Convert, in place, the BLOB +values+ of a row whose SQLite3::DataType are
+    # in +types+ using the Database#type_map
+    #
+    def convert_blobs( values, types )
+      types.each_with_index do |type, idx|
+        next unless type == DataType::BLOB
+        col = result_meta[idx]
+        # if the rowid column is encountered, then we can use an incremental
+        # blob api, otherwise we have to use the all at once version.
+        if using_rowid_column? then
+          value = Amalgalite::Blob.new( :db_blob => SQLite3::Blob.new( db.api,
+                                                                       col.db,
+                                                                       col.table,
+                                                                       col.name,
+                                                                       Integer( values[@rowid_index] ),
+                                                                       "r"),
+                                        :column => col)
+        else
+          value = Amalgalite::Blob.new( :string => values[idx], :column => col )
+        end
+        values[idx] = db.type_map.result_value_of( col.normalized_declared_data_type, value )
+      end
+      return values
+    end
+
+    ##
+    # The conversion plan of the result columns, one conversion per column as
+    # given by TypeMap#result_conversion_of for the declared type of the
+    # column.  The plan is compiled once and is applied by the extension as
+    # each row is fetched.  It is nil if no column needs converting.
+    #
+    # The plan is recompiled if the Database#type_map changes.
+    #
+    # Like #result_meta, this should not be called until the statement has
+    # been stepped at least once.
+    #
+    def conversion_plan
+      type_map = db.type_map
+      unless @conversion_plan_type_map.equal?( type_map )
+        plan = result_meta.map do |col|
+          declared_type = col.normalized_declared_data_type
+          if type_map.respond_to?( :result_conversion_of ) then
+            conversion = type_map.result_conversion_of( declared_type )
+            conversion.nil? && interned_column?( col ) ? :intern : conversion
+          else
+            lambda { |value| type_map.result_value_of( declared_type, value ) }
+          end
+        end
+        @conversion_plan = plan.compact.empty? ? nil : plan
+        @conversion_plan_type_map = type_map
+      end
+      return @conversion_plan
+    end
+
+    ##
+    # Is the result column +col+ one of the #intern_columns
+    #
+    def interned_column?( col )
+      return false unless @intern_columns
+      @intern_columns.include?( col.order ) or @intern_columns.include?( col.as_name.to_s )
+    end
+
+    ##
+    # The conversion plan to hand to the extension while stepping, or false if
+    # it has not been compiled yet.  Rows fetched before then are converted
+    # with #convert_values.
+    #
+    def compiled_conversion_plan
+      @conversion_plan_type_map.equal?( db.type_map ) ? @conversion_plan : false
+    end
+
+    ##
+    # Convert, in place, the raw +values+ of a row whose SQLite3::DataType are
+    # in +types+ with the #conversion_plan
+    #
+    def convert_values( values, types )
+      plan = conversion_plan
+      @stmt_api.convert_values( values, types, plan ) if plan
+      return values
+    end
+
+    ##
+    # If SQLite has prepared the statement again, because the schema of any of
+    # the databases changed, forget the #result_meta and everything made from
+    # it, as the result columns may be different now.  Returns true if it did,
+    # the rows stepped since then have not been converted.
+    #
+    def refresh_result_meta
+      return false unless @stmt_api.reprepared?
+      @result_meta              = nil
+      @fields                   = nil
+      @result_field_map         = nil
+      @row_class                = nil
+      @rowid_index              = nil
+      @conversion_plan          = nil
+      @conversion_plan_type_map = nil
+      return true
+    end
+
+    ##
+    # Raise the error for a failed step of the statement
+    #
+    def raise_step_error( rc )
+      self.close # must close so that the error message is guaranteed to be pushed into the database handler
+                 # and we can call last_error_message on it
+      msg = "SQLITE ERROR #{rc} (#{Amalgalite::SQLite3::Constants::ResultCode.name_from_value( rc )}) : #{@db.api.last_error_message}"
+      raise Amalgalite::SQLite3::Error, msg
+    end
+
     ##
     # Inspect the statement and gather all the meta information about the
     # results, include the name of the column result column and the origin
@@ -343,10 +825,8 @@ module Amalgalite
           column_meta = ::Amalgalite::Column.new( db_name, tbl_name, col_name, idx, as_name )
           column_meta.declared_data_type = @stmt_api.column_declared_type( idx )
 
-          # only check for rowid if we have a table name and it is not one of the
-          # sqlite_master tables.  We could get recursion in those cases.
-          if not using_rowid_column? and tbl_name and
-             not %w[ sqlite_master sqlite_temp_master ].include?( tbl_name ) and is_column_rowid?( tbl_name, col_name ) then
+          # only check for rowid if we have a table name
+          if not using_rowid_column? and tbl_name and is_column_rowid?( tbl_name, col_name, db_name ) then
             @rowid_index = idx
           end
 
@@ -361,19 +841,8 @@ module Amalgalite
     ##
     # is the column indicated by the Column a 'rowid' column
     #
-    def is_column_rowid?( table_name, column_name )
-      table_schema = @db.schema.tables[table_name]
-      return false unless table_schema
-
-      column_schema  = table_schema.columns[column_name]
-      if column_schema then
-        if column_schema.primary_key? and column_schema.declared_data_type and column_schema.declared_data_type.upcase == "INTEGER" then
-          return true
-        end
-      else
-        return true if Statement.rowid_column_names.include?( column_name.upcase )
-      end
-      return false
+    def is_column_rowid?( table_name, column_name, db_name = "main" )
+      @db.rowid_column?( db_name, table_name, column_name )
     end
 
     ##
@@ -415,12 +884,28 @@ module Amalgalite
       @stmt_api.sql
     end
 
+    ##
+    # call-seq:
+    #   stmt.stats( reset = false ) -> Hash
+    #
+    # The runtime counters SQLite keeps for this statement, and the number of
+    # rows it has returned, as a Hash with the keys :fullscan_step, :sort,
+    # :autoindex, :vm_step, :reprepare, :run, :filter_miss, :filter_hit,
+    # :memused and :rows.  A statement with fullscan_step or autoindex counts
+    # is not using an index.  If +reset+ is true the counters start again from
+    # 0.  See SQLite3::Statement#stats
+    #
+    def stats( reset = false )
+      @stmt_api.stats( reset )
+    end
+
     ##
     # Close the statement.  The statement is no longer valid for use after it
     # has been closed.
     #
     def close
       if open? then
+        clear_blobs_to_write
         @stmt_api.close
         @open = false
       end
@@ -0,0 +1,169 @@
+#--
+# Copyright (c) 2008 Jeremy Hinegardner
+# All rights reserved.  See LICENSE and/or COPYING for details.
+#++
+
+module Amalgalite
+  ##
+  # A bounded, least recently used, cache of prepared Statements keyed by their
+  # SQL.  Database#execute, #first_row_from, #pragma and the transaction
+  # methods check statements out of the cache instead of preparing and closing
+  # a new Statement on every call.
+  #
+  # Cached statements are prepared with SQLITE_PREPARE_PERSISTENT.  A statement
+  # is removed from the cache while it is checked out, so the same SQL may be
+  # used re-entrantly.  It is reset, its bindings cleared and its row options put
+  # back to the defaults when it is checked back in.  The whole cache is
+  # emptied when the schema version of the main database changes, so
+  # statements on dropped tables are not kept.  A statement that outlives a
+  # change to any other schema, or one made by another connection, is
+  # prepared again by SQLite and notices its new result columns, see
+  # Statement#refresh_result_meta.
+  #
+  class StatementCache
+    # The default number of statements kept in the cache
+    DEFAULT_CAPACITY = 64
+
+    # The maximum number of statements kept in the cache
+    attr_reader :capacity
+
+    # The number of checkouts that found their statement in the cache
+    attr_reader :hits
+
+    # The number of checkouts that had to prepare a new statement
+    attr_reader :misses
+
+    # The number of statements closed to keep the cache within its capacity
+    attr_reader :evictions
+
+    # The number of times the cache was emptied because the schema changed
+    attr_reader :invalidations
+
+    ##
+    # Create a cache of up to +capacity+ statements for the Database +db+.  A
+    # capacity of 0 disables caching.
+    #
+    def initialize( db, capacity = DEFAULT_CAPACITY )
+      @db             = db
+      @capacity       = Integer( capacity )
+      @statements     = {}
+      @checked_out    = {}.compare_by_identity
+      @schema_version = nil
+      reset_counters!
+    end
+
+    ##
+    # Is caching enabled
+    #
+    def enabled?
+      @capacity > 0
+    end
+
+    ##
+    # The number of statements currently in the cache
+    #
+    def size
+      @statements.size
+    end
+
+    ##
+    # Return a Statement for +sql+, from the cache if possible.  The Statement
+    # must be handed back with #checkin when the caller is done with it.
+    #
+    def checkout( sql )
+      return Amalgalite::Statement.new( @db, sql ) unless enabled?
+
+      validate!
+      if stmt = @statements.delete( sql ) then
+        @hits += 1
+      else
+        @misses += 1
+        stmt = Amalgalite::Statement.new( @db, sql, persistent: true )
+      end
+      @checked_out[stmt] = @schema_version
+      return stmt
+    end
+
+    ##
+    # Return a Statement obtained from #checkout for +sql+ to the cache,
+    # closing the least recently used statements if the cache is over
+    # capacity.  Statements that cannot be reset, or that were checked out
+    # before the schema changed, are closed instead.
+    #
+    def checkin( sql, stmt )
+      version = @checked_out.delete( stmt )
+      return unless stmt.open?
+      return stmt.close unless enabled?
+
+      validate!
+      return stmt.close if version != @schema_version
+
+      begin
+        stmt.reset_for_next_execute!
+        stmt.reset_row_options!
+      rescue ::Amalgalite::SQLite3::Error
+        return stmt.close
+      end
+
+      if previous = @statements.delete( sql ) then
+        previous.close
+      end
+      @statements[sql] = stmt
+
+      while @statements.size > @capacity do
+        _, lru = @statements.shift
+        lru.close
+        @evictions += 1
+      end
+      return nil
+    end
+
+    ##
+    # Close and remove every statement in the cache
+    #
+    def clear
+      @statements.each_value { |stmt| stmt.close }
+      @statements.clear
+    end
+
+    ##
+    # Set all the counters back to 0
+    #
+    def reset_counters!
+      @hits          = 0
+      @misses        = 0
+      @evictions     = 0
+      @invalidations = 0
+    end
+
+    ##
+    # The counters and sizes of the cache as a Hash
+    #
+    def stats
+      { :capacity      => capacity,
+        :size          => size,
+        :hits          => hits,
+        :misses        => misses,
+        :evictions     => evictions,
+        :invalidations => invalidations }
+    end
+
+    private
+
+    ##
+    # Empty the cache if the schema has changed since it was last checked.  A
+    # schema version that cannot be read at the moment changes nothing.
+    #
+    def validate!
+      version = @db.api.schema_version
+      return if version.nil?
+      if version != @schema_version then
+        unless @statements.empty?
+          clear
+          @invalidations += 1
+        end
+        @schema_version = version
+      end
+    end
+  end
+end
@@ -43,6 +43,42 @@ module Amalgalite
     def result_value_of( delcared_type, value )
       raise NotImplementedError, "result_value_of has not been implemented"
     end
+
+    ##
+    # :call-seq:
+    #   map.result_conversion_of( declared_type ) -> conversion
+    #
+    # result_conversion_of is called once per result column when a Statement
+    # compiles its conversion plan.  The conversion returned is applied to
+    # every non-BLOB value of the column while the row is built in the
+    # extension, and must be one of:
+    #
+    # nil::       the value is returned as is
+    # :to_s::     the value is converted to a String, NULL becomes ""
+    # :float::    TEXT values are converted with Kernel#Float
+    # :integer::  TEXT values are converted with Kernel#Float and truncated
+    # callable::  anything responding to +call+, it is called with the value
+    #
+    # BLOB values are always passed through result_value_of.  The default is a
+    # callable that invokes result_value_of.
+    #
+    def result_conversion_of( declared_type )
+      lambda { |value| result_value_of( declared_type, value ) }
+    end
+
+    ##
+    # :call-seq:
+    #   map.native_binding? -> true or false
+    #
+    # native_binding? is called once per Statement to decide if bind
+    # parameters may be bound in the extension without calling bind_type_of.
+    # Return true only if bind_type_of maps Float, Integer, nil and
+    # Amalgalite::Blob to themselves and everything else to TEXT, the way
+    # TypeMaps::DefaultMap does.  The default is false.
+    #
+    def native_binding?
+      false
+    end
   end 
 
   ##
@@ -52,6 +52,17 @@ module Amalgalite::TypeMaps
       'binary'    => 'blob',
     }.freeze
 
+    # The conversion methods that have a native equivalent used in
+    # #result_conversion_of
+    NATIVE_CONVERSIONS = {
+      'date'     => :date,
+      'datetime' => :datetime,
+      'time'     => :time,
+      'string'  => nil,
+      'float'   => :float,
+      'integer' => :integer,
+    }.freeze
+
     ##
     # A straight logical mapping (for me at least) of basic Ruby classes to SQLite types, if
     # nothing can be found then default to TEXT.
@@ -71,6 +82,14 @@ module Amalgalite::TypeMaps
       end
     end
 
+    ##
+    # Parameters are bound in the extension unless bind_type_of has been
+    # overridden in a subclass, see TypeMap#native_binding?
+    #
+    def native_binding?
+      method( :bind_type_of ).owner == DefaultMap
+    end
+
     ##
     # Map the incoming value to an outgoing value.  For some incoming values,
     # there will be no change, but for some (i.e. Dates and Times) there is some
@@ -99,25 +118,47 @@ module Amalgalite::TypeMaps
     end
 
     ##
-    # convert a string to a date
+    # The conversion for the result values of columns of the given
+    # `normalized_declared_type`, see TypeMap#result_conversion_of.
+    #
+    # Strings, Floats, Integers, Dates, DateTimes and Times are converted
+    # natively, unless the conversion method has been overridden in a
+    # subclass.  Everything else goes through #result_value_of.
+    #
+    def result_conversion_of( normalized_declared_type )
+      if method( :result_value_of ).owner == DefaultMap then
+        return nil unless normalized_declared_type
+        conversion_method = DefaultMap::SQL_TO_METHOD[normalized_declared_type]
+        if native_conversion?( conversion_method ) then
+          return DefaultMap::NATIVE_CONVERSIONS[conversion_method]
+        end
+      end
+      return lambda { |value| result_value_of( normalized_declared_type, value ) }
+    end
+
+    ##
+    # convert a string to a date.  ISO-8601 dates are parsed natively,
+    # anything else goes to Date.parse
     #
     def date( str )
-      Date.parse( str )
+      ::Amalgalite::SQLite3.parse_date( str ) || Date.parse( str )
     end
 
     ##
     # convert a string to a datetime, if no timzone is found in the parsed
-    # string, set it to the local offset.  
+    # string, set it to the local offset.  ISO-8601 date times are parsed
+    # natively, anything else goes to DateTime.parse
     #
     def datetime( str )
-      DateTime.parse( str )
+      ::Amalgalite::SQLite3.parse_datetime( str ) || DateTime.parse( str )
     end
 
     ##
-    # convert a string to a Time
+    # convert a string to a Time.  ISO-8601 times are parsed natively,
+    # anything else goes to Time.parse
     #
     def time( str )
-      Time.parse( str )
+      ::Amalgalite::SQLite3.parse_time( str ) || Time.parse( str )
     end
 
     ##
@@ -154,5 +195,12 @@ module Amalgalite::TypeMaps
     def blob( str )
       ::Amalgalite::Blob.new( :string => str )
     end
+
+    private
+
+    def native_conversion?( conversion_method )
+      return false unless NATIVE_CONVERSIONS.has_key?( conversion_method )
+      return method( conversion_method ).owner == DefaultMap
+    end
   end
 end
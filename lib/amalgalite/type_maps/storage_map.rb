@@ -28,11 +28,27 @@ module Amalgalite::TypeMaps
       end
     end
 
+    ##
+    # Parameters are bound in the extension unless bind_type_of has been
+    # overridden in a subclass, see TypeMap#native_binding?
+    #
+    def native_binding?
+      method( :bind_type_of ).owner == StorageMap
+    end
+
     ##
     # Do no mapping, just return the value as it was retrieved from SQLite.
     #
     def result_value_of( delcared_type, value )
       return value
     end
+
+    ##
+    # No conversion, the values are used as they were retrieved from SQLite.
+    #
+    def result_conversion_of( declared_type )
+      return super unless method( :result_value_of ).owner == StorageMap
+      return nil
+    end
   end
 end
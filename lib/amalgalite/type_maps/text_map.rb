@@ -17,5 +17,10 @@ module Amalgalite::TypeMaps
     def result_value_of( delcared_type, value )
       return value.to_s
     end
+
+    def result_conversion_of( declared_type )
+      return super unless method( :result_value_of ).owner == TextMap
+      return :to_s
+    end
   end
 end
@@ -73,6 +73,147 @@ describe Amalgalite::Blob do
   it "raises an error if initialized incorrectly" do
     lambda{ Amalgalite::Blob.new( :file => "/dev/null", :string => "foo" ) }.should raise_error( Amalgalite::Blob::Error )
   end
-end
+  describe "incremental io on the database blob" do
+    before(:each) do
+      @db.execute( "INSERT INTO blobs(name, data) VALUES ( 'a', CAST( '0123456789' AS BLOB ) )" )
+      @db.execute( "INSERT INTO blobs(name, data) VALUES ( 'b', 'second row' )" )
+    end
+
+    it "reads into a buffer, seeks and reports its position" do
+      Amalgalite::SQLite3::Blob.new( @db.api, "main", "blobs", "data", 1, "r" ) do |blob|
+        buf = String.new
+        blob.read( 4, buf ).should equal( buf )
+        buf.should eql( "0123" )
+        blob.pos.should eql( 4 )
+        blob.seek( -2, IO::SEEK_END )
+        blob.readpartial( 10 ).should eql( "89" )
+        blob.eof?.should be == true
+        blob.read( 1, buf ).should be_nil
+        buf.should eql( "" )
+        lambda { blob.readpartial( 1 ) }.should raise_error( EOFError )
+        blob.pos = 2
+        blob.read.should eql( "23456789" )
+      end
+    end
+
+    it "imports and exports whole files" do
+      File.open( @junk_file, "wb" ) { |f| f.write( "abcdefghij" ) }
+      Amalgalite::SQLite3::Blob.new( @db.api, "main", "blobs", "data", 1, "w" ) do |blob|
+        blob.import_file( @junk_file ).should eql( 10 )
+        blob.pos.should eql( 10 )
+        lambda { blob.import_file( @junk_file ) }.should raise_error( ArgumentError, /does not fit/ )
+      end
+      Amalgalite::SQLite3::Blob.new( @db.api, "main", "blobs", "data", 1, "r" ) do |blob|
+        blob.seek( 3 )
+        blob.export_file( @junk_file ).should eql( 7 )
+      end
+      IO.binread( @junk_file ).should eql( "defghij" )
+    end
+
+    it "can be interrupted between the chunks of a file" do
+      @db.execute( "INSERT INTO blobs(name, data) VALUES ( 'c', zeroblob( 32 * 1024 * 1024 ) )" )
+      started = Queue.new
+      Amalgalite::SQLite3::Blob.new( @db.api, "main", "blobs", "data", 3, "r" ) do |blob|
+        exporter = Thread.new do
+          started.push( true )
+          begin
+            blob.export_file( @junk_file )
+          rescue RuntimeError => e
+            e.message
+          end
+        end
+        started.pop
+        exporter.raise( RuntimeError, "stopped" )
+        exporter.value.should eql( "stopped" )
+        blob.pos.should be < blob.length
+        blob.pos.should eql( File.size( @junk_file ) )
+      end
+    end
+
+    it "rejects a zeroblob with a negative length" do
+      stmt = @db.api.prepare( "INSERT INTO blobs(name, data) VALUES ( 'c', ? )" )
+      lambda { stmt.bind_zeroblob64( 1, -1 ) }.should raise_error( ArgumentError, /negative/ )
+      stmt.close
+    end
+
+    it "can be moved to another row" do
+      blob = Amalgalite::SQLite3::Blob.new( @db.api, "main", "blobs", "data", 1, "r" )
+      blob.read( 3 )
+      blob.reopen( 2 ).should equal( blob )
+      blob.pos.should eql( 0 )
+      blob.read.should eql( "second row" )
+      blob.close
+      blob.closed?.should be == true
+      lambda { blob.read }.should raise_error( IOError )
+    end
+  end
+
+  describe "written to the rows a statement changes" do
+    before(:each) do
+      @column = @db.schema.tables['blobs'].columns['data']
+    end
+
+    def blob_of( string )
+      Amalgalite::Blob.new( :io => StringIO.new( string ), :column => @column )
+    end
+
+    it "fills the row of an UPDATE" do
+      @db.execute( "INSERT INTO blobs(name) VALUES( 'a' ), ( 'b' )" )
+      @db.execute( "UPDATE blobs SET data = ? WHERE name = 'a'", blob_of( "updated" ) )
+      @db.execute( "SELECT name, data FROM blobs ORDER BY name" ).map { |r| [ r['name'], r['data'].to_s ] }.should == [ [ "a", "updated" ], [ "b", "" ] ]
+    end
+
+    it "fills each row of a multi-row INSERT in order" do
+      @db.execute( "INSERT INTO blobs(name, data) VALUES( 'a', ? ), ( 'b', ? ) RETURNING id", blob_of( "first" ), blob_of( "second" ) ).size.should eql( 2 )
+      @db.execute( "SELECT data FROM blobs ORDER BY name" ).map { |r| r['data'].to_s }.should == [ "first", "second" ]
+    end
+
+    it "does not leave the connection tracking rows after a failed or unstepped bind" do
+      @db.execute( "CREATE TABLE others( id INTEGER PRIMARY KEY, data BLOB )" )
+      other = Amalgalite::Blob.new( :io => StringIO.new( "other" ), :column => @db.schema.tables['others'].columns['data'] )
+      lambda {
+        @db.execute( "INSERT INTO blobs(name, data) VALUES( 'a', ? ), ( 'b', ? )", blob_of( "first" ), other )
+      }.should raise_error( Amalgalite::Error, /one table/ )
+
+      stmt = @db.prepare( "UPDATE blobs SET data = ?" )
+      stmt.bind( blob_of( "never" ) )
+      @db.execute( "INSERT INTO blobs(name, data) VALUES( 'c', ? )", blob_of( "third" ) )
+      stmt.close
+      @db.first_value_from( "SELECT data FROM blobs WHERE name = 'c'" ).to_s.should eql( "third" )
+    end
+
+    it "ingests many rows through reused handles" do
+      rows = (1..25).map { |i| [ "row#{i}", blob_of( "data #{i}" ) ] }
+      @db.ingest_blobs( "INSERT INTO blobs(name, data) VALUES( ?, ? )", rows, batch_size: 10 ).should eql( 25 )
+      @db.first_value_from( "SELECT data FROM blobs WHERE name = 'row17'" ).to_s.should eql( "data 17" )
+      @db.first_value_from( "SELECT count(*) FROM blobs WHERE length(data) > 0" ).should eql( 25 )
+    end
 
+    it "keeps none of the rows when a later batch fails" do
+      rows = Enumerator.new do |y|
+        (1..25).each do |i|
+          raise ArgumentError, "bad row #{i}" if i == 15
+          y << [ "row#{i}", blob_of( "data #{i}" ) ]
+        end
+      end
+      lambda {
+        @db.ingest_blobs( "INSERT INTO blobs(name, data) VALUES( ?, ? )", rows, batch_size: 10 )
+      }.should raise_error( ArgumentError, /bad row 15/ )
+      @db.first_value_from( "SELECT count(*) FROM blobs" ).should eql( 0 )
+      @db.in_transaction?.should eql( false )
+    end
 
+    it "leaves the enclosing transaction open" do
+      @db.transaction do
+        @db.execute( "INSERT INTO blobs(name) VALUES( 'outer' )" )
+        @db.ingest_blobs( "INSERT INTO blobs(name, data) VALUES( ?, ? )", [ [ "a", blob_of( "first" ) ] ], batch_size: 1 )
+        lambda {
+          @db.ingest_blobs( "INSERT INTO blobs(name, data) VALUES( ?, ? )", [ [ "b", blob_of( "second" ) ], [ "b", nil, 1 ] ], batch_size: 1 )
+        }.should raise_error( Amalgalite::Error )
+        @db.in_transaction?.should eql( true )
+        @db.rollback
+      end
+      @db.first_value_from( "SELECT count(*) FROM blobs" ).should eql( 0 )
+    end
+  end
+end
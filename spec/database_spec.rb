@@ -33,6 +33,31 @@ describe Amalgalite::Database do
     lambda { Amalgalite::Database.new( SpecInfo.test_db, "b+" ) }.should raise_error(Amalgalite::Database::InvalidModeError)
   end
 
+  it "applies the open settings as soon as it is opened" do
+    db = Amalgalite::Database.new( SpecInfo.test_db, "w+", :journal_mode => "wal", :synchronous => :normal,
+                                   :cache_size => -4000, :busy_timeout => 1500, :temp_store => "memory" )
+    db.pragma( "journal_mode" ).first[0].should eql( "wal" )
+    db.pragma( "synchronous" ).first[0].should eql( 1 )
+    db.pragma( "cache_size" ).first[0].should eql( -4000 )
+    db.pragma( "busy_timeout" ).first[0].should eql( 1500 )
+    db.pragma( "temp_store" ).first[0].should eql( 2 )
+    db.close
+    lambda { Amalgalite::Database.new( SpecInfo.test_db, "w+", :synchronous => "off; DROP TABLE t" ) }.should raise_error( ArgumentError )
+    lambda { Amalgalite::Database.new( SpecInfo.test_db, "w+", :busy_timeout => "1500" ) }.should raise_error( ArgumentError )
+    lambda { Amalgalite::Database.new( SpecInfo.test_db, "w+", :mmap_size => 2**64 ) }.should raise_error( ArgumentError )
+  end
+
+  it "opens an immutable database through a uri" do
+    db = Amalgalite::Database.new( SpecInfo.test_db )
+    db.execute( "CREATE TABLE t(a)" )
+    db.execute( "INSERT INTO t VALUES( 42 )" )
+    db.close
+
+    db = Amalgalite::Database.new( SpecInfo.test_db, "r", :immutable => true, :nomutex => true )
+    db.first_value_from( "SELECT a FROM t" ).should eql( 42 )
+    db.close
+  end
+
   it "can be in autocommit mode, and is by default" do
     @iso_db.autocommit?.should eql(true)
   end
@@ -128,6 +153,20 @@ describe Amalgalite::Database do
     s.string.should match(/unregistered as trace tap/)
   end
 
+  it "raises the exception of a trace tap once SQLite has returned" do
+    db  = Amalgalite::Database.new( SpecInfo.test_db )
+    tap = Object.new
+    def tap.trace( msg )
+      raise ArgumentError, "tap failed" if msg =~ /boom/
+    end
+    def tap.profile( msg, time ) ; end
+    db.trace_tap = tap
+    lambda { db.execute( "SELECT 'boom'" ) }.should raise_error( ArgumentError, "tap failed" )
+    db.trace_tap = nil
+    db.first_value_from( "SELECT 42" ).should eql( 42 )
+    db.close
+  end
+
   it "raises an exception if the wrong type of object is used for tracing" do
     db = Amalgalite::Database.new( SpecInfo.test_db )
     lambda { db.trace_tap = Object.new }.should raise_error(Amalgalite::Error)
@@ -142,6 +181,25 @@ describe Amalgalite::Database do
     s.string.should =~ /unregistered as trace tap/
   end
 
+  it "collects statement statistics by fingerprint" do
+    @iso_db.collect_query_stats = true
+    3.times { |i| @iso_db.execute( "SELECT * FROM subcountry WHERE level = ?", "no-such-#{i}" ) }
+    @iso_db.execute( "SELECT name FROM country LIMIT 5" )
+    @iso_db.collect_query_stats = false
+    @iso_db.collect_query_stats?.should be == false
+
+    stats = @iso_db.query_stats
+    scan  = stats.find { |s| s['fingerprint'] =~ /FROM subcountry WHERE level\s*=\s*\?/ }
+    scan['calls'].should eql( 3 )
+    scan['rows'].should eql( 0 )
+    scan['fullscan_steps'].should be > 3 * 3000
+    stats.find { |s| s['fingerprint'] =~ /FROM country/ }['rows'].should eql( 5 )
+
+    @iso_db.first_value_from( "SELECT sum(calls) FROM amalgalite_query_stats" ).should be >= 4
+    @iso_db.reset_query_stats!
+    @iso_db.query_stats.should be_empty
+  end
+
   it "#execute yields each row when called with a block" do
     count = 0
     @iso_db.execute( "SELECT * FROM country LIMIT 10") do |row|
@@ -474,6 +532,71 @@ describe Amalgalite::Database do
     val.should eql(3995)
   end
 
+  it "returns results column by column" do
+    cols = @iso_db.execute_columnar( "SELECT id, name FROM country WHERE id < ? ORDER BY id", 100 )
+    rows = @iso_db.execute( "SELECT id, name FROM country WHERE id < ? ORDER BY id", 100 )
+    cols.keys.should eql( %w[ id name ] )
+    cols['id'].unpack( "q*" ).should eql( rows.map { |r| r['id'] } )
+    cols['name'].should eql( rows.map { |r| r['name'] } )
+  end
+
+  it "keeps every column of a result that repeats a column name" do
+    sql  = "SELECT c.name, s.name, c.id FROM country c JOIN subcountry s ON s.country = c.two_letter WHERE c.two_letter = 'JP' ORDER BY s.name"
+    cols = @iso_db.execute_columnar( sql )
+    rows = @iso_db.execute( sql )
+    cols.keys.should eql( %w[ name name_2 id ] )
+    cols['name'].should eql( rows.map { |r| r[0] } )
+    cols['name_2'].should eql( rows.map { |r| r[1] } )
+    @iso_db.prepare( sql ) { |stmt| stmt.columns ; stmt.packed_columns.should eql( 'id' => :int64 ) }
+  end
+
+  it "packs only columns whose values are all integers or all floats" do
+    db = Amalgalite::Database.new( ":memory:" )
+    db.execute( "CREATE TABLE t(i, f, m)" )
+    db.execute( "INSERT INTO t VALUES( 1, 1.5, 1 )" )
+    db.execute( "INSERT INTO t VALUES( 2, 2.5, 2.5 )" )
+    db.prepare( "SELECT * FROM t ORDER BY i" ) do |stmt|
+      cols = stmt.columns
+      cols['i'].unpack( "q*" ).should eql( [ 1, 2 ] )
+      cols['f'].unpack( "d*" ).should eql( [ 1.5, 2.5 ] )
+      cols['m'].should eql( [ 1, 2.5 ] )
+      stmt.packed_columns.should eql( 'i' => :int64, 'f' => :double )
+    end
+    db.execute_columnar( "SELECT i FROM t", pack: false ).should eql( 'i' => [ 1, 2 ] )
+    db.close
+  end
+
+  it "converts columnar results with the type map instead of packing them" do
+    db = Amalgalite::Database.new( ":memory:" )
+    db.execute( "CREATE TABLE t(a INTEGER, b FLOAT, c)" )
+    db.execute( "INSERT INTO t VALUES( 1, 1.5, 'x' ), ( 2, 2.5, 'y' )" )
+    db.type_map = Amalgalite::TypeMaps::TextMap.new
+    2.times do
+      db.execute_columnar( "SELECT a, b, c FROM t" ).should eql( 'a' => %w[ 1 2 ], 'b' => %w[ 1.5 2.5 ], 'c' => %w[ x y ] )
+    end
+    db.close
+  end
+
+  it "converts columnar results with a custom type map" do
+    hundreds = Class.new( Amalgalite::TypeMaps::DefaultMap ) do
+      def result_value_of( declared_type, value )
+        value.kind_of?( Integer ) ? value * 100 : value
+      end
+    end
+    db = Amalgalite::Database.new( ":memory:" )
+    db.execute( "CREATE TABLE t(a INTEGER)" )
+    db.execute( "INSERT INTO t VALUES( 1 ), ( 2 )" )
+    db.type_map = hundreds.new
+    db.execute( "SELECT a FROM t" ).map { |row| row[0] }.should eql( [ 100, 200 ] )
+    2.times do
+      db.prepare( "SELECT a FROM t" ) do |stmt|
+        stmt.columns.should eql( 'a' => [ 100, 200 ] )
+        stmt.packed_columns.should be_empty
+      end
+    end
+    db.close
+  end
+
   it "replicates a database to memory" do
     mem_db = @iso_db.replicate_to( ":memory:" )
     @iso_db.close
@@ -492,6 +615,33 @@ describe Amalgalite::Database do
     fdb.execute("SELECT count(*) as cnt from subcountry").first['cnt'].should == all_sub
   end
 
+  it "backs up a database in steps, reporting progress" do
+    steps = []
+    mem_db = @iso_db.backup_to( ":memory:", pages_per_step: 10 ) { |remaining, total| steps << [ remaining, total ] }
+    steps.size.should be > 1
+    steps.last.first.should eql( 0 )
+    steps.map(&:last).uniq.size.should eql( 1 )
+    mem_db.first_value_from( "SELECT count(*) FROM subcountry" ).should eql( 3995 )
+    mem_db.close
+  end
+
+  it "restarts a backup when another connection writes to the source" do
+    writer  = Amalgalite::Database.new( @iso_db_path )
+    written = false
+    remaining = []
+    mem_db = @iso_db.backup_to( ":memory:", pages_per_step: 10, progress: lambda { |left, total|
+      remaining << left
+      unless written then
+        writer.execute( "DELETE FROM subcountry WHERE country = 'US'" )
+        written = true
+      end
+    } )
+    writer.close
+    remaining.each_cons( 2 ).any? { |a, b| b >= a }.should be == true
+    mem_db.first_value_from( "SELECT count(*) FROM subcountry WHERE country = 'US'" ).should eql( 0 )
+    mem_db.close
+  end
+
   it "raises an error if it is given an invalid location to replicate to" do
     lambda { @iso_db.replicate_to( false ) }.should raise_error( ArgumentError, /must be a String or a Database/ )
   end
@@ -502,4 +652,30 @@ describe Amalgalite::Database do
     db.first_value_from("SELECT stuff FROM things").should == "foobar"
   end
 
+  it "knows which columns are the rowid of a table" do
+    db = Amalgalite::Database.new(":memory:")
+    db.execute( "CREATE TABLE t1( id INTEGER PRIMARY KEY, a TEXT, oid TEXT )" )
+    db.execute( "CREATE TABLE t2( id INT PRIMARY KEY, a TEXT )" )
+    db.rowid_column?( "main", "t1", "id" ).should be == true
+    db.rowid_column?( "main", "t1", "a" ).should be == false
+    db.rowid_column?( "main", "t1", "oid" ).should be == false
+    db.rowid_column?( "main", "t2", "id" ).should be == false
+    db.rowid_column?( "main", "t2", "rowid" ).should be == true
+    db.rowid_column?( "main", "t3", "rowid" ).should be == false
+    db.execute( "CREATE TABLE t3( x )" )
+    db.rowid_column?( "main", "t3", "rowid" ).should be == true
+    db.close
+  end
+
+  it "sees schema changes made inside a transaction" do
+    db = Amalgalite::Database.new(":memory:")
+    version = db.api.schema_version
+    db.api.schema_version.should be == version
+    db.transaction do
+      db.execute( "CREATE TABLE t1( x )" )
+      db.api.schema_version.should_not be == version
+    end
+    db.close
+  end
+
 end
@@ -85,4 +85,51 @@ describe Amalgalite::TypeMaps::DefaultMap do
       lambda{ @map.result_value_of( "footype", 1..3 ) }.should raise_error( ::Amalgalite::Error )
     end
   end
+
+  describe "#result_conversion_of" do
+    it "uses native conversions for strings, floats and integers" do
+      @map.result_conversion_of( nil ).should == nil
+      @map.result_conversion_of( "varchar" ).should == nil
+      @map.result_conversion_of( "real" ).should == :float
+      @map.result_conversion_of( "bigint" ).should == :integer
+      @map.result_conversion_of( "date" ).should == :date
+      @map.result_conversion_of( "datetime" ).should == :datetime
+      @map.result_conversion_of( "timestamp" ).should == :time
+    end
+
+    it "falls back to result_value_of for everything else" do
+      @map.result_conversion_of( "bool" ).call( "true" ).should == true
+      lambda { @map.result_conversion_of( "footype" ).call( "foo" ) }.should raise_error( ::Amalgalite::Error )
+    end
+
+    it "falls back to result_value_of for conversion methods overridden in a subclass" do
+      map = Class.new( Amalgalite::TypeMaps::DefaultMap ) { def float( str ) "overridden" end }.new
+      map.result_conversion_of( "real" ).call( "3.14" ).should == "overridden"
+    end
+  end
+
+  describe "dates and times" do
+    it "parses ISO-8601 strings natively" do
+      Amalgalite::SQLite3.parse_date( "2008-04-01" ).should == Date.new( 2008, 4, 1 )
+      Amalgalite::SQLite3.parse_datetime( "2008-04-01T12:34:56.5+05:30" ).should == DateTime.new( 2008, 4, 1, 12, 34, Rational( 113, 2 ), "+05:30" )
+      Amalgalite::SQLite3.parse_time( "2008-04-01 12:34:56 UTC" ).should == Time.utc( 2008, 4, 1, 12, 34, 56 )
+      Amalgalite::SQLite3.parse_time( "2008-04-01 12:34:56 -0700" ).utc_offset.should == -7 * 3600
+    end
+
+    it "leaves strings that are not strict ISO-8601 to the ruby parsers" do
+      Amalgalite::SQLite3.parse_date( "April 1, 2008" ).should == nil
+      Amalgalite::SQLite3.parse_date( "2008-02-30" ).should == nil
+      Amalgalite::SQLite3.parse_datetime( "2020-01-01 10:00:00 +05:" ).should == nil
+      Amalgalite::SQLite3.parse_datetime( "2020-01-01 10:00:00 +05:3" ).should == nil
+      Amalgalite::SQLite3.parse_time( "2020-01-01 10:00:00 +05" ).utc_offset.should == 5 * 3600
+      @map.result_value_of( "date", "April 1, 2008" ).should == Date.new( 2008, 4, 1 )
+    end
+
+    it "formats times and dates the same as to_s" do
+      [ Time.now, Time.now.utc, Time.new( 2008, 4, 1, 12, 34, 56, "-07:00" ),
+        Date.new( 2008, 4, 1 ), DateTime.new( 2008, 4, 1, 12, 34, 56, "+05:30" ) ].each do |t|
+        Amalgalite::SQLite3.format_time( t ).should == t.to_s
+      end
+    end
+  end
 end
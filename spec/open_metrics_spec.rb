@@ -0,0 +1,44 @@
+require 'spec_helper'
+
+describe Amalgalite::OpenMetrics do
+  before(:each) do
+    @db = Amalgalite::Database.new( SpecInfo.test_db )
+    @db.execute( "CREATE TABLE t(a, b)" )
+    10.times { |x| @db.execute( "INSERT INTO t(a, b) VALUES (?, ?)", x, x + 1 ) }
+  end
+
+  after(:each) do
+    @db.close
+  end
+
+  it "reports the library and each connection's counters" do
+    other   = Amalgalite::Database.new( ":memory:" )
+    metrics = Amalgalite::OpenMetrics.new
+    metrics.register( @db, "database" => "test" ).register( other, "database" => "mem\"ory" )
+    text = metrics.to_s
+
+    text.should =~ /^sqlite_memory_used_bytes \d+$/
+    text.should =~ /^# TYPE sqlite_cache_hit counter$/
+    text.should =~ /^sqlite_cache_hit_total\{database="test"\} \d+$/
+    text.should =~ /^sqlite_schema_used_bytes\{database="mem\\"ory"\} \d+$/
+    text.scan( /^# TYPE sqlite_cache_miss / ).size.should eql( 1 )
+    text.should =~ /\n# EOF\n\z/
+
+    other.close
+    metrics.size.should eql( 2 )
+    metrics.to_s.should_not =~ /mem\\"ory/
+    metrics.size.should eql( 1 )
+  end
+
+  it "reads all of the database status counters at once" do
+    counters = @db.api.status.to_h
+    counters[:cache_hit].should eql( [ @db.api.status.cache_hit.current, 0 ] )
+    counters[:stmt_used].first.should be > 0
+  end
+
+  it "reads all of the library status counters at once" do
+    counters = Amalgalite::SQLite3.status.to_h
+    counters[:memory_used].first.should be > 0
+    counters[:memory_used].last.should be >= counters[:memory_used].first
+  end
+end
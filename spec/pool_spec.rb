@@ -0,0 +1,64 @@
+require 'spec_helper'
+
+describe Amalgalite::Pool do
+  before(:each) do
+    @pool = Amalgalite::Pool.new( SpecInfo.test_db, :readers => 2, :timeout => 0.2, :busy_timeout => 1000 )
+    @pool.write( "CREATE TABLE t(a)" )
+  end
+
+  after(:each) do
+    @pool.close
+  end
+
+  it "routes transactions to the writer while readers see the last commit" do
+    @pool.transaction do |db|
+      db.execute( "INSERT INTO t(a) VALUES (1)" )
+      Thread.new { @pool.read( "SELECT count(*) FROM t" ).first[0] }.value.should eql( 0 )
+    end
+    @pool.read( "SELECT count(*) FROM t" ).first[0].should eql( 1 )
+    lambda { @pool.read( "INSERT INTO t(a) VALUES (2)" ) }.should raise_error( Amalgalite::SQLite3::Error )
+  end
+
+  it "times out checkouts when every connection is in use" do
+    readers = [ @pool.checkout, @pool.checkout ]
+    @pool.available.should eql( 0 )
+    lambda { @pool.checkout }.should raise_error( Amalgalite::Pool::TimeoutError )
+
+    writer = @pool.checkout_writer
+    Thread.new { lambda { @pool.checkout_writer }.should raise_error( Amalgalite::Pool::TimeoutError ) }.join
+
+    readers.each { |db| @pool.checkin( db ) }
+    @pool.checkin( writer )
+    @pool.with_reader { |db| readers.should include( db ) }
+  end
+
+  it "never opens more readers than it was asked for" do
+    size = 0
+    20.times.map do
+      Thread.new do
+        @pool.with_reader( 5 ) { size = [ size, @pool.size ].max ; sleep 0.01 }
+      end
+    end.each( &:join )
+    size.should eql( 2 )
+    @pool.available.should eql( 2 )
+  end
+
+  it "refuses connections that are not checked out of it" do
+    db = @pool.checkout
+    @pool.checkin( db )
+    lambda { @pool.checkin( db ) }.should raise_error( Amalgalite::Error )
+    lambda { @pool.checkin( @iso_db ) }.should raise_error( Amalgalite::Error )
+    [ @pool.checkout, @pool.checkout ].uniq.size.should eql( 2 )
+  end
+
+  it "rolls back and replaces connections given back in a bad state" do
+    db = @pool.checkout
+    db.execute( "BEGIN" )
+    db.execute( "SELECT * FROM t" )
+    @pool.checkin( db )
+    db.autocommit?.should eql( true )
+
+    db.close
+    @pool.with_reader { |other| other.should be_open }
+  end
+end
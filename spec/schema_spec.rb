@@ -112,6 +112,18 @@ describe Amalgalite::Schema do
     s.dirty?.should be == true
   end
 
+  it "reloads only the tables that changed" do
+    s = @iso_db.schema
+    country = s.tables['country']
+    @iso_db.execute( "create table x1( a, b )" )
+    @iso_db.execute( "drop table subcountry" )
+    s = @iso_db.schema
+    s.dirty?.should be == false
+    s.tables['country'].should equal( country )
+    s.tables['x1'].columns.keys.sort.should be == %w[ a b ]
+    s.tables.keys.include?('subcountry').should be == false
+  end
+
   it "knows if a temporary table exists" do
     @iso_db.execute "CREATE TEMPORARY TABLE tt(a,b,c)"
     @iso_db.schema.tables.keys.include?('tt').should be == true
@@ -0,0 +1,100 @@
+require 'spec_helper'
+require 'amalgalite/sqlite3'
+require 'rbconfig'
+require 'open3'
+
+describe "Amalgalite::SQLite3 memory configuration" do
+  # other specs leave databases open, so the memory is configured in a ruby of
+  # its own.  Returns what the script printed, and raises with what it wrote
+  # to stderr if it failed.
+  def run_script( script )
+    args = $LOAD_PATH.map { |path| "-I#{path}" }
+    output, errors, status = Open3.capture3( RbConfig.ruby, *args, "-e", script )
+    raise "the script failed, #{status}:\n#{errors}" unless status.success?
+    return output
+  end
+
+  it "cannot be changed while a database is open" do
+    db = Amalgalite::Database.new( ":memory:" )
+    lambda { Amalgalite::SQLite3.configure_memory( allocator: :pool ) }.should raise_error( ::Amalgalite::SQLite3::Error, /connections are open/ )
+    db.close
+  end
+
+  it "installs the pool allocator and reports the memory of SQLite to the GC" do
+    script = <<-code
+      require 'amalgalite'
+      Amalgalite::SQLite3.configure_memory( allocator: :pool, gc_accounting: true, lookaside: [ 128, 64 ] )
+      db = Amalgalite::Database.new( ":memory:" )
+      db.execute( "CREATE TABLE t(a, b)" )
+      db.transaction { 1000.times { |i| db.execute( "INSERT INTO t VALUES( ?, ? )", i, "x" * 200 ) } }
+      config = Amalgalite::SQLite3.memory_configuration
+      p [ config[:allocator], config[:lookaside], config[:gc_bytes] > 200_000, db.first_value_from( "SELECT sum( length( b ) ) FROM t" ) ]
+      db.close
+    code
+    output = run_script( script )
+    output.lines.last.should eql( "[:pool, [128, 64], true, 200000]\n" )
+  end
+
+  it "does not count a connection that failed to open" do
+    script = <<-code
+      require 'amalgalite'
+      begin
+        Amalgalite::Database.new( "#{SpecInfo.test_db}-missing", "r" )
+      rescue Amalgalite::SQLite3::Error
+        Amalgalite::SQLite3.configure_memory( allocator: :pool )
+        p Amalgalite::SQLite3.memory_configuration[:allocator]
+      end
+    code
+    output = run_script( script )
+    output.lines.last.should eql( ":pool\n" )
+  end
+
+  it "shares one budgeted page cache between the connections" do
+    script = <<-code
+      require 'amalgalite'
+      Amalgalite::SQLite3.configure_page_cache( budget: 256 * 1024 )
+      dbs = [ "#{SpecInfo.test_db}", "#{SpecInfo.test_db}-2" ].map { |f| Amalgalite::Database.new( f ) }
+      dbs.each do |db|
+        db.execute( "CREATE TABLE t(a, b)" )
+        db.transaction { 2000.times { |i| db.execute( "INSERT INTO t VALUES( ?, ? )", i, "x" * 200 ) } }
+      end
+      counts = dbs.map { |db| db.first_value_from( "SELECT count(*) FROM t WHERE length( b ) = 200" ) }
+      stats  = Amalgalite::SQLite3.page_cache_stats
+      p [ counts, stats[:used] <= stats[:budget], stats[:evictions] > 0, stats[:hits] > 0 ]
+      dbs.each { |db| db.close }
+      Amalgalite::SQLite3.configure_page_cache( budget: nil )
+      p Amalgalite::SQLite3.page_cache_stats
+    code
+    output = run_script( script )
+    ::FileUtils.rm_f( "#{SpecInfo.test_db}-2" )
+    output.lines.last( 2 ).should eql( [ "[[2000, 2000], true, true, true]\n", "nil\n" ] )
+  end
+
+  it "keeps the page cache it had when preallocating a new one fails" do
+    script = <<-code
+      require 'amalgalite'
+      Amalgalite::SQLite3.configure_page_cache( budget: 256 * 1024 )
+      begin
+        Amalgalite::SQLite3.configure_page_cache( budget: 1 << 60, preallocate: true )
+      rescue Amalgalite::SQLite3::Error
+        db = Amalgalite::Database.new( ":memory:" )
+        p [ Amalgalite::SQLite3.page_cache_stats[:budget], db.first_value_from( "SELECT 1" ) ]
+        db.close
+      end
+    code
+    output = run_script( script )
+    output.lines.last.should eql( "[262144, 1]\n" )
+  end
+
+  it "sizes the lookaside memory of a connection" do
+    db = Amalgalite::Database.new( ":memory:" )
+    db.configure_lookaside( 256, 32 )
+    db.execute( "CREATE TABLE t(a)" )
+    db.api.status.to_h[:lookaside_used].last.should be <= 32
+    db.close
+  end
+
+  it "rejects an unknown allocator" do
+    lambda { Amalgalite::SQLite3.configure_memory( allocator: :arena ) }.should raise_error( ArgumentError )
+  end
+end
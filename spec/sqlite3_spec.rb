@@ -3,8 +3,12 @@ require 'amalgalite/sqlite3'
 require 'rbconfig'
 
 describe "Amalgalite::SQLite3" do
-  it "is threadsafe is ruby is compiled with pthread support, in this case that is (#{RbConfig::CONFIG['configure_args'].include?( "--enable-pthread" )})" do
-    Amalgalite::SQLite3.threadsafe?.should eql(RbConfig::CONFIG['configure_args'].include?( "--enable-pthread" ))
+  it "is threadsafe" do
+    Amalgalite::SQLite3.threadsafe?.should eql(true)
+  end
+
+  it "releases the GVL by default" do
+    Amalgalite::SQLite3.release_gvl?.should eql(true)
   end
 
   it "knows if an SQL statement is complete" do
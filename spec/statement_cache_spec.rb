@@ -0,0 +1,70 @@
+require 'spec_helper'
+
+describe Amalgalite::StatementCache do
+  before(:each) do
+    @db = Amalgalite::Database.new( ":memory:", "w+", :statement_cache_size => 3 )
+    @db.execute( "CREATE TABLE t(x, y)" )
+    @db.execute( "INSERT INTO t VALUES( 1, 'one' )" )
+    @cache = @db.statement_cache
+    @cache.clear
+    @cache.reset_counters!
+  end
+
+  after(:each) do
+    @db.close
+  end
+
+  it "reuses statements for the same sql" do
+    @db.first_value_from( "SELECT y FROM t WHERE x = ?", 1 ).should eql( "one" )
+    @cache.misses.should be > 0
+    @cache.reset_counters!
+    2.times { @db.first_value_from( "SELECT y FROM t WHERE x = ?", 1 ).should eql( "one" ) }
+    @cache.misses.should eql( 0 )
+    @cache.hits.should eql( 2 )
+  end
+
+  it "evicts the least recently used statement when it is full" do
+    @db.execute( "SELECT 1" )
+    @db.execute( "SELECT 2" )
+    @db.execute( "SELECT 3" )
+    @db.execute( "SELECT 1" )
+    @db.execute( "SELECT 4" )
+    @cache.evictions.should eql( 1 )
+    @db.execute( "SELECT 1" )
+    @db.execute( "SELECT 2" )
+    @cache.stats.should == { :capacity => 3, :size => 3, :hits => 2, :misses => 5, :evictions => 2, :invalidations => 0 }
+  end
+
+  it "is emptied when the schema changes" do
+    @db.first_row_from( "SELECT * FROM t" ).to_a.should eql( [ 1, "one" ] )
+    @db.execute( "ALTER TABLE t ADD COLUMN z" )
+    @db.first_row_from( "SELECT * FROM t" ).to_a.should eql( [ 1, "one", nil ] )
+    @cache.invalidations.should eql( 1 )
+  end
+
+  it "hands out statements that notice schema changes it is not emptied for" do
+    @db.execute( "CREATE TEMP TABLE tt(a INTEGER)" )
+    @db.execute( "INSERT INTO tt VALUES( 1 )" )
+    @db.execute_with( { :as => :struct }, "SELECT * FROM tt" ).first.to_a.should eql( [ 1 ] )
+    @db.execute( "ALTER TABLE tt ADD COLUMN b TEXT DEFAULT 'b'" )
+    @db.execute_with( { :as => :struct }, "SELECT * FROM tt" ).first.to_h.should == { :a => 1, :b => "b" }
+    @db.first_row_from( "SELECT * FROM tt" ).to_a.should eql( [ 1, "b" ] )
+    @cache.hits.should be > 0
+  end
+
+  it "may be used re-entrantly" do
+    rows = []
+    @db.execute( "SELECT x FROM t" ) do |row|
+      rows << @db.first_value_from( "SELECT x FROM t" )
+    end
+    rows.should eql( [ 1 ] )
+  end
+
+  it "can be disabled" do
+    db = Amalgalite::Database.new( ":memory:", "w+", :statement_cache_size => 0 )
+    db.execute( "SELECT 1" )
+    db.statement_cache.size.should eql( 0 )
+    db.statement_cache.misses.should eql( 0 )
+    db.close
+  end
+end
@@ -103,6 +103,51 @@ describe Amalgalite::Statement do
  
   end
 
+  it "knows the index of each named parameter when it is prepared" do
+    stmt = @db.api.prepare( "SELECT ?, :a, @b, $c, :a" )
+    stmt.parameter_indexes.should == { ":a" => 2, :":a" => 2, "@b" => 3, :"@b" => 3, "$c" => 4, :"$c" => 4 }
+    stmt.close
+  end
+
+  it "binds arrays and hashes of parameters in the extension" do
+    @db.execute( "CREATE TABLE t(i, f, s, n, d, b)" )
+    @db.prepare( "INSERT INTO t VALUES( :i, :f, :s, :n, :d, :b )" ) do |stmt|
+      stmt.execute( ":i" => 2**40, ":f" => 4.2, :":s" => "forty two", ":n" => nil,
+                    ":d" => Date.new( 2008, 4, 1 ), ":b" => Amalgalite::Blob.new( :string => "\0\1" ) )
+      stmt.execute( [ 1, 1.5, :sym, nil, Time.utc( 2008, 4, 1 ), Amalgalite::Blob.new( :string => "\2" ) ] )
+    end
+    rows = @db.execute( "SELECT typeof(i), i, f, s, n, d, hex(b) FROM t" ).map { |r| r.to_a }
+    rows.should eql( [ [ "integer", 2**40, 4.2, "forty two", nil, "2008-04-01", "0001" ],
+                       [ "integer", 1, 1.5, "sym", nil, "2008-04-01 00:00:00 UTC", "02" ] ] )
+  end
+
+  it "binds parameters in ruby when the type map overrides bind_type_of" do
+    @db.type_map = Amalgalite::TypeMaps::TextMap.new
+    @db.execute( "CREATE TABLE t(x)" )
+    @db.execute( "INSERT INTO t VALUES( ? )", 42 )
+    @db.first_value_from( "SELECT typeof(x) FROM t" ).should eql( "text" )
+  end
+
+  it "executes a statement for each of many rows" do
+    @db.execute( "CREATE TABLE t(x integer, y text)" )
+    rows = ( 1..25 ).map { |i| [ i, "row #{i}" ] }
+    rows[10] = { ":x" => 11, ":y" => "row 11" }
+    rows[12] = [ 13, Amalgalite::Blob.new( :string => "row 13" ) ]
+    @db.prepare( "INSERT INTO t VALUES( :x, :y )" ) do |stmt|
+      stmt.execute_many( rows.each, batch_size: 7 ).should eql( 25 )
+    end
+    @db.execute( "SELECT x, CAST( y AS text ) FROM t ORDER BY x" ).map { |r| r.to_a }.should eql( ( 1..25 ).map { |i| [ i, "row #{i}" ] } )
+  end
+
+  it "stops executing many rows at the first failure" do
+    @db.execute( "CREATE TABLE t(x unique)" )
+    @db.prepare( "INSERT INTO t VALUES( ? )" ) do |stmt|
+      lambda { stmt.execute_many( [ 1, 2, 2, 3 ] ) }.should raise_error( Amalgalite::SQLite3::Error, /UNIQUE/ )
+      lambda { stmt.execute_many( [ [ 4, 5 ] ] ) }.should raise_error( Amalgalite::Error )
+    end
+    @db.execute( "SELECT x FROM t" ).map { |r| r.first }.should eql( [ 1, 2 ] )
+  end
+
   it "binds a integer variable correctly" do
     @iso_db.prepare("SELECT * FROM country WHERE id = ? ORDER BY name ") do |stmt|
       all_rows = stmt.execute( 891 )
@@ -165,4 +210,135 @@ describe Amalgalite::Statement do
       all_rows.first[1].should eql("CS")
     end
   end
+
+  it "fetches a whole row of raw values in a single step" do
+    @db.execute( "CREATE TABLE t(i integer, f real, s text, b blob, n)" )
+    @db.execute( "INSERT INTO t VALUES( 42, 4.2, 'forty two', x'00ff', NULL )" )
+    stmt = @db.api.prepare( "SELECT * FROM t" )
+    values = []
+    types  = []
+    stmt.step_row( values, types ).should eql( Amalgalite::SQLite3::Constants::ResultCode::ROW )
+    values.should eql( [ 42, 4.2, "forty two", "\x00\xff".b, nil ] )
+    types.should eql( [ Amalgalite::SQLite3::Constants::DataType::INTEGER,
+                        Amalgalite::SQLite3::Constants::DataType::FLOAT,
+                        Amalgalite::SQLite3::Constants::DataType::TEXT,
+                        Amalgalite::SQLite3::Constants::DataType::BLOB,
+                        Amalgalite::SQLite3::Constants::DataType::NULL ] )
+    stmt.step_row( values ).should eql( Amalgalite::SQLite3::Constants::ResultCode::DONE )
+    stmt.close
+  end
+
+  it "fetches rows in batches" do
+    @iso_db.prepare( "SELECT two_letter FROM country ORDER BY two_letter" ) do |stmt|
+      expected = @iso_db.execute( "SELECT two_letter FROM country ORDER BY two_letter" ).map { |r| r.first }
+      first = stmt.fetch_many( 10 )
+      first.size.should eql( 10 )
+      first.map { |r| r['two_letter'] }.should eql( expected[0,10] )
+
+      rest = stmt.fetch_many( expected.size )
+      rest.size.should eql( expected.size - 10 )
+      rest.last.first.should eql( expected.last )
+    end
+  end
+
+  it "counts the rows and full scan steps of a statement" do
+    @iso_db.prepare( "SELECT * FROM subcountry WHERE level = 'state'" ) do |stmt|
+      rows = stmt.execute
+      stats = stmt.stats
+      stats[:rows].should eql( rows.size )
+      stats[:fullscan_step].should be > 0
+      stats[:run].should eql( 1 )
+
+      stmt.stats( true )
+      stats = stmt.stats
+      stats[:rows].should eql( 0 )
+      stats[:fullscan_step].should eql( 0 )
+    end
+  end
+
+  it "reports the counters of every open statement of the database" do
+    @iso_db.execute( "SELECT count(*) FROM subcountry WHERE level = 'state'" )
+    stats = @iso_db.statement_stats.find { |s| s[:sql] == "SELECT count(*) FROM subcountry WHERE level = 'state'" }
+    stats[:fullscan_step].should be > 0
+    stats[:busy].should eql( false )
+  end
+
+  it "iterates over the result set in slices" do
+    @iso_db.prepare( "SELECT id FROM country WHERE id < 100 ORDER BY id" ) do |stmt|
+      slices = []
+      stmt.each_slice( 7 ) { |rows| slices << rows.map { |r| r.first } }
+      slices[0...-1].each { |slice| slice.size.should eql( 7 ) }
+      slices.flatten.should eql( @iso_db.execute( "SELECT id FROM country WHERE id < 100 ORDER BY id" ).map { |r| r.first } )
+    end
+  end
+
+  it "converts the result values with the conversion plan of the type map" do
+    @db.execute( "CREATE TABLE t(i integer, f real, s varchar, d date, n)" )
+    @db.execute( "INSERT INTO t VALUES( '42', '4.2', 'forty two', '2008-04-01', NULL )" )
+    @db.execute( "INSERT INTO t VALUES( 7.9, 3, 'seven', NULL, 1 )" )
+    @db.execute( "SELECT * FROM t" ).map { |r| r.to_a }.should eql( [ [ 42, 4.2, "forty two", Date.new( 2008, 4, 1 ), nil ],
+                                                                    [ 7.9, 3.0, "seven", nil, 1 ] ] )
+    @db.type_map = Amalgalite::TypeMaps::TextMap.new
+    @db.execute( "SELECT * FROM t" ).map { |r| r.to_a }.should eql( [ [ "42", "4.2", "forty two", "2008-04-01", "" ],
+                                                                    [ "7.9", "3.0", "seven", "", "1" ] ] )
+  end
+  it "returns text as UTF-8" do
+    value = @db.first_value_from( "SELECT 'caf' || char( 233 )" )
+    value.encoding.should eql( Encoding::UTF_8 )
+    value.should eql( "caf\u00e9" )
+  end
+
+  it "interns the values of the requested columns" do
+    rows = @iso_db.execute_with( { intern: %w[ country ] }, "SELECT s.country, s.name FROM subcountry s WHERE s.country IN ( 'US', 'JP' )" )
+    us = rows.select { |r| r['country'] == "US" }.map { |r| r['country'] }
+    us.size.should be > 1
+    us.each { |c| c.should be_frozen ; c.should equal( us.first ) }
+    rows.first['name'].should_not be_frozen
+  end
+
+  describe "row types" do
+    it "returns rows as a Struct generated for the result" do
+      rows = @iso_db.execute_with( { as: :struct }, "SELECT name, two_letter FROM country WHERE two_letter IN ( :a, :b ) ORDER BY name",
+                                   ":a" => "JP", ":b" => "US" )
+      rows.map( &:two_letter ).should eql( %w[ JP US ] )
+      rows.first.should be_kind_of( Struct )
+      rows.first.class.should equal( @iso_db.row_class_for( :struct, %w[ name two_letter ] ) )
+      @iso_db.first_row_from( "SELECT name, two_letter FROM country WHERE two_letter = 'JP'" ).should be_kind_of( Amalgalite::Result::Row )
+    end
+
+    it "names repeated columns by their occurrence" do
+      row = @iso_db.first_row_with( { as: :struct }, "SELECT 1 AS a, 2 AS a, 3 AS b, 4 AS a" )
+      row.to_a.should eql( [ 1, 2, 3, 4 ] )
+      row.class.members.should eql( [ :a, :a_2, :b, :a_3 ] )
+      @iso_db.unique_field_names( %w[ a a a_2 ] ).should eql( %w[ a a_3 a_2 ] )
+    end
+
+    it "returns rows as instances of a given class" do
+      klass = Class.new do
+        attr_reader :name, :code
+        def initialize( name, code ) ; @name, @code = name, code ; end
+      end
+      @iso_db.prepare( "SELECT name, two_letter FROM country WHERE two_letter = ?" ) do |stmt|
+        row = stmt.execute_with( { as: klass }, "JP" ).first
+        row.should be_kind_of( klass )
+        row.code.should eql( "JP" )
+        stmt.row_type.should equal( klass )
+      end
+    end
+
+    it "raises an error for an unknown row type" do
+      @iso_db.prepare( "SELECT 1" ) do |stmt|
+        lambda { stmt.row_type = :hash }.should raise_error( Amalgalite::Error, /Unknown row type/ )
+        lambda { stmt.execute_with( { as: :struct, shape: :wide } ) }.should raise_error( ArgumentError, /shape/ )
+      end
+    end
+
+    it "still binds named parameters called as and intern" do
+      @iso_db.execute( "SELECT :as, :intern", ":as" => 5, ":intern" => "x" ).first.to_a.should eql( [ 5, "x" ] )
+      @iso_db.first_row_from( "SELECT :as", ":as": 5 ).to_a.should eql( [ 5 ] )
+      @iso_db.prepare( "SELECT :as" ) { |stmt| stmt.execute( ":as" => 5 ).first.to_a.should eql( [ 5 ] ) }
+      lambda { @iso_db.execute( "SELECT 1", as: :struct ) }.should raise_error( Amalgalite::Error, /parameters/ )
+    end
+  end
+
 end
@@ -30,7 +30,7 @@ describe Amalgalite::Taps::StringIO do
     s = ::Amalgalite::Taps::StringIO.new
     s.profile( 'test', 42 )
     s.dump_profile
-    s.string.should eql("42 : test\n[test] => sum: 42, sumsq: 1764, n: 1, mean: 42.000000, stddev: 0.000000, min: 42, max: 42\n")
+    s.string.should eql("42 : test\n[test] => sum: 42, sumsq: 1764, n: 1, mean: 42.000000, stddev: 0.000000, min: 42, max: 42, p50: 42, p90: 42, p99: 42, p999: 42\n")
   end
 
   it "has a stdout tap" do
@@ -53,5 +53,44 @@ describe Amalgalite::ProfileSampler do
     h['max'].should eql(84)
     h['mean'].should eql(49.0)
     h['n'].should eql(3)
+    h['p50'].should eql(42)
+    h['p99'].should eql(84)
+  end
+
+  it "merges snapshots of other samplers" do
+    a = Amalgalite::ProfileSampler.new( 'a' )
+    b = Amalgalite::ProfileSampler.new( 'b' )
+    1.upto( 900 ) { |i| a.sample( i ) }
+    901.upto( 1000 ) { |i| b.sample( i * 1000 ) }
+    snapshot = a.dup.merge!( b )
+    a.n.should eql( 900 )
+    snapshot.n.should eql( 1000 )
+    snapshot.max.should eql( 1_000_000 )
+    snapshot.percentile( 50 ).should be_within( 500 * 0.016 ).of( 500 )
+    snapshot.percentile( 99 ).should be_within( 990_000 * 0.016 ).of( 990_000 )
+  end
+end
+
+describe Amalgalite::Histogram do
+  it "reports percentiles to within 1 part in 64" do
+    h = Amalgalite::Histogram.new
+    1.upto( 100_000 ) { |i| h.record( i * 37 ) }
+    h.count.should eql( 100_000 )
+    h.min.should eql( 37 )
+    h.max.should eql( 3_700_000 )
+    { 50 => 1_850_000, 90 => 3_330_000, 99 => 3_663_000, 99.9 => 3_696_300 }.each_pair do |p, exact|
+      h.percentile( p ).should be_within( exact / 64 ).of( exact )
+      h.percentile( p ).should be >= exact
+    end
+    h.percentile( 100 ).should eql( 3_700_000 )
+  end
+
+  it "refuses values that are not finite" do
+    h = Amalgalite::Histogram.new
+    [ Float::NAN, Float::INFINITY, -Float::INFINITY ].each do |v|
+      lambda { h.record( v ) }.should raise_error( ArgumentError )
+    end
+    h.record( 1.6 ).count.should eql( 1 )
+    h.max.should eql( 2 )
   end
 end
@@ -0,0 +1,83 @@
+require 'spec_helper'
+
+describe "Amalgalite and ruby threads" do
+  # a query that keeps sqlite busy without calling back into ruby
+  def counting_query( count, result = "count(*)" )
+    "WITH RECURSIVE c(x) AS (SELECT 1 UNION ALL SELECT x+1 FROM c WHERE x < #{count}) SELECT #{result} FROM c"
+  end
+
+  def now
+    Process.clock_gettime( Process::CLOCK_MONOTONIC )
+  end
+
+  before(:each) do
+    @dbs = Array.new( 2 ) { Amalgalite::Database.new( ":memory:" ) }
+  end
+
+  after(:each) do
+    @dbs.each { |db| db.close }
+  end
+
+  it "lets other ruby threads run while a query is stepping" do
+    started = Queue.new
+    timing  = {}
+    long = Thread.new do
+      started << true
+      timing[:start] = now
+      @dbs[0].first_value_from( counting_query( 2_000_000 ) )
+      timing[:finish] = now
+    end
+
+    started.pop
+    sleep 0.1
+    @dbs[1].first_value_from( "SELECT 42" ).should eql( 42 )
+    during = now
+    long.join
+
+    during.should be > timing[:start]
+    during.should be < timing[:finish]
+  end
+
+  it "overlaps concurrent queries on separate connections" do
+    timings = Array.new( 2 ) { {} }
+    threads = @dbs.each_with_index.map do |db, i|
+      Thread.new do
+        timings[i][:start] = now
+        db.first_value_from( counting_query( 1_000_000 ) ).should eql( 1_000_000 )
+        timings[i][:finish] = now
+      end
+    end
+    threads.each { |t| t.join }
+
+    a, b = timings
+    a[:start].should be < b[:finish]
+    b[:start].should be < a[:finish]
+  end
+
+  it "interrupts a running query when the thread is killed" do
+    started = Queue.new
+    long = Thread.new do
+      started << true
+      @dbs[0].first_value_from( counting_query( 1_000_000_000 ) )
+    end
+
+    started.pop
+    sleep 0.1
+    before = now
+    long.kill
+    long.join( 10 ).should_not eql( nil )
+    ( now - before ).should be < 5
+  end
+
+  it "calls ruby functions from a query that runs without the GVL" do
+    @dbs.each do |db|
+      db.define_function( "plus_one" ) { |x| x + 1 }
+    end
+    threads = @dbs.map do |db|
+      Thread.new do
+        db.first_value_from( counting_query( 1_000, "sum(plus_one(x))" ) )
+      end
+    end
+    threads.map { |t| t.value }.should eql( [ 501_500, 501_500 ] )
+  end
+end